@@ -0,0 +1,183 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+// Benchmarks cullBin on the cells of TiledRendering with a scene of many
+// random instances, scalar against SSE2, checks that both bin the same
+// instances, and checks that every instance lands in the cell under its
+// center.  Reports how many cell draws the bins leave.
+//
+// Usage: CellCulling [-n instances] [-r rows] [-c columns]
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "warp.h"
+#include "cull.h"
+
+const int Frames = 100;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float Random(float lo, float hi)
+{
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+// The cell edges of TiledRendering's GridPoints, in normalized device
+// coordinates; they are squeezed towards the center like the grid.
+static void Edges(float* edges, int count, int pixels)
+{
+    for (int k = 0; k <= count; k++) {
+        float u = 2.0f * k / count - 1.0f;
+        u = (u * fabsf(u) + 1.0f) / 2.0f;
+        edges[k] = floorf(u * pixels) * 2.0f / pixels - 1.0f;
+    }
+}
+
+static double Bin(const CullGrid* grid, const CullSphere* spheres, int count, CullBins* bins)
+{
+    double start = Now();
+    for (int f = 0; f < Frames; f++) {
+        if (!cullBin(grid, spheres, count, bins)) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    return (Now() - start) / Frames;
+}
+
+static int Find(const float* edges, int count, float x)
+{
+    for (int k = 0; k < count; k++) {
+        if (x >= edges[k] && x < edges[k + 1]) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    int count = 4096, rows = 20, columns = 36;
+    for (int i = 1; i < argc; i++) {
+        int hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-n") && hasValue) {
+            count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && hasValue) {
+            rows = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-c") && hasValue) {
+            columns = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-n instances] [-r rows] [-c columns]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count < 1 || rows < 1 || columns < 1 || rows >= CULL_MAX_EDGES || columns >= CULL_MAX_EDGES) {
+        fprintf(stderr, "Need at least one instance, and 1 to %d rows and columns\n", CULL_MAX_EDGES - 1);
+        return 1;
+    }
+
+    // The demo's projection.
+    const int width = 1280, height = 720;
+    const float fovy = 16 * 3.14159265f / 180, aspect = (float) width / height;
+    const float zNear = 0.1f, zFar = 300;
+    float f = 1 / tanf(fovy / 2);
+    float projection[16] = {
+        f / aspect, 0, 0, 0,
+        0, f, 0, 0,
+        0, 0, (zFar + zNear) / (zNear - zFar), -1,
+        0, 0, 2 * zFar * zNear / (zNear - zFar), 0,
+    };
+
+    float xEdges[CULL_MAX_EDGES], yEdges[CULL_MAX_EDGES];
+    Edges(xEdges, columns, width);
+    Edges(yEdges, rows, height);
+    CullGrid* grid = cullCreateGrid(projection, xEdges, columns, yEdges, rows);
+    CullBins* scalar = cullCreateBins();
+    CullBins* simd = cullCreateBins();
+    CullSphere* spheres = (CullSphere*) malloc(sizeof(CullSphere) * count);
+    if (!grid || !scalar || !simd || !spheres) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // Scattered through the view volume and a little beyond it, with some
+    // behind the eye.
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        float z = Random(-40, 2);
+        float reach = fabsf(z) / f * 1.2f;
+        spheres[i].X = Random(-reach * aspect, reach * aspect);
+        spheres[i].Y = Random(-reach, reach);
+        spheres[i].Z = z;
+        spheres[i].Radius = Random(0.02f, 0.3f);
+    }
+
+    int best = warpGetIsa();
+    warpSetIsa(WARP_ISA_SCALAR);
+    double scalarSeconds = Bin(grid, spheres, count, scalar);
+    double simdSeconds = 0;
+    if (warpSetIsa(WARP_ISA_SSE2) != WARP_ISA_SCALAR) {
+        simdSeconds = Bin(grid, spheres, count, simd);
+    }
+    warpSetIsa(best);
+
+    int cellCount = rows * columns;
+    if (simdSeconds > 0 && (scalar->Count != simd->Count ||
+        memcmp(scalar->Offsets, simd->Offsets, sizeof(int) * (cellCount + 1)) ||
+        memcmp(scalar->Instances, simd->Instances, sizeof(int) * scalar->Count))) {
+        fprintf(stderr, "Scalar and SSE2 bins differ\n");
+        return 1;
+    }
+
+    // Every instance must be in the cell under its center.
+    int missed = 0, visible = 0;
+    for (int i = 0; i < count; i++) {
+        const CullSphere* s = spheres + i;
+        if (s->Z > -zNear) {
+            continue;
+        }
+        float x = f / aspect * s->X / -s->Z, y = f * s->Y / -s->Z;
+        int col = Find(xEdges, columns, x), row = Find(yEdges, rows, y);
+        if (col < 0 || row < 0) {
+            continue;
+        }
+        visible++;
+        int cell = row * columns + col, found = 0;
+        for (int k = scalar->Offsets[cell]; k < scalar->Offsets[cell + 1]; k++) {
+            found |= scalar->Instances[k] == i;
+        }
+        missed += !found;
+    }
+
+    int empty = 0;
+    for (int c = 0; c < cellCount; c++) {
+        empty += scalar->Offsets[c] == scalar->Offsets[c + 1];
+    }
+
+    printf("%d instances, %d x %d cells\n\n", count, rows, columns);
+    printf("instance draws   %9d of %d, %.2f%%\n", scalar->Count, count * cellCount,
+           100.0 * scalar->Count / ((double) count * cellCount));
+    printf("empty cells      %9d of %d\n", empty, cellCount);
+    printf("centers on screen%9d, %d missing from their cell\n\n", visible, missed);
+    printf("scalar           %9.3f ms\n", scalarSeconds * 1e3);
+    if (simdSeconds > 0) {
+        printf("sse2             %9.3f ms, %.2fx\n", simdSeconds * 1e3, scalarSeconds / simdSeconds);
+    }
+
+    cullDestroyGrid(grid);
+    cullDestroyBins(scalar);
+    cullDestroyBins(simd);
+    free(spheres);
+    return missed ? 1 : 0;
+}
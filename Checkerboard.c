@@ -3,9 +3,11 @@
 // http://creativecommons.org/licenses/by/3.0/
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "pez.h"
 #include "vmath.h"
+#include "mesh.h"
 
 struct {
     GLuint Position;
@@ -18,6 +20,8 @@ typedef struct {
     int FillIndexCount;
     GLuint LineVao;
     GLuint FillVao;
+    GLenum IndexType;
+    GLuint RestartIndex;
 } MeshPod;
 
 struct {
@@ -25,27 +29,29 @@ struct {
     GLuint LitProgram;
     GLuint SimpleProgram;
     GLuint QuadProgram;
-    GLuint GridProgram;
+    GLuint ResolveProgram;
     MeshPod Cylinder;
     Matrix4 Projection;
     Matrix4 View;
     GLuint FboTexture;
     GLuint FboHandle;
     GLuint QuadVao;
-    MeshPod Grid;
+    int Frame;
+    GLuint MotionTexture;
+    GLuint HistoryHandles[2];
+    GLuint HistoryTextures[2];
+    GLuint HistoryMotion[2];
+    Matrix4 PreviousMVP[7];
 } Globals;
 
-typedef struct {
-    Point3 Position;
-    Vector2 TexCoord;
-} Vertex;
-
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
 static MeshPod CreateCylinder();
+static GLuint CreateIndexBuffer(const MeshIndices* indices);
 static GLuint CreateQuad();
-static MeshPod CreateGrid(int rows, int cols);
-static GLuint CreateRenderTarget(GLuint* colorTexture);
+static GLuint CreateRenderTarget(GLuint* colorTexture, GLuint* motionTexture, bool depth);
+static void RenderCells(GLenum mode, int indexCount, int instanceCount, Matrix4* MV, int parity);
+static void ResolveFrame(int parity);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define offset(x) ((const GLvoid*)x)
@@ -55,6 +61,26 @@ const int Stacks = 8;
 const int GridRows = 20;
 const int GridCols = 36;
 
+// Draws half of the cells each frame, swapping halves every frame, and
+// fills in the other half from the previous frame.  Otherwise the same
+// half is drawn every frame and the rest is left empty.
+const bool TemporalCheckerboard = true;
+
+// Moves the reused cells along with the motion of what was drawn there
+// last frame, and fills them from the neighboring cells where something
+// else was uncovered.  Without it, the reused cells are assumed to stand
+// still.
+const bool MotionVectors = true;
+
+// How far apart two motion vectors can be, in pixels, and still be taken
+// to belong to the same surface.
+const float MotionTolerance = 1.0f;
+
+// The lines then carry the motion of the surface they lie on.
+const bool SinglePassWireframe = true;
+
+const bool DerivativeNormals = true;
+
 PezConfig PezGetConfig()
 {
     PezConfig config;
@@ -77,10 +103,19 @@ void PezInitialize()
     }
 
     // Compile shaders
+    if (TemporalCheckerboard && MotionVectors) {
+        pezSwAddDirective("*", "#define MOTION_VECTORS");
+    }
+    if (SinglePassWireframe) {
+        pezSwAddDirective("*", "#define WIREFRAME");
+    }
+    bool litGs = !DerivativeNormals || pezOption("gs");
+    if (!litGs) {
+        pezSwAddDirective("*", "#define DERIVATIVE_NORMALS");
+    }
     Globals.SimpleProgram = LoadProgram("Simple.VS", 0, "Simple.FS");
     Globals.QuadProgram = LoadProgram("Quad.VS", 0, "Quad.FS");
-    Globals.GridProgram = LoadProgram("Grid.VS", 0, "Grid.FS");
-    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.GS", "Lit.FS");
+    Globals.LitProgram = LoadProgram("Lit.VS", litGs ? "Lit.GS" : 0, "Lit.FS");
 
     // Set up viewport
     float fovy = 16 * TwoPi / 180;
@@ -93,16 +128,39 @@ void PezInitialize()
     Globals.View = M4MakeLookAt(eye, target, up);
 
     // Create offscreen buffer:
-    Globals.FboHandle = CreateRenderTarget(&Globals.FboTexture);
+    GLuint* motion = MotionVectors ? &Globals.MotionTexture : 0;
+    Globals.FboHandle = CreateRenderTarget(&Globals.FboTexture, motion, true);
     glUseProgram(Globals.QuadProgram);
     Globals.QuadVao = CreateQuad();
-    Globals.Grid = CreateGrid(GridRows, GridCols);
+
+    // Last frame's result, and the one being resolved.  They start out
+    // empty, which the resolve treats as never drawn.
+    if (TemporalCheckerboard) {
+        for (int i = 0; i < 2; i++) {
+            motion = MotionVectors ? &Globals.HistoryMotion[i] : 0;
+            Globals.HistoryHandles[i] = CreateRenderTarget(&Globals.HistoryTextures[i], motion, false);
+            glBindFramebuffer(GL_FRAMEBUFFER, Globals.HistoryHandles[i]);
+            glClearColor(0, 0, 0, 0);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        Globals.ResolveProgram = LoadProgram("Quad.VS", 0, "Resolve.FS");
+        glUniform1i(u("Current"), 0);
+        glUniform1i(u("Previous"), 1);
+        glUniform1i(u("CurrentMotion"), 2);
+        glUniform1i(u("PreviousMotion"), 3);
+        glUniform2i(u("Size"), cfg.Width, cfg.Height);
+        glUniform2i(u("Cells"), GridCols, GridRows);
+        glUniform1f(u("MotionTolerance"), MotionTolerance);
+    }
 
     // Create geometry
     Globals.Cylinder = CreateCylinder();
 
     // Misc Initialization
     Globals.Theta = 0;
+    Globals.Frame = 0;
     glClearColor(0.9, 0.9, 1.0, 1);
     glLineWidth(1.5);
     glEnable(GL_LINE_SMOOTH);
@@ -110,6 +168,7 @@ void PezInitialize()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_PRIMITIVE_RESTART);
     glPolygonOffset(1,1);
 }
 
@@ -181,10 +240,19 @@ void PezRender()
 
     int instanceCount = Instances;
     MeshPod* mesh = &Globals.Cylinder;
+    if (Globals.Frame == 0) {
+        memcpy(Globals.PreviousMVP, MVP, sizeof(MVP));
+    }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Cells are drawn where row + column + parity is odd.
+    int parity = TemporalCheckerboard ? Globals.Frame % 2 : 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, TemporalCheckerboard ? Globals.FboHandle : 0);
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (TemporalCheckerboard && MotionVectors) {
+        const GLfloat still[] = {0, 0, 0, 0};
+        glClearBufferfv(GL_COLOR, 1, still);
+    }
     glEnable(GL_DEPTH_TEST);
   
     glUseProgram(Globals.LitProgram);
@@ -193,53 +261,108 @@ void PezRender()
     glUniform4f(u("BackMaterial"), 0.5, 0.5, 0, 1);
     glUniform3fv(u("Hhat"), Instances, &Hhat[0].x);
     glUniform3fv(u("Lhat"), Instances, &Lhat[0].x);
+    glUniform2f(u("Lattice"), Slices, Stacks);
+    if (TemporalCheckerboard && MotionVectors) {
+        glUniformMatrix4fv(u("ScreenModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+        glUniformMatrix4fv(u("PreviousModelviewProjection"), Instances, 0, (float*) &Globals.PreviousMVP[0]);
+    }
+    memcpy(Globals.PreviousMVP, MVP, sizeof(MVP));
 
     glBindVertexArray(mesh->FillVao);
+    glPrimitiveRestartIndex(mesh->RestartIndex);
+    RenderCells(GL_TRIANGLES, mesh->FillIndexCount, instanceCount, MV, parity);
+
+    if (!SinglePassWireframe) {
+        // The lines leave the motion of the surfaces under them alone.
+        GLenum colorOnly = GL_COLOR_ATTACHMENT0;
+        GLenum colorAndMotion[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        if (TemporalCheckerboard && MotionVectors) {
+            glDrawBuffers(1, &colorOnly);
+        }
 
-    PezConfig cfg = PezGetConfig();
-    GLint viewport[] = {0, 0, cfg.Width, cfg.Height};
-
-    float cellWidth = (float) cfg.Width / GridCols;
-    float cellHeight = (float) cfg.Height / GridRows;
+        glUseProgram(Globals.SimpleProgram);
+        glUniform4f(u("Color"), 0, 0, 0, 1);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(mesh->LineVao);
+        RenderCells(GL_LINE_STRIP, mesh->LineIndexCount, instanceCount, MV, parity);
 
-    for (int row = 0; row < GridRows; row++) {
-        for (int col = 0; col < GridCols; col++) {
-            if ((row+col) % 2 == 0) continue; // checkboard, just for fun
-            float x = cellWidth * col;
-            float y = cellHeight * row;
-            Matrix4 pickmatrix = M4PickMatrix(x + cellWidth/2, y + cellHeight/2, cellWidth, cellHeight, viewport);
-            glViewport(x, y, cellWidth, cellHeight);
-            for (int i = 0; i < Instances; i++) {
-                Matrix4 projection = M4Mul(M4Transpose(pickmatrix),Globals.Projection);
-                MVP[i] = M4Mul(projection, MV[i]);
-            }
-            glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
-            glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
+        glDepthMask(GL_TRUE);
+        if (TemporalCheckerboard && MotionVectors) {
+            glDrawBuffers(2, colorAndMotion);
         }
     }
 
-    glUseProgram(Globals.SimpleProgram);
-    glUniform4f(u("Color"), 0, 0, 0, 1);
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(mesh->LineVao);
+    if (TemporalCheckerboard) {
+        ResolveFrame(parity);
+    }
+    Globals.Frame++;
+
+    #undef Instances
+}
+
+// Cell edges are whole pixels, so that Resolve.FS can tell which cell each
+// pixel belongs to.
+static void RenderCells(GLenum mode, int indexCount, int instanceCount, Matrix4* MV, int parity)
+{
+    PezConfig cfg = PezGetConfig();
+    GLint viewport[] = {0, 0, cfg.Width, cfg.Height};
+    Matrix4 MVP[instanceCount];
 
     for (int row = 0; row < GridRows; row++) {
         for (int col = 0; col < GridCols; col++) {
-            if ((row+col) % 2 == 0) continue; // checkboard, just for fun
-            float x = cellWidth * col;
-            float y = cellHeight * row;
-            Matrix4 pickmatrix = M4PickMatrix(x + cellWidth/2, y + cellHeight/2, cellWidth, cellHeight, viewport);
+            if ((row + col + parity) % 2 == 0) continue;
+            int x = col * cfg.Width / GridCols;
+            int y = row * cfg.Height / GridRows;
+            int cellWidth = (col + 1) * cfg.Width / GridCols - x;
+            int cellHeight = (row + 1) * cfg.Height / GridRows - y;
+            Matrix4 pickmatrix = M4PickMatrix(x + cellWidth/2.f, y + cellHeight/2.f, cellWidth, cellHeight, viewport);
             glViewport(x, y, cellWidth, cellHeight);
-            for (int i = 0; i < Instances; i++) {
-                Matrix4 projection = M4Mul(M4Transpose(pickmatrix),Globals.Projection);
+            Matrix4 projection = M4Mul(M4Transpose(pickmatrix),Globals.Projection);
+            for (int i = 0; i < instanceCount; i++) {
                 MVP[i] = M4Mul(projection, MV[i]);
             }
-            glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
-            glDrawElementsInstanced(GL_LINES, mesh->LineIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
+            glUniformMatrix4fv(u("ModelviewProjection"), instanceCount, 0, (float*) &MVP[0]);
+            glDrawElementsInstanced(mode, indexCount, Globals.Cylinder.IndexType, 0, instanceCount);
         }
     }
+}
+
+// Combines this frame's cells with last frame's result into the next
+// history buffer, then shows it.
+static void ResolveFrame(int parity)
+{
+    PezConfig cfg = PezGetConfig();
+    int current = Globals.Frame % 2;
+    int previous = 1 - current;
+
+    glViewport(0, 0, cfg.Width, cfg.Height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(Globals.QuadVao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, Globals.HistoryHandles[current]);
+    glUseProgram(Globals.ResolveProgram);
+    glUniform1i(u("Parity"), parity);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, Globals.FboTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, Globals.HistoryTextures[previous]);
+    if (MotionVectors) {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, Globals.MotionTexture);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, Globals.HistoryMotion[previous]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(Globals.QuadProgram);
+    glBindTexture(GL_TEXTURE_2D, Globals.HistoryTextures[current]);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-    glDepthMask(GL_TRUE);
+    glEnable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
 }
 
 void PezHandleMouse(int x, int y, int action)
@@ -310,20 +433,30 @@ static Point3 EvaluateCylinder(float s, float t)
     return range;
 }
 
+static GLuint CreateIndexBuffer(const MeshIndices* indices)
+{
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->Size * indices->Count, indices->Data, GL_STATIC_DRAW);
+    return vbo;
+}
+
 static MeshPod CreateCylinder()
 {
     const int VertexCount = (Slices+1) * (Stacks+1);
-    const int FillIndexCount = (Slices+1) * Stacks * 6;
 
-    const int circles = (Stacks+1)*Slices;
-    const int longitudinal = Stacks*Slices;
-    const int LineIndexCount = 2 * (circles + longitudinal);
- 
+    // Stacks are the lattice's columns and slices its rows.
+    MeshIndices* triangles = meshLatticeTriangles(Slices, Stacks);
+    MeshIndices* lines = meshLatticeLines(Slices, Stacks);
+    pezCheck(triangles && lines, "Unable to build cylinder indices.");
+
     // Create a buffer with positions
     GLuint positionsVbo;
     if (1) {
-        Point3 verts[VertexCount];
-        Point3* pVert = &verts[0];
+        Point3* verts = (Point3*) malloc(sizeof(Point3) * VertexCount);
+        pezCheck(verts != 0, "Unable to allocate cylinder vertices.");
+        Point3* pVert = verts;
         float ds = 1.0f / Stacks;
         float dt = 1.0f / Slices;
 
@@ -337,85 +470,25 @@ static MeshPod CreateCylinder()
 
         pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Point3) * VertexCount;
         const GLvoid* data = &verts[0].x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            int vps = Slices+1; // vertices per stack
-            for (GLushort i = 0; i < vps; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1) % vps;
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) % vps + vps);
-                *pIndex++ = (n + (i + 1) % vps);
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-
-        GLushort inds[LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Circles:
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks+1; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += Slices + 1;
-        }
-
-        // Longitudinal:
-        n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (Slices + 1);
-            }
-            n += Slices + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
     MeshPod mesh;
     mesh.VertexCount = VertexCount;
-    mesh.FillIndexCount = FillIndexCount;
-    mesh.LineIndexCount = LineIndexCount;
+    mesh.FillIndexCount = triangles->Count;
+    mesh.LineIndexCount = lines->Count;
+    mesh.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
 
     glGenVertexArrays(1, &mesh.FillVao);
     glBindVertexArray(mesh.FillVao);
@@ -434,174 +507,53 @@ static MeshPod CreateCylinder()
     return mesh;
 }
 
-static GLuint CreateRenderTarget(GLuint* colorTexture)
+static GLuint CreateTexture(GLenum internalFormat, GLenum format, GLenum type)
 {
-    pezCheck(GL_NO_ERROR == glGetError(), "OpenGL error on line %d",  __LINE__);
     PezConfig cfg = PezGetConfig();
-
-    glGenTextures(1, colorTexture);
-    glBindTexture(GL_TEXTURE_2D, *colorTexture);
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cfg.Width, cfg.Height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create color texture.");
-
-    GLuint fboHandle;
-    glGenFramebuffers(1, &fboHandle);
-    glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *colorTexture, 0);
-
-    GLuint depthBuffer;
-    glGenRenderbuffers(1, &depthBuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cfg.Width, cfg.Height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
-
-    pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    return fboHandle;
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, cfg.Width, cfg.Height, 0, format, type, 0);
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create texture.");
+    return texture;
 }
 
-static MeshPod CreateGrid(int rows, int columns)
+// The color has an alpha channel for Resolve.FS.  Motion, if asked for, is
+// the second color attachment.
+static GLuint CreateRenderTarget(GLuint* colorTexture, GLuint* motionTexture, bool depth)
 {
-    MeshPod grid;
-    grid.VertexCount = (columns+1) * (rows+1);
-    grid.FillIndexCount = 6 * columns * rows;
-    int horizontalLines = rows * (columns + 1);
-    int verticalLines = columns * (rows + 1);
-    grid.LineIndexCount = 2 * (horizontalLines + verticalLines);
-
-    // Create a buffer with interleaved positions and texture coordinates
-    GLuint positionsVbo;
-    if (1) {
-        Vertex verts[grid.VertexCount];
-        Vertex* pVert = &verts[0];
-        float ds = 1.0f / columns;
-        float dt = 1.0f / rows;
-
-        // The upper bounds in these loops are tweaked to reduce the
-        // chance of precision error causing an incorrect # of iterations.
-        for (float s = 0; s < 1 + ds / 2; s += ds) {
-            for (float t = 0; t < 1 + dt / 2; t += dt) {
-
-                float u = s*2.0 - 1.0;
-                float v = t*2.0 - 1.0;
-                u = (u*u*copysign(1.0,u) + 1.0) / 2.0;
-                v = (v*v*copysign(1.0,v) + 1.0) / 2.0;
-                
-                float x = u*2-1;
-                float y = v*2-1;
-
-                float theta  = atan2(y,x);
-                float radius = sqrt(x*x+y*y);
-                radius = sqrt(radius);
-                x = radius * cos(theta);
-                y = radius * sin(theta);
-                pVert->Position = (Point3){x, y, 0};
-                pVert->TexCoord.x = u;
-                pVert->TexCoord.y = v;
-                ++pVert;
-            }
-        }
-
-        pezCheck(pVert - &verts[0] == grid.VertexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(verts);
-        const GLvoid* data = &verts[0].Position.x;
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &positionsVbo);
-        glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
-        glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
+    pezCheck(GL_NO_ERROR == glGetError(), "OpenGL error on line %d",  __LINE__);
+    PezConfig cfg = PezGetConfig();
 
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[grid.FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < columns; j++) {
-            int vps = rows+1; // vertices per row
-            for (GLushort i = 0; i < rows; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1);
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) + vps);
-                *pIndex++ = (n + (i + 1));
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
+    *colorTexture = CreateTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
 
-        pezCheck(pIndex - &inds[0] == grid.FillIndexCount, "Tessellation error.");
+    GLuint fboHandle;
+    glGenFramebuffers(1, &fboHandle);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *colorTexture, 0);
 
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+    if (motionTexture) {
+        GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        *motionTexture = CreateTexture(GL_RG16F, GL_RG, GL_FLOAT);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, *motionTexture, 0);
+        glDrawBuffers(2, buffers);
     }
 
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-        GLushort inds[grid.LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Horizontal:
-        GLushort n = 0;
-        for (GLushort j = 0; j < columns+1; j++) {
-            for (GLushort i = 0; i < rows; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += rows + 1;
-        }
-
-        // Vertical:
-        n = 0;
-        for (GLushort j = 0; j < columns; j++) {
-            for (GLushort i = 0; i < rows+1; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (rows + 1);
-            }
-            n += rows + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == grid.LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+    if (depth) {
+        GLuint depthBuffer;
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cfg.Width, cfg.Height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
     }
-    
-    glGenVertexArrays(1, &grid.FillVao);
-    glBindVertexArray(grid.FillVao);
-    glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-    glVertexAttribPointer(Attr.Position, 3, GL_FLOAT, GL_FALSE, 20, 0);
-    glEnableVertexAttribArray(Attr.Position);
-    glVertexAttribPointer(Attr.TexCoord, 2, GL_FLOAT, GL_FALSE, 20, offset(12));
-    glEnableVertexAttribArray(Attr.TexCoord);
 
-    glGenVertexArrays(1, &grid.LineVao);
-    glBindVertexArray(grid.LineVao);
-    glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-    glVertexAttribPointer(Attr.Position, 3, GL_FLOAT, GL_FALSE, 20, 0);
-    glEnableVertexAttribArray(Attr.Position);
-    glDisableVertexAttribArray(Attr.TexCoord);
-
-    glBindVertexArray(0);
-
-    return grid;
+    pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return fboHandle;
 }
 
 static GLuint CreateQuad()
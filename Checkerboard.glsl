@@ -1,42 +1,107 @@
--- Grid.VS
+-- Quad.VS
 
 layout(location = 0) in vec3 Position;
+layout(location = 1) in vec2 TexCoord;
+out vec2 vTexCoord;
 
 void main()
 {
+    vTexCoord = TexCoord;
     gl_Position = vec4(Position, 1);
 }
 
--- Grid.FS
+-- Quad.FS
 
+in vec2 vTexCoord;
 out vec4 FragColor;
+uniform sampler2D Sampler;
 
 void main()
 {
-    FragColor = vec4(0,0,0.5,0.25);
+    FragColor = texture(Sampler, vTexCoord);
 }
 
--- Quad.VS
+-- Resolve.FS
 
-layout(location = 0) in vec3 Position;
-layout(location = 1) in vec2 TexCoord;
-out vec2 vTexCoord;
+// Rebuilds the whole frame from the cells drawn this frame and the last
+// frame's result.  Alpha records whether a pixel was drawn (1) or reused
+// (0.5), so that no pixel is reused two frames running.
+layout(location = 0) out vec4 FragColor;
+uniform sampler2D Current;
+uniform sampler2D Previous;
+uniform ivec2 Size;             // of the screen, in pixels
+uniform ivec2 Cells;            // columns and rows
+uniform int Parity;
 
-void main()
+#ifdef MOTION_VECTORS
+layout(location = 1) out vec4 FragMotion;
+uniform sampler2D CurrentMotion;
+uniform sampler2D PreviousMotion;
+uniform float MotionTolerance;
+#endif
+
+// Cell edges are at cell * Size / Cells, rounded down, as in RenderCells.
+ivec2 CellOf(ivec2 p)
 {
-    vTexCoord = TexCoord;
-    gl_Position = vec4(Position, 1);
+    return ((p + 1) * Cells - 1) / Size;
 }
 
--- Quad.FS
+ivec2 CellCorner(ivec2 cell)
+{
+    return cell * Size / Cells;
+}
 
-in vec2 vTexCoord;
-out vec4 FragColor;
-uniform sampler2D Sampler;
+// Weighs the nearest pixel of each neighboring cell by how close it is.
+// The neighbors all have the other parity, so they were drawn this frame.
+vec3 SpatialFill(ivec2 p, ivec2 cell)
+{
+    ivec2 lo = CellCorner(cell);
+    ivec2 hi = CellCorner(cell + 1) - 1;
+    ivec2 taps[4] = ivec2[4](ivec2(lo.x - 1, p.y), ivec2(hi.x + 1, p.y),
+                             ivec2(p.x, lo.y - 1), ivec2(p.x, hi.y + 1));
+    vec3 sum = vec3(0);
+    float total = 0;
+    for (int i = 0; i < 4; i++) {
+        if (any(lessThan(taps[i], ivec2(0))) || any(greaterThanEqual(taps[i], Size)))
+            continue;
+        float w = 1.0 / float(abs(taps[i].x - p.x) + abs(taps[i].y - p.y));
+        sum += w * texelFetch(Current, taps[i], 0).rgb;
+        total += w;
+    }
+    return sum / total;
+}
 
 void main()
 {
-    FragColor = texture(Sampler, vTexCoord);
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    ivec2 cell = CellOf(p);
+    if ((cell.x + cell.y + Parity) % 2 == 1) {
+        FragColor = vec4(texelFetch(Current, p, 0).rgb, 1);
+#ifdef MOTION_VECTORS
+        FragMotion = texelFetch(CurrentMotion, p, 0);
+#endif
+        return;
+    }
+
+    // Whatever was here last frame is assumed to keep moving the same way.
+    vec2 motion = vec2(0);
+#ifdef MOTION_VECTORS
+    motion = texelFetch(PreviousMotion, p, 0).xy;
+    FragMotion = vec4(motion, 0, 0);
+#endif
+    vec2 source = (vec2(p) + 0.5) / vec2(Size) - motion;
+    vec4 previous = texture(Previous, source);
+    bool valid = all(greaterThanEqual(source, vec2(0))) && all(lessThan(source, vec2(1)));
+    valid = valid && previous.a > 0.75;
+
+#ifdef MOTION_VECTORS
+    // A different motion at the source means something else was there,
+    // and this pixel has just been uncovered.
+    vec2 sourceMotion = texture(PreviousMotion, source).xy;
+    valid = valid && length((sourceMotion - motion) * vec2(Size)) < MotionTolerance;
+#endif
+
+    FragColor = vec4(valid ? previous.rgb : SpatialFill(p, cell), 0.5);
 }
 
 -- Simple.VS
@@ -63,14 +128,30 @@ void main()
 
 layout(location = 0) in vec4 Position;
 out vec3 vPosition;
+#ifdef DERIVATIVE_NORMALS
+flat out int vInstanceID;
+#else
 out int vInstanceID;
+#endif
 uniform mat4 ModelviewProjection[7];
 
+#ifdef MOTION_VECTORS
+// Where the vertex is on the whole screen, now and last frame.
+uniform mat4 ScreenModelviewProjection[7];
+uniform mat4 PreviousModelviewProjection[7];
+out vec4 vScreen;
+out vec4 vPrevious;
+#endif
+
 void main()
 {
     vInstanceID = gl_InstanceID;
     vPosition = Position.xyz;
     gl_Position = ModelviewProjection[gl_InstanceID] * Position;
+#ifdef MOTION_VECTORS
+    vScreen = ScreenModelviewProjection[gl_InstanceID] * Position;
+    vPrevious = PreviousModelviewProjection[gl_InstanceID] * Position;
+#endif
 }
 
 
@@ -81,9 +162,16 @@ layout(triangle_strip, max_vertices = 3) out;
 in vec3 vPosition[3];
 out vec3 gNormal;
 in int vInstanceID[3];
-out float gDistance[4];
+out vec3 gPosition;
 flat out int gInstanceID;
 
+#ifdef MOTION_VECTORS
+in vec4 vScreen[3];
+in vec4 vPrevious[3];
+out vec4 gScreen;
+out vec4 gPrevious;
+#endif
+
 void main()
 {
     gInstanceID = vInstanceID[0];
@@ -92,6 +180,11 @@ void main()
     gNormal = normalize(cross(A, B));
 
     for (int j = 0; j < 3; j++) {
+        gPosition = vPosition[j];
+#ifdef MOTION_VECTORS
+        gScreen = vScreen[j];
+        gPrevious = vPrevious[j];
+#endif
         gl_Position = gl_in[j].gl_Position;
         EmitVertex();
     }
@@ -100,9 +193,15 @@ void main()
 
 -- Lit.FS
 
+#ifdef DERIVATIVE_NORMALS
+in vec3 vPosition;
+flat in int vInstanceID;
+#else
+in vec3 gPosition;
 in vec3 gNormal;
 flat in int gInstanceID;
-out vec4 FragColor;
+#endif
+layout(location = 0) out vec4 FragColor;
 uniform vec3 AmbientMaterial = vec3(0.2, 0.2, 0.2);
 uniform vec3 SpecularMaterial = vec3(0.5, 0.5, 0.5);
 uniform vec4 FrontMaterial = vec4(0.75, 0.75, 0.5, 0.5);
@@ -111,14 +210,59 @@ uniform float Shininess = 7;
 uniform vec3 Hhat[7];
 uniform vec3 Lhat[7];
 
+#ifdef WIREFRAME
+// The lit-pass wireframe; see OriginalScene.glsl.
+uniform vec2 Lattice;
+uniform vec4 LineColor = vec4(0, 0, 0, 1);
+uniform float LineWidth = 1.5;
+
+float Wire(vec3 p)
+{
+    vec2 cell = vec2(atan(p.z, p.x) / 6.28318531, p.y + 0.5) * Lattice;
+    vec3 dx = dFdx(p), dy = dFdy(p);
+    float da = (abs(p.x * dx.z - p.z * dx.x) + abs(p.x * dy.z - p.z * dy.x)) / dot(p.xz, p.xz);
+    vec2 pitch = vec2(da / 6.28318531, abs(dx.y) + abs(dy.y)) * Lattice;
+    vec2 d = abs(fract(cell + 0.5) - 0.5) / max(pitch, vec2(1e-6));
+    return clamp(0.5 * LineWidth + 0.5 - min(d.x, d.y), 0.0, 1.0);
+}
+#endif
+
+#ifdef MOTION_VECTORS
+// How far the surface moved since last frame, in texture coordinates.
+#ifdef DERIVATIVE_NORMALS
+in vec4 vScreen;
+in vec4 vPrevious;
+#define gScreen vScreen
+#define gPrevious vPrevious
+#else
+in vec4 gScreen;
+in vec4 gPrevious;
+#endif
+layout(location = 1) out vec4 FragMotion;
+#endif
+
 void main()
 {
+#ifdef MOTION_VECTORS
+    FragMotion = vec4(0.5 * (gScreen.xy / gScreen.w - gPrevious.xy / gPrevious.w), 0, 1);
+#endif
+
+#ifdef DERIVATIVE_NORMALS
+    // The position's screen-space derivatives lie in the face, and their
+    // cross product points back at the viewer on either side of it.
+    vec3 position = vPosition;
+    vec3 N = normalize(cross(dFdx(position), dFdy(position)));
+    int instance = vInstanceID;
+#else
+    vec3 position = gPosition;
     vec3 N = -normalize(gNormal);
     if (!gl_FrontFacing)
        N = -N;
+    int instance = gInstanceID;
+#endif
 
-    float df = max(0.0, dot(N, Lhat[gInstanceID]));
-    float sf = max(0.0, dot(N, Hhat[gInstanceID]));
+    float df = max(0.0, dot(N, Lhat[instance]));
+    float sf = max(0.0, dot(N, Hhat[instance]));
     sf = pow(sf, Shininess);
 
     vec3 diffuse = gl_FrontFacing ? FrontMaterial.rgb : BackMaterial.rgb;
@@ -127,4 +271,7 @@ void main()
         lighting += sf * SpecularMaterial;
 
     FragColor = vec4(lighting, FrontMaterial.a);
+#ifdef WIREFRAME
+    FragColor = mix(FragColor, LineColor, Wire(position));
+#endif
 }
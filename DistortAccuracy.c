@@ -0,0 +1,128 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+// Compares lensDistortFast against lensDistortReference over every pixel
+// center of a viewport, for a sweep of powers.  Errors are reported in
+// float ULPs relative to a double-precision evaluation, and in pixels
+// relative to the reference kernel.
+//
+// Usage: DistortAccuracy [width height]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "lens.h"
+
+static const float Powers[] = {
+    0.5f, 0.625f, 0.75f, 0.875f, 1.0f, 1.125f, 1.25f, 1.5f, 1.75f, 2.0f, 2.5f
+};
+
+// Distance between two floats in units in the last place.
+static double UlpDistance(float a, float b)
+{
+    int ia, ib;
+    memcpy(&ia, &a, 4);
+    memcpy(&ib, &b, 4);
+    long long la = ia < 0 ? (long long) (int) 0x80000000 - ia : ia;
+    long long lb = ib < 0 ? (long long) (int) 0x80000000 - ib : ib;
+    return (double) llabs(la - lb);
+}
+
+static void Exact(const float* xy, float* out, int count, float power)
+{
+    for (int i = 0; i < count; i++) {
+        double x = xy[2 * i], y = xy[2 * i + 1];
+        double r2 = x * x + y * y;
+        double s = r2 > 0 ? pow(r2, 0.5 * (power - 1.0)) : 0;
+        out[2 * i] = (float) (x * s);
+        out[2 * i + 1] = (float) (y * s);
+    }
+}
+
+static double Seconds(void (*kernel)(float*, int, float), const float* xy, float* out,
+                      int count, float power)
+{
+    memcpy(out, xy, sizeof(float) * 2 * count);
+    clock_t start = clock();
+    kernel(out, count, power);
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv)
+{
+    int width = 1920, height = 1080;
+    if (argc == 3) {
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "Usage: %s [width height]\n", argv[0]);
+        return 1;
+    }
+
+    int count = width * height;
+    float* xy = (float*) malloc(sizeof(float) * 2 * count);
+    float* ref = (float*) malloc(sizeof(float) * 2 * count);
+    float* fast = (float*) malloc(sizeof(float) * 2 * count);
+    float* exact = (float*) malloc(sizeof(float) * 2 * count);
+    if (!xy || !ref || !fast || !exact) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    float* p = xy;
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++, p += 2) {
+            p[0] = (i + 0.5f) * 2.0f / width - 1.0f;
+            p[1] = (j + 0.5f) * 2.0f / height - 1.0f;
+        }
+    }
+
+    printf("%d x %d points\n\n", width, height);
+    printf("power  ref ulp  fast ulp  fast-ref px  ref Mpt/s  fast Mpt/s\n");
+
+    double worstPixels = 0;
+    for (int k = 0; k < sizeof(Powers) / sizeof(Powers[0]); k++) {
+        float power = Powers[k];
+        double refTime = Seconds(lensDistortReference, xy, ref, count, power);
+        double fastTime = Seconds(lensDistortFast, xy, fast, count, power);
+        Exact(xy, exact, count, power);
+
+        double refUlp = 0, fastUlp = 0, pixels = 0;
+        for (int i = 0; i < count; i++) {
+            for (int c = 0; c < 2; c++) {
+                int n = 2 * i + c;
+                double r = UlpDistance(ref[n], exact[n]);
+                double f = UlpDistance(fast[n], exact[n]);
+                refUlp = r > refUlp ? r : refUlp;
+                fastUlp = f > fastUlp ? f : fastUlp;
+            }
+            double dx = fabs(fast[2 * i] - ref[2 * i]) * 0.5 * width;
+            double dy = fabs(fast[2 * i + 1] - ref[2 * i + 1]) * 0.5 * height;
+            pixels = dx > pixels ? dx : pixels;
+            pixels = dy > pixels ? dy : pixels;
+        }
+        worstPixels = pixels > worstPixels ? pixels : worstPixels;
+
+        // The fast kernel leaves the points alone at power 1, so there is
+        // no throughput to report.
+        char fastRate[16] = "-";
+        if (power != 1.0f) {
+            snprintf(fastRate, sizeof(fastRate), "%.1f", fastTime > 0 ? count / fastTime * 1e-6 : 0);
+        }
+        printf("%5.3f  %7.0f  %8.0f  %11.2e  %9.1f  %10s\n", power,
+               refUlp, fastUlp, pixels,
+               refTime > 0 ? count / refTime * 1e-6 : 0, fastRate);
+    }
+
+    printf("\nWorst difference from reference: %.2e pixels\n", worstPixels);
+
+    free(xy);
+    free(ref);
+    free(fast);
+    free(exact);
+    return 0;
+}
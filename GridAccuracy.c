@@ -0,0 +1,262 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+// How closely the grid demos approximate the exact warp.  Each demo's
+// CreateGrid mesh is rebuilt on the CPU and rasterized, interpolating the
+// texture coordinates linearly across each triangle like the GPU does.  At
+// every pixel center the result is compared with the exact mapping that
+// Quad.FS in TextureWarping-Gridless.glsl evaluates, and the error is
+// reported in source texels.  Grid sizes are swept so that the error can
+// be read against the triangle count; the adaptive grid from mesh.h is
+// given the uniform grid's triangle count as its budget.  The lens-fit grid
+// is the pincushion grid on the edges from meshLensEdges, which is how
+// TiledRendering partitions the screen.
+//
+// Usage: GridAccuracy [-p barrelPower] [-w width] [-h height]
+//
+// The source image is the same size as the screen, like the demos' FBO.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "warp.h"
+#include "mesh.h"
+
+// Rows of the sweep; columns keep the demos' 20:36 ratio.
+const int SweepRows[] = {5, 10, 20, 40, 80};
+
+enum { GRID_ADAPTIVE = WARP_GRID_NONUNIFORM + 1, GRID_LENS_FIT };
+
+typedef struct TechniqueRec {
+    const char* Name;
+    int Layout;
+} Technique;
+
+typedef struct StatsRec {
+    double Max;
+    double Mean;
+    double P99;
+    int Mismatched;             // pixels where only one of the two shows the source
+} Stats;
+
+// Interpolated texture coordinates at every pixel center, or NAN where
+// the mesh doesn't reach.
+static void Rasterize(const float* positions, const float* texCoords, const unsigned int* indices,
+                      int triangleCount, int width, int height, float* st)
+{
+    for (int i = 0; i < 2 * width * height; i++) {
+        st[i] = NAN;
+    }
+
+    for (int t = 0; t < triangleCount; t++, indices += 3) {
+        float x[3], y[3];
+        for (int k = 0; k < 3; k++) {
+            x[k] = 0.5f * (positions[2 * indices[k]] + 1.0f) * width;
+            y[k] = 0.5f * (positions[2 * indices[k] + 1] + 1.0f) * height;
+        }
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area == 0) {
+            continue;
+        }
+
+        float minX = fminf(x[0], fminf(x[1], x[2])), maxX = fmaxf(x[0], fmaxf(x[1], x[2]));
+        float minY = fminf(y[0], fminf(y[1], y[2])), maxY = fmaxf(y[0], fmaxf(y[1], y[2]));
+        int i0 = (int) ceilf(minX - 0.5f), i1 = (int) floorf(maxX - 0.5f);
+        int j0 = (int) ceilf(minY - 0.5f), j1 = (int) floorf(maxY - 0.5f);
+        i0 = i0 < 0 ? 0 : i0;
+        j0 = j0 < 0 ? 0 : j0;
+        i1 = i1 >= width ? width - 1 : i1;
+        j1 = j1 >= height ? height - 1 : j1;
+
+        for (int j = j0; j <= j1; j++) {
+            for (int i = i0; i <= i1; i++) {
+                float px = i + 0.5f, py = j + 0.5f;
+                float w[3];
+                for (int k = 0; k < 3; k++) {
+                    int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+                    w[k] = ((x[k2] - x[k1]) * (py - y[k1]) - (px - x[k1]) * (y[k2] - y[k1])) / area;
+                }
+                if (w[0] < 0 || w[1] < 0 || w[2] < 0) {
+                    continue;
+                }
+                float* p = st + 2 * (j * width + i);
+                p[0] = p[1] = 0;
+                for (int k = 0; k < 3; k++) {
+                    p[0] += w[k] * texCoords[2 * indices[k]];
+                    p[1] += w[k] * texCoords[2 * indices[k] + 1];
+                }
+            }
+        }
+    }
+}
+
+// Exact texture coordinates at the corners of a grid on the lens's edges.
+static int LensFitVertices(const LensModel* model, int rows, int columns, int width, int height,
+                           float* positions, float* texCoords)
+{
+    float xEdges[columns + 1], yEdges[rows + 1];
+    if (!meshLensEdges(model, 0, columns, width, width, height, xEdges) ||
+        !meshLensEdges(model, 1, rows, height, width, height, yEdges)) {
+        return 0;
+    }
+    float* p = positions;
+    for (int i = 0; i <= columns; i++) {
+        for (int j = 0; j <= rows; j++, p += 2) {
+            p[0] = xEdges[i];
+            p[1] = yEdges[j];
+        }
+    }
+    int count = (columns + 1) * (rows + 1);
+    memcpy(texCoords, positions, sizeof(float) * 2 * count);
+    lensDistort(model, texCoords, count);
+    return 1;
+}
+
+static int Inside(const float* st)
+{
+    return fabsf(st[0]) <= 1 && fabsf(st[1]) <= 1;
+}
+
+static int CompareFloats(const void* a, const void* b)
+{
+    float x = *(const float*) a, y = *(const float*) b;
+    return (x > y) - (x < y);
+}
+
+static Stats Measure(const float* st, const float* exact, int width, int height, float* errors)
+{
+    Stats stats = {0, 0, 0, 0};
+    int n = 0;
+    for (int i = 0; i < width * height; i++) {
+        const float* a = st + 2 * i;
+        const float* b = exact + 2 * i;
+        int shown = !isnan(a[0]) && Inside(a);
+        if (shown != Inside(b)) {
+            stats.Mismatched++;
+        }
+        if (!shown || !Inside(b)) {
+            continue;
+        }
+        double dx = (a[0] - b[0]) * 0.5 * width;
+        double dy = (a[1] - b[1]) * 0.5 * height;
+        errors[n] = (float) sqrt(dx * dx + dy * dy);
+        stats.Max = errors[n] > stats.Max ? errors[n] : stats.Max;
+        stats.Mean += errors[n];
+        n++;
+    }
+    if (n) {
+        stats.Mean /= n;
+        qsort(errors, n, sizeof(float), CompareFloats);
+        stats.P99 = errors[(int) (0.99 * (n - 1))];
+    }
+    return stats;
+}
+
+int main(int argc, char** argv)
+{
+    float power = 2.0f;
+    int width = 1280, height = 720;
+    for (int i = 1; i < argc; i++) {
+        int hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-p") && hasValue) {
+            power = (float) atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && hasValue) {
+            width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-h") && hasValue) {
+            height = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-p barrelPower] [-w width] [-h height]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const Technique techniques[] = {
+        {"uniform", WARP_GRID_UNIFORM},
+        {"nonuniform", WARP_GRID_NONUNIFORM},
+        {"pincushion", WARP_GRID_PINCUSHION},
+        {"lens-fit", GRID_LENS_FIT},
+        {"adaptive", GRID_ADAPTIVE},
+    };
+    const int techniqueCount = sizeof(techniques) / sizeof(techniques[0]);
+    const int sweepCount = sizeof(SweepRows) / sizeof(SweepRows[0]);
+    const int maxRows = SweepRows[sweepCount - 1], maxCols = maxRows * 36 / 20;
+
+    int count = width * height;
+    int gridCount = (maxRows + 1) * (maxCols + 1);
+    float* exact = (float*) malloc(sizeof(float) * 2 * count);
+    float* st = (float*) malloc(sizeof(float) * 2 * count);
+    float* errors = (float*) malloc(sizeof(float) * count);
+    float* positions = (float*) malloc(sizeof(float) * 2 * gridCount);
+    float* texCoords = (float*) malloc(sizeof(float) * 2 * gridCount);
+    unsigned int* indices = (unsigned int*) malloc(sizeof(unsigned int) * 6 * maxRows * maxCols);
+    if (!exact || !st || !errors || !positions || !texCoords || !indices) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // The exact warp at every pixel center.
+    LensModel model = lensPowerModel(power);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            exact[2 * (j * width + i)] = (i + 0.5f) * 2.0f / width - 1.0f;
+            exact[2 * (j * width + i) + 1] = (j + 0.5f) * 2.0f / height - 1.0f;
+        }
+    }
+    lensDistort(&model, exact, count);
+
+    printf("%d x %d, barrel power %g, errors in source texels\n\n", width, height, power);
+    printf("technique    rows  cols  triangles       max      mean       p99  mismatched px\n");
+
+    for (int t = 0; t < techniqueCount; t++) {
+        for (int s = 0; s < sweepCount; s++) {
+            int rows = SweepRows[s], columns = rows * 36 / 20;
+            int triangleCount = 2 * rows * columns;
+            MeshGrid* adaptive = 0;
+            if (techniques[t].Layout == GRID_ADAPTIVE) {
+                adaptive = meshCreateAdaptive(&model, 0, triangleCount, MESH_MAX_DEPTH, width, height);
+                if (!adaptive) {
+                    fprintf(stderr, "Unable to build the adaptive grid\n");
+                    return 1;
+                }
+                triangleCount = adaptive->TriangleCount;
+                Rasterize(adaptive->Positions, adaptive->TexCoords, adaptive->Indices,
+                          triangleCount, width, height, st);
+            } else {
+                if (techniques[t].Layout == GRID_LENS_FIT) {
+                    if (!LensFitVertices(&model, rows, columns, width, height, positions, texCoords)) {
+                        fprintf(stderr, "Unable to place the grid edges\n");
+                        return 1;
+                    }
+                } else {
+                    warpGridVertices(techniques[t].Layout, power, rows, columns, positions, texCoords);
+                }
+                warpGridIndices(rows, columns, indices);
+                Rasterize(positions, texCoords, indices, triangleCount, width, height, st);
+            }
+
+            Stats stats = Measure(st, exact, width, height, errors);
+            if (adaptive) {
+                printf("%-11s     -     -  %9d  %8.3f  %8.3f  %8.3f  %13d\n", techniques[t].Name,
+                       triangleCount, stats.Max, stats.Mean, stats.P99, stats.Mismatched);
+            } else {
+                printf("%-11s  %4d  %4d  %9d  %8.3f  %8.3f  %8.3f  %13d\n", techniques[t].Name,
+                       rows, columns, triangleCount, stats.Max, stats.Mean, stats.P99, stats.Mismatched);
+            }
+            meshDestroy(adaptive);
+        }
+        printf("\n");
+    }
+
+    printf("Mismatched pixels show the source where the exact warp shows the background,\n"
+           "or the other way around; they are left out of the error columns.\n");
+
+    free(exact);
+    free(st);
+    free(errors);
+    free(positions);
+    free(texCoords);
+    free(indices);
+    return 0;
+}
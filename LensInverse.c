@@ -0,0 +1,199 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+// Round-trip report for the inverse lens solver.  For each model, every
+// pixel center of a viewport is distorted and undistorted, in both orders,
+// and the error is reported in pixels.  Then an image is warped with a
+// forward remap table and restored with a cached inverse table.
+//
+// Usage: LensInverse [-t tolerance] [-w width] [-h height]
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <time.h>
+#include "lens.h"
+#include "warp.h"
+
+const int MaxIterations = 8;
+
+typedef struct ModelRec {
+    const char* Name;
+    LensModel Model;
+} Model;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void PixelCenters(float* xy, int width, int height)
+{
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++, xy += 2) {
+            xy[0] = (i + 0.5f) * 2.0f / width - 1.0f;
+            xy[1] = (j + 0.5f) * 2.0f / height - 1.0f;
+        }
+    }
+}
+
+// Largest and mean distance in pixels, skipping points of b whose radius
+// is beyond the given limit.
+static void Compare(const float* a, const float* b, int count, int width, int height,
+                    float limit, double* worst, double* mean)
+{
+    double sum = 0;
+    int n = 0;
+    *worst = 0;
+    for (int i = 0; i < count; i++, a += 2, b += 2) {
+        if (sqrtf(b[0] * b[0] + b[1] * b[1]) >= limit) {
+            continue;
+        }
+        double dx = (a[0] - b[0]) * 0.5 * width;
+        double dy = (a[1] - b[1]) * 0.5 * height;
+        double d = sqrt(dx * dx + dy * dy);
+        *worst = d > *worst ? d : *worst;
+        sum += d;
+        n++;
+    }
+    *mean = n ? sum / n : 0;
+}
+
+static void FillChecker(WarpImage* image)
+{
+    for (int y = 0; y < image->Height; y++) {
+        unsigned char* p = image->Pixels + y * image->Stride;
+        for (int x = 0; x < image->Width; x++) {
+            p[x] = (((x >> 5) ^ (y >> 5)) & 1) ? 230 : (unsigned char) (x * 200 / image->Width);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    float tolerance = 1e-6f;
+    int width = 1920, height = 1080;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-t") && hasValue) {
+            tolerance = (float) atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && hasValue) {
+            width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-h") && hasValue) {
+            height = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-t tolerance] [-w width] [-h height]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The powers used by the demos, followed by polynomial lenses.
+    const Model models[] = {
+        {"power 0.5", lensPowerModel(0.5f)},
+        {"power 0.75", lensPowerModel(0.75f)},
+        {"power 2", lensPowerModel(2.0f)},
+        {"barrel", lensPolynomialModel(-0.22f, 0.024f, 0)},
+        {"pincushion", lensPolynomialModel(0.18f, 0.05f, 0)},
+        {"strong barrel", lensPolynomialModel(-0.35f, 0, 0)},
+        {"decentered", lensBrownConradyModel(-0.22f, 0.024f, 0, 0.0012f, -0.0008f)},
+    };
+    const int modelCount = sizeof(models) / sizeof(models[0]);
+
+    int count = width * height;
+    float* original = (float*) malloc(sizeof(float) * 2 * count);
+    float* points = (float*) malloc(sizeof(float) * 2 * count);
+    WarpImage src = {width, height, 1, width, (unsigned char*) malloc(count)};
+    WarpImage warped = {width, height, 1, width, (unsigned char*) malloc(count)};
+    WarpImage restored = {width, height, 1, width, (unsigned char*) malloc(count)};
+    if (!original || !points || !src.Pixels || !warped.Pixels || !restored.Pixels) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    PixelCenters(original, width, height);
+    FillChecker(&src);
+    WarpFill fill = warpDefaultFill();
+
+    printf("%d x %d points, tolerance %g, up to %d iterations\n\n", width, height, tolerance, MaxIterations);
+    printf("model          max r   inv(fwd) px        fwd(inv) px        failed   Mpt/s   table ms  "
+           "image err\n");
+    printf("                       max       mean     max       mean\n");
+
+    for (int m = 0; m < modelCount; m++) {
+        const LensModel* model = &models[m].Model;
+        float maxRadius = lensMaxRadius(model);
+        float edge[2] = {maxRadius, 0};
+        lensDistort(model, edge, 1);
+        double worst1, mean1, worst2, mean2;
+
+        // Undistorting distorted points should give back the originals.
+        memcpy(points, original, sizeof(float) * 2 * count);
+        lensDistort(model, points, count);
+        lensUndistort(model, points, count, tolerance, MaxIterations);
+        Compare(points, original, count, width, height, maxRadius, &worst1, &mean1);
+
+        // And the other way around, which is what an inverse table does.
+        // Points whose radius the lens never reaches can't round-trip.
+        memcpy(points, original, sizeof(float) * 2 * count);
+        double start = Now();
+        int failed = lensUndistort(model, points, count, tolerance, MaxIterations);
+        double solve = Now() - start;
+        lensDistort(model, points, count);
+        Compare(points, original, count, width, height, edge[0], &worst2, &mean2);
+
+        // Warp an image and restore it through the cached inverse table.
+        start = Now();
+        WarpMap* inverse = warpCreateLensMap(model, 1, tolerance, width, height, width, height);
+        double build = Now() - start;
+        WarpMap* forward = warpCreateLensMap(model, 0, 0, width, height, width, height);
+        if (!inverse || !forward) {
+            fprintf(stderr, "Unable to create maps\n");
+            return 1;
+        }
+        warpApplyMap(&src, forward, &warped, &fill);
+        warpApplyMap(&warped, inverse, &restored, &fill);
+
+        // Only compare pixels that survive both trips.
+        double sum = 0;
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            const WarpTap* a = inverse->Taps + i;
+            const float* o = original + 2 * i;
+            if (sqrtf(o[0] * o[0] + o[1] * o[1]) >= edge[0]) {
+                continue;
+            }
+            if (!(a->Flags & WARP_TAP_SOURCE) || a->Coverage != 255) {
+                continue;
+            }
+            const WarpTap* b = forward->Taps + a->Y * width + a->X;
+            if ((b->Flags & WARP_TAP_SOURCE) && b->Coverage == 255) {
+                sum += abs(restored.Pixels[i] - src.Pixels[i]);
+                n++;
+            }
+        }
+
+        printf("%-13s  %5.2f  %8.2e  %8.2e  %8.2e  %8.2e  %6d  %6.1f  %9.1f  %9.2f\n",
+               models[m].Name, maxRadius, worst1, mean1, worst2, mean2, failed,
+               solve > 0 ? count / solve * 1e-6 : 0, build * 1e3, n ? sum / n : 0);
+
+        warpDestroyMap(inverse);
+        warpDestroyMap(forward);
+    }
+
+    printf("\nmax r is the radius up to which the model can be inverted.  Image error is the\n"
+           "mean absolute difference, out of 255, after warping and restoring a checkerboard;\n"
+           "most of it is from resampling twice.\n");
+
+    free(original);
+    free(points);
+    free(src.Pixels);
+    free(warped.Pixels);
+    free(restored.Pixels);
+    return 0;
+}
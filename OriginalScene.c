@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include "pez.h"
 #include "vmath.h"
+#include "mesh.h"
 
 typedef struct {
     int VertexCount;
@@ -13,6 +14,8 @@ typedef struct {
     int FillIndexCount;
     GLuint LineVao;
     GLuint FillVao;
+    GLenum IndexType;
+    GLuint RestartIndex;
 } MeshPod;
 
 struct {
@@ -31,6 +34,7 @@ typedef struct {
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
 static MeshPod CreateCylinder();
+static GLuint CreateIndexBuffer(const MeshIndices* indices);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define a(x) glGetAttribLocation(CurrentProgram(), x)
@@ -39,6 +43,16 @@ static MeshPod CreateCylinder();
 const int Slices = 24;
 const int Stacks = 8;
 
+// Draws the cylinders' rings and slices in the lit pass, from each
+// fragment's distance to the nearest one, instead of drawing the line
+// indices again.
+const bool SinglePassWireframe = true;
+
+// Flat shades Lit.FS from screen-space derivatives of the position, so
+// Lit.GS doesn't have to run just for a face normal.  Compare the two with
+// the "-b frames" benchmark and "-o gs".
+const bool DerivativeNormals = true;
+
 PezConfig PezGetConfig()
 {
     PezConfig config;
@@ -55,8 +69,15 @@ void PezInitialize()
     const PezConfig cfg = PezGetConfig();
 
     // Compile shaders
+    if (SinglePassWireframe) {
+        pezSwAddDirective("*", "#define WIREFRAME");
+    }
+    bool litGs = !DerivativeNormals || pezOption("gs");
+    if (!litGs) {
+        pezSwAddDirective("*", "#define DERIVATIVE_NORMALS");
+    }
     Globals.SimpleProgram = LoadProgram("Simple.VS", 0, "Simple.FS");
-    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.GS", "Lit.FS");
+    Globals.LitProgram = LoadProgram("Lit.VS", litGs ? "Lit.GS" : 0, "Lit.FS");
 
     // Set up viewport
     float fovy = 16 * TwoPi / 180;
@@ -81,6 +102,7 @@ void PezInitialize()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_PRIMITIVE_RESTART);
     glPolygonOffset(1,1);
 }
 
@@ -144,19 +166,23 @@ void PezRender()
     glUniform4f(u("BackMaterial"), 0.5, 0.5, 0, 1);
     glUniform3fv(u("Hhat"), Instances, &Hhat[0].x);
     glUniform3fv(u("Lhat"), Instances, &Lhat[0].x);
+    glUniform2f(u("Lattice"), Slices, Stacks);
     glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
 
     glBindVertexArray(mesh->FillVao);
-    glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-
-    glUseProgram(Globals.SimpleProgram);
-    glUniform4f(u("Color"), 0, 0, 0, 1);
-    glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
-
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(mesh->LineVao);
-    glDrawElementsInstanced(GL_LINES, mesh->LineIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-    glDepthMask(GL_TRUE);
+    glPrimitiveRestartIndex(mesh->RestartIndex);
+    glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, mesh->IndexType, 0, instanceCount);
+
+    if (!SinglePassWireframe) {
+        glUseProgram(Globals.SimpleProgram);
+        glUniform4f(u("Color"), 0, 0, 0, 1);
+        glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(mesh->LineVao);
+        glDrawElementsInstanced(GL_LINE_STRIP, mesh->LineIndexCount, mesh->IndexType, 0, instanceCount);
+        glDepthMask(GL_TRUE);
+    }
 }
 
 void PezHandleMouse(int x, int y, int action)
@@ -227,20 +253,30 @@ static Vector3 EvaluateCylinder(float s, float t)
     return range;
 }
 
+static GLuint CreateIndexBuffer(const MeshIndices* indices)
+{
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->Size * indices->Count, indices->Data, GL_STATIC_DRAW);
+    return vbo;
+}
+
 static MeshPod CreateCylinder()
 {
     const int VertexCount = (Slices+1) * (Stacks+1);
-    const int FillIndexCount = (Slices+1) * Stacks * 6;
 
-    const int circles = (Stacks+1)*Slices;
-    const int longitudinal = Stacks*Slices;
-    const int LineIndexCount = 2 * (circles + longitudinal);
- 
+    // Stacks are the lattice's columns and slices its rows.
+    MeshIndices* triangles = meshLatticeTriangles(Slices, Stacks);
+    MeshIndices* lines = meshLatticeLines(Slices, Stacks);
+    pezCheck(triangles && lines, "Unable to build cylinder indices.");
+
     // Create a buffer with positions
     GLuint positionsVbo;
     if (1) {
-        Vertex verts[VertexCount];
-        Vertex* pVert = &verts[0];
+        Vertex* verts = (Vertex*) malloc(sizeof(Vertex) * VertexCount);
+        pezCheck(verts != 0, "Unable to allocate cylinder vertices.");
+        Vertex* pVert = verts;
         float ds = 1.0f / Stacks;
         float dt = 1.0f / Slices;
 
@@ -255,85 +291,25 @@ static MeshPod CreateCylinder()
 
         pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Vertex) * VertexCount;
         const GLvoid* data = &verts[0].Position.x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            int vps = Slices+1; // vertices per stack
-            for (GLushort i = 0; i < vps; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1) % vps;
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) % vps + vps);
-                *pIndex++ = (n + (i + 1) % vps);
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-
-        GLushort inds[LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Circles:
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks+1; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += Slices + 1;
-        }
-
-        // Longitudinal:
-        n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (Slices + 1);
-            }
-            n += Slices + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
     MeshPod mesh;
     mesh.VertexCount = VertexCount;
-    mesh.FillIndexCount = FillIndexCount;
-    mesh.LineIndexCount = LineIndexCount;
+    mesh.FillIndexCount = triangles->Count;
+    mesh.LineIndexCount = lines->Count;
+    mesh.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
 
     glGenVertexArrays(1, &mesh.FillVao);
     glBindVertexArray(mesh.FillVao);
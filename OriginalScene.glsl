@@ -22,7 +22,11 @@ void main()
 
 in vec4 Position;
 out vec3 vPosition;
+#ifdef DERIVATIVE_NORMALS
+flat out int vInstanceID;
+#else
 out int vInstanceID;
+#endif
 uniform mat4 ModelviewProjection[7];
 
 void main()
@@ -40,7 +44,7 @@ layout(triangle_strip, max_vertices = 3) out;
 in vec3 vPosition[3];
 out vec3 gNormal;
 in int vInstanceID[3];
-out float gDistance[4];
+out vec3 gPosition;
 flat out int gInstanceID;
 
 void main()
@@ -51,6 +55,7 @@ void main()
     gNormal = normalize(cross(A, B));
 
     for (int j = 0; j < 3; j++) {
+        gPosition = vPosition[j];
         gl_Position = gl_in[j].gl_Position;
         EmitVertex();
     }
@@ -59,8 +64,14 @@ void main()
 
 -- Lit.FS
 
+#ifdef DERIVATIVE_NORMALS
+in vec3 vPosition;
+flat in int vInstanceID;
+#else
+in vec3 gPosition;
 in vec3 gNormal;
 flat in int gInstanceID;
+#endif
 out vec4 FragColor;
 uniform vec3 AmbientMaterial = vec3(0.2, 0.2, 0.2);
 uniform vec3 SpecularMaterial = vec3(0.5, 0.5, 0.5);
@@ -70,14 +81,47 @@ uniform float Shininess = 7;
 uniform vec3 Hhat[7];
 uniform vec3 Lhat[7];
 
+#ifdef WIREFRAME
+// The cylinder's rings and slices, as the line indices used to draw them
+// in a second pass.
+uniform vec2 Lattice;
+uniform vec4 LineColor = vec4(0, 0, 0, 1);
+uniform float LineWidth = 1.5;
+
+// How much of this pixel the nearest ring or slice covers.  The quads'
+// diagonals are neither, so they never show.
+float Wire(vec3 p)
+{
+    // Angle around the axis and height along it, in lattice cells.  The
+    // angle's derivatives are worked out from the position's so that the
+    // seam in atan doesn't show.
+    vec2 cell = vec2(atan(p.z, p.x) / 6.28318531, p.y + 0.5) * Lattice;
+    vec3 dx = dFdx(p), dy = dFdy(p);
+    float da = (abs(p.x * dx.z - p.z * dx.x) + abs(p.x * dy.z - p.z * dy.x)) / dot(p.xz, p.xz);
+    vec2 pitch = vec2(da / 6.28318531, abs(dx.y) + abs(dy.y)) * Lattice;
+    vec2 d = abs(fract(cell + 0.5) - 0.5) / max(pitch, vec2(1e-6));
+    return clamp(0.5 * LineWidth + 0.5 - min(d.x, d.y), 0.0, 1.0);
+}
+#endif
+
 void main()
 {
+#ifdef DERIVATIVE_NORMALS
+    // The position's screen-space derivatives lie in the face, and their
+    // cross product points back at the viewer on either side of it.
+    vec3 position = vPosition;
+    vec3 N = normalize(cross(dFdx(position), dFdy(position)));
+    int instance = vInstanceID;
+#else
+    vec3 position = gPosition;
     vec3 N = -normalize(gNormal);
     if (!gl_FrontFacing)
        N = -N;
+    int instance = gInstanceID;
+#endif
 
-    float df = max(0.0, dot(N, Lhat[gInstanceID]));
-    float sf = max(0.0, dot(N, Hhat[gInstanceID]));
+    float df = max(0.0, dot(N, Lhat[instance]));
+    float sf = max(0.0, dot(N, Hhat[instance]));
     sf = pow(sf, Shininess);
 
     vec3 diffuse = gl_FrontFacing ? FrontMaterial.rgb : BackMaterial.rgb;
@@ -86,4 +130,7 @@ void main()
         lighting += sf * SpecularMaterial;
 
     FragColor = vec4(lighting, FrontMaterial.a);
+#ifdef WIREFRAME
+    FragColor = mix(FragColor, LineColor, Wire(position));
+#endif
 }
@@ -3,9 +3,12 @@
 // http://creativecommons.org/licenses/by/3.0/
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "pez.h"
 #include "vmath.h"
+#include "mesh.h"
+#include "lens.h"
 
 typedef struct {
     int VertexCount;
@@ -13,6 +16,8 @@ typedef struct {
     int FillIndexCount;
     GLuint LineVao;
     GLuint FillVao;
+    GLenum IndexType;
+    GLuint RestartIndex;
 } MeshPod;
 
 struct {
@@ -22,7 +27,7 @@ struct {
     MeshPod Cylinder;
     Matrix4 Projection;
     Matrix4 View;
-    float Power;
+    LensModel Lens;
 } Globals;
 
 typedef struct {
@@ -32,6 +37,8 @@ typedef struct {
 static GLuint LoadProgram(const char* vsKey, const char* tcsKey, const char* tesKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
 static MeshPod CreateCylinder();
+static GLuint CreateIndexBuffer(const MeshIndices* indices);
+static void SetLensUniforms(const LensModel* lens);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define a(x) glGetAttribLocation(CurrentProgram(), x)
@@ -39,6 +46,26 @@ static MeshPod CreateCylinder();
 
 const int Slices = 24;
 const int Stacks = 8;
+const bool FastDistort = true;
+
+// Replaces the animated power curve with a calibrated Brown-Conrady lens.
+// Only the terms it uses are compiled into the shaders.
+const bool CalibratedLens = false;
+
+// Tessellates each edge just finely enough that its distorted curve stays
+// within TessError pixels of the segments, rather than TessLevel times
+// everywhere, and skips patches that are off screen.
+const bool AdaptiveTessellation = true;
+const float TessError = 0.25f;
+
+// Also skips back-facing patches.  The cylinders are open and show their
+// insides, so this is off.
+const bool CullBackPatches = false;
+
+// Saves tessellating the cylinders a second time as isolines.
+const bool SinglePassWireframe = true;
+
+const bool DerivativeNormals = true;
 
 PezConfig PezGetConfig()
 {
@@ -56,8 +83,31 @@ void PezInitialize()
     const PezConfig cfg = PezGetConfig();
 
     // Compile shaders
+    Globals.Lens = CalibratedLens ?
+        lensBrownConradyModel(0.22f, 0.024f, 0, 0.0012f, -0.0008f) : lensPowerModel(1);
+    pezSwAddDirective("*", lensShaderDefine(&Globals.Lens));
+    if (FastDistort) {
+        pezSwAddDirective("*", "#define FAST_DISTORT");
+    }
+    if (AdaptiveTessellation) {
+        pezSwAddDirective("*", "#define ADAPTIVE_TESSELLATION");
+    }
+    if (SinglePassWireframe) {
+        pezSwAddDirective("*", "#define WIREFRAME");
+    }
+    bool litGs = !DerivativeNormals || pezOption("gs");
+    if (!litGs) {
+        pezSwAddDirective("*", "#define DERIVATIVE_NORMALS");
+    }
     Globals.SimpleProgram = LoadProgram("Simple.VS", "Simple.TCS", "Simple.TES", 0, "Simple.FS");
-    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.TCS", "Lit.TES", "Lit.GS", "Lit.FS");
+    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.TCS", "Lit.TES", litGs ? "Lit.GS" : 0, "Lit.FS");
+    glUniform1i(u("CullBackPatches"), CullBackPatches);
+    GLuint programs[] = {Globals.SimpleProgram, Globals.LitProgram};
+    for (int i = 0; i < 2; i++) {
+        glUseProgram(programs[i]);
+        glUniform2f(u("Viewport"), cfg.Width, cfg.Height);
+        glUniform1f(u("TessError"), TessError);
+    }
 
     // Set up viewport
     float fovy = 16 * TwoPi / 180;
@@ -90,7 +140,7 @@ void PezUpdate(float seconds)
     const float RadiansPerSecond = 0.5f;
     Globals.Theta += seconds * RadiansPerSecond;
     //Globals.Theta = Pi / 4;
-    Globals.Power = 1.0 - 0.25 * (sin(Globals.Theta * 8.0f) + 1.0);
+    Globals.Lens.Power = 1.0 - 0.25 * (sin(Globals.Theta * 8.0f) + 1.0);
 }
 
 void PezRender()
@@ -147,31 +197,41 @@ void PezRender()
     glUniform4f(u("BackMaterial"), 0.5, 0.5, 0, 1);
     glUniform3fv(u("Hhat"), Instances, &Hhat[0].x);
     glUniform3fv(u("Lhat"), Instances, &Lhat[0].x);
+    glUniform2f(u("Lattice"), Slices, Stacks);
     glUniform1f(u("TessLevel"), TessLevel);
-    glUniform1f(u("Power"), Globals.Power);
+    SetLensUniforms(&Globals.Lens);
     glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
 
     glBindVertexArray(mesh->FillVao);
     glPatchParameteri(GL_PATCH_VERTICES, 3);
-    glDrawElementsInstanced(GL_PATCHES, mesh->FillIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-
-    glPatchParameteri(GL_PATCH_VERTICES, 2);
-    glUseProgram(Globals.SimpleProgram);
-    glUniform4f(u("Color"), 0, 0, 0, 1);
-    glUniform1f(u("TessLevel"), TessLevel);
-    glUniform1f(u("Power"), Globals.Power);
-    glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
-
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(mesh->LineVao);
-    glDrawElementsInstanced(GL_PATCHES, mesh->LineIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-    glDepthMask(GL_TRUE);
+    glDrawElementsInstanced(GL_PATCHES, mesh->FillIndexCount, mesh->IndexType, 0, instanceCount);
+
+    if (!SinglePassWireframe) {
+        glPatchParameteri(GL_PATCH_VERTICES, 2);
+        glUseProgram(Globals.SimpleProgram);
+        glUniform4f(u("Color"), 0, 0, 0, 1);
+        glUniform1f(u("TessLevel"), TessLevel);
+        SetLensUniforms(&Globals.Lens);
+        glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(mesh->LineVao);
+        glDrawElementsInstanced(GL_PATCHES, mesh->LineIndexCount, mesh->IndexType, 0, instanceCount);
+        glDepthMask(GL_TRUE);
+    }
 }
 
 void PezHandleMouse(int x, int y, int action)
 {
 }
 
+static void SetLensUniforms(const LensModel* lens)
+{
+    glUniform1f(u("Lens.Power"), lens->Power);
+    glUniform3f(u("Lens.K"), lens->K1, lens->K2, lens->K3);
+    glUniform2f(u("Lens.P"), lens->P1, lens->P2);
+}
+
 static GLuint CurrentProgram()
 {
     GLuint p;
@@ -179,6 +239,25 @@ static GLuint CurrentProgram()
     return p;
 }
 
+// Puts the shared sections between a tessellation stage's directives and
+// its own text, so that the stages share one copy of the lens and of the
+// edge levels.  Returns the number of strings.
+static GLsizei SpliceShared(const char* source, const char** keys, int count, const char** strings, GLint* lengths)
+{
+    const char* body = strstr(source, "#line");
+    strings[0] = source;
+    lengths[0] = (GLint) (body - source);
+    for (int i = 0; i < count; i++) {
+        const char* shared = pezGetShader(keys[i]);
+        pezCheck(shared != 0, "Can't find shader: %s\n", keys[i]);
+        strings[1 + i] = strstr(shared, "#line");
+        lengths[1 + i] = -1;
+    }
+    strings[1 + count] = body;
+    lengths[1 + count] = -1;
+    return 2 + count;
+}
+
 static GLuint LoadProgram(const char* vsKey, const char* tcsKey, const char* tesKey, const char* gsKey, const char* fsKey)
 {
     GLchar spew[256];
@@ -199,7 +278,11 @@ static GLuint LoadProgram(const char* vsKey, const char* tcsKey, const char* tes
         const char* tcsSource = pezGetShader(tcsKey);
         pezCheck(tcsSource != 0, "Can't find tcshader: %s\n", tcsKey);
         GLuint tcsHandle = glCreateShader(GL_TESS_CONTROL_SHADER);
-        glShaderSource(tcsHandle, 1, &tcsSource, 0);
+        const char* tcsShared[] = { "Distort", "Edges" };
+        const char* tcsStrings[4];
+        GLint tcsLengths[4];
+        GLsizei tcsCount = SpliceShared(tcsSource, tcsShared, 2, tcsStrings, tcsLengths);
+        glShaderSource(tcsHandle, tcsCount, tcsStrings, tcsLengths);
         glCompileShader(tcsHandle);
         glGetShaderiv(tcsHandle, GL_COMPILE_STATUS, &compileSuccess);
         glGetShaderInfoLog(tcsHandle, sizeof(spew), 0, spew);
@@ -211,7 +294,11 @@ static GLuint LoadProgram(const char* vsKey, const char* tcsKey, const char* tes
         const char* tesSource = pezGetShader(tesKey);
         pezCheck(tesSource != 0, "Can't find teshader: %s\n", tesKey);
         GLuint tesHandle = glCreateShader(GL_TESS_EVALUATION_SHADER);
-        glShaderSource(tesHandle, 1, &tesSource, 0);
+        const char* tesShared[] = { "Distort" };
+        const char* tesStrings[3];
+        GLint tesLengths[3];
+        GLsizei tesCount = SpliceShared(tesSource, tesShared, 1, tesStrings, tesLengths);
+        glShaderSource(tesHandle, tesCount, tesStrings, tesLengths);
         glCompileShader(tesHandle);
         glGetShaderiv(tesHandle, GL_COMPILE_STATUS, &compileSuccess);
         glGetShaderInfoLog(tesHandle, sizeof(spew), 0, spew);
@@ -262,20 +349,31 @@ static Vector3 EvaluateCylinder(float s, float t)
     return range;
 }
 
+static GLuint CreateIndexBuffer(const MeshIndices* indices)
+{
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->Size * indices->Count, indices->Data, GL_STATIC_DRAW);
+    return vbo;
+}
+
 static MeshPod CreateCylinder()
 {
     const int VertexCount = (Slices+1) * (Stacks+1);
-    const int FillIndexCount = (Slices+1) * Stacks * 6;
 
-    const int circles = (Stacks+1)*Slices;
-    const int longitudinal = Stacks*Slices;
-    const int LineIndexCount = 2 * (circles + longitudinal);
- 
+    // Stacks are the lattice's columns and slices its rows.  Isoline
+    // patches can't restart, so the lines are separate segments.
+    MeshIndices* triangles = meshLatticeTriangles(Slices, Stacks);
+    MeshIndices* lines = meshLatticeSegments(Slices, Stacks);
+    pezCheck(triangles && lines, "Unable to build cylinder indices.");
+
     // Create a buffer with positions
     GLuint positionsVbo;
     if (1) {
-        Vertex verts[VertexCount];
-        Vertex* pVert = &verts[0];
+        Vertex* verts = (Vertex*) malloc(sizeof(Vertex) * VertexCount);
+        pezCheck(verts != 0, "Unable to allocate cylinder vertices.");
+        Vertex* pVert = verts;
         float ds = 1.0f / Stacks;
         float dt = 1.0f / Slices;
 
@@ -290,85 +388,25 @@ static MeshPod CreateCylinder()
 
         pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Vertex) * VertexCount;
         const GLvoid* data = &verts[0].Position.x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            int vps = Slices+1; // vertices per stack
-            for (GLushort i = 0; i < vps; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1) % vps;
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) % vps + vps);
-                *pIndex++ = (n + (i + 1) % vps);
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-
-        GLushort inds[LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Circles:
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks+1; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += Slices + 1;
-        }
-
-        // Longitudinal:
-        n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (Slices + 1);
-            }
-            n += Slices + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
     MeshPod mesh;
     mesh.VertexCount = VertexCount;
-    mesh.FillIndexCount = FillIndexCount;
-    mesh.LineIndexCount = LineIndexCount;
+    mesh.FillIndexCount = triangles->Count;
+    mesh.LineIndexCount = lines->Count;
+    mesh.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
 
     glGenVertexArrays(1, &mesh.FillVao);
     glBindVertexArray(mesh.FillVao);
@@ -1,3 +1,131 @@
+-- Distort
+
+// Shared by the tessellation stages, which LoadProgram compiles with this
+// section ahead of their own.
+
+struct LensModel {
+    float Power;
+    vec3 K;
+    vec2 P;
+};
+uniform LensModel Lens;
+
+vec4 Distort(vec4 p)
+{
+    vec2 v = p.xy / p.w;
+
+#if defined(LENS_K1) || defined(LENS_RADIAL) || defined(LENS_BROWN_CONRADY)
+    // Brown-Conrady, with only the terms this lens has compiled in
+    // (see lensShaderDefine in lens.h).
+    float r2 = dot(v, v);
+#ifdef LENS_K1
+    float radial = 1.0 + Lens.K.x * r2;
+#else
+    float radial = 1.0 + r2 * (Lens.K.x + r2 * (Lens.K.y + r2 * Lens.K.z));
+#endif
+    vec2 d = v * radial;
+#ifdef LENS_BROWN_CONRADY
+    float xy = 2.0 * v.x * v.y;
+    d.x += Lens.P.x * xy + Lens.P.y * (r2 + 2.0 * v.x * v.x);
+    d.y += Lens.P.x * (r2 + 2.0 * v.y * v.y) + Lens.P.y * xy;
+#endif
+    v = d;
+#elif defined(FAST_DISTORT)
+    // Same as the polar round trip below, since scaling v by
+    // radius^(Lens.Power-1) leaves its angle alone.
+    float r2 = dot(v, v);
+    if (r2 > 0) {
+        if (Lens.Power == 2.0)
+            v *= sqrt(r2);
+        else if (Lens.Power == 0.5)
+            v *= inversesqrt(sqrt(r2));
+        else
+            v *= exp2(0.5 * (Lens.Power - 1.0) * log2(r2));
+    }
+#else
+    // Convert to polar coords:
+    float theta  = atan(v.y,v.x);
+    float radius = length(v);
+
+    // Distort:
+    radius = pow(radius, Lens.Power);
+
+    // Convert back to Cartesian:
+    v.x = radius * cos(theta);
+    v.y = radius * sin(theta);
+#endif
+    p.xy = v.xy * p.w;
+    return p;
+}
+
+-- Edges
+
+// The crack-free edge levels, shared by the control stages, which
+// LoadProgram compiles with Distort and this section ahead of their own.
+// Screen needs the instance, so the input is declared here for them.
+
+in int vInstanceID[];
+
+#ifdef ADAPTIVE_TESSELLATION
+uniform mat4 ModelviewProjection[7];
+uniform vec2 Viewport;
+uniform float TessError;
+
+// Where a point of the patch lands on screen, in pixels from the center.
+vec2 Screen(vec3 p)
+{
+    precise vec4 d = Distort(ModelviewProjection[vInstanceID[0]] * vec4(p, 1));
+    precise vec2 s = 0.5 * Viewport * d.xy / d.w;
+    return s;
+}
+
+// Lexicographic order, to run every edge the same way.
+bool Before(vec3 a, vec3 b)
+{
+    return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.z < b.z;
+}
+
+float Stray(vec2 p, vec2 a, vec2 b)
+{
+    vec2 e = b - a;
+    float t = dot(e, e) > 0.0 ? clamp(dot(p - a, e) / dot(e, e), 0.0, 1.0) : 0.0;
+    return distance(p, a + t * e);
+}
+
+// Segments for the edge from a to b, which land at A and B: enough that
+// the distorted edge strays no more than TessError pixels from its chords.
+// The stray of a gentle curve grows with the square of its length and
+// shrinks with the square of the segment count, so long edges and curved
+// ones both get more.  The samples widen the screen bounds.
+//
+// Every patch and line sharing the edge has to get the same level, or the
+// mesh cracks.  Neighbors see the edge run in opposite directions, so it
+// is put in a fixed order first, and the arithmetic is precise so that the
+// compiler can't evaluate it differently in each.
+float EdgeLevel(vec3 a, vec3 b, vec2 A, vec2 B, inout vec4 bounds)
+{
+    if (Before(b, a)) {
+        vec3 t = a; a = b; b = t;
+        vec2 T = A; A = B; B = T;
+    }
+    precise float stray = 0.0;
+    for (int k = 1; k <= 3; k++) {
+        precise vec2 p = Screen(mix(a, b, 0.25 * float(k)));
+        stray = max(stray, Stray(p, A, B));
+        bounds = vec4(min(bounds.xy, p), max(bounds.zw, p));
+    }
+    return clamp(ceil(sqrt(stray / TessError)), 1.0, float(gl_MaxTessGenLevel));
+}
+
+// Bounds are the corners and edge samples, with a pixel to spare for the
+// curve between them.
+bool Offscreen(vec4 bounds)
+{
+    vec2 reach = 0.5 * Viewport + 1.0;
+    return any(greaterThan(bounds.xy, reach)) || any(lessThan(bounds.zw, -reach));
+}
+#endif
+
 -- Simple.VS
 
 in vec3 Position;
@@ -16,8 +144,6 @@ layout(vertices = 2) out;
 
 in vec3 vPosition[];
 out vec3 tcPosition[];
-
-in int vInstanceID[];
 out int tcInstanceID[];
 
 uniform float TessLevel;
@@ -28,8 +154,19 @@ void main()
 {
     tcPosition[ID] = vPosition[ID];
     tcInstanceID[ID] = vInstanceID[ID];
+#ifdef ADAPTIVE_TESSELLATION
+    if (ID != 0)
+        return;
+
+    vec3 a = vPosition[0], b = vPosition[1];
+    vec2 A = Screen(a), B = Screen(b);
+    vec4 bounds = vec4(min(A, B), max(A, B));
+    gl_TessLevelOuter[1] = EdgeLevel(a, b, A, B, bounds);
+    gl_TessLevelOuter[0] = Offscreen(bounds) ? 0.0 : 1.0;
+#else
     gl_TessLevelOuter[0] = 1;
     gl_TessLevelOuter[1] = TessLevel;
+#endif
 }
 
 -- Simple.TES
@@ -39,25 +176,6 @@ layout(isolines) in;
 in vec3 tcPosition[];
 in int tcInstanceID[];
 uniform mat4 ModelviewProjection[7];
-uniform float Power = 0.5;
-
-vec4 Distort(vec4 p)
-{
-    vec2 v = p.xy / p.w;
-
-    // Convert to polar coords:
-    float theta  = atan(v.y,v.x);
-    float radius = length(v);
-
-    // Distort:
-    radius = pow(radius, Power);
-
-    // Convert back to Cartesian:
-    v.x = radius * cos(theta);
-    v.y = radius * sin(theta);
-    p.xy = v.xy * p.w;
-    return p;
-}
 
 void main()
 {
@@ -95,11 +213,10 @@ layout(vertices = 3) out;
 
 in vec3 vPosition[];
 out vec3 tcPosition[];
-
-in int vInstanceID[];
 out int tcInstanceID[];
 
 uniform float TessLevel;
+uniform bool CullBackPatches;
 
 #define ID gl_InvocationID
 
@@ -108,8 +225,34 @@ void main()
     tcPosition[ID] = vPosition[ID];
     tcInstanceID[ID] = vInstanceID[ID];
 
+#ifdef ADAPTIVE_TESSELLATION
+    // One invocation sets the levels for the whole patch.  Outer level i
+    // is for the edge opposite vertex i.
+    if (ID != 0)
+        return;
+
+    vec3 a = vPosition[0], b = vPosition[1], c = vPosition[2];
+    vec2 A = Screen(a), B = Screen(b), C = Screen(c);
+    vec4 bounds = vec4(min(min(A, B), C), max(max(A, B), C));
+    float bc = EdgeLevel(b, c, B, C, bounds);
+    float ca = EdgeLevel(c, a, C, A, bounds);
+    float ab = EdgeLevel(a, b, A, B, bounds);
+
+    // The lens keeps orientation, so the distorted corners tell which way
+    // the whole patch faces.
+    vec2 e = B - A, f = C - A;
+    bool back = CullBackPatches && e.x * f.y - e.y * f.x < 0.0;
+    if (back || Offscreen(bounds))
+        bc = ca = ab = 0.0;
+
+    gl_TessLevelOuter[0] = bc;
+    gl_TessLevelOuter[1] = ca;
+    gl_TessLevelOuter[2] = ab;
+    gl_TessLevelInner[0] = max(max(bc, ca), ab);
+#else
     gl_TessLevelInner[0] = gl_TessLevelOuter[0] =
     gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = TessLevel;
+#endif
 }
 
 -- Lit.TES
@@ -119,27 +262,12 @@ layout(triangles, equal_spacing, ccw) in;
 in vec3 tcPosition[];
 out vec3 tePosition;
 in int tcInstanceID[];
+#ifdef DERIVATIVE_NORMALS
+flat out int teInstanceID;
+#else
 out int teInstanceID;
+#endif
 uniform mat4 ModelviewProjection[7];
-uniform float Power;
-
-vec4 Distort(vec4 p)
-{
-    vec2 v = p.xy / p.w;
-
-    // Convert to polar coords:
-    float theta  = atan(v.y,v.x);
-    float radius = length(v);
-
-    // Distort:
-    radius = pow(radius, Power);
-
-    // Convert back to Cartesian:
-    v.x = radius * cos(theta);
-    v.y = radius * sin(theta);
-    p.xy = v.xy * p.w;
-    return p;
-}
 
 void main()
 {
@@ -160,7 +288,7 @@ layout(triangle_strip, max_vertices = 3) out;
 in vec3 tePosition[3];
 out vec3 gNormal;
 in int teInstanceID[3];
-out float gDistance[4];
+out vec3 gPosition;
 flat out int gInstanceID;
 
 void main()
@@ -171,6 +299,7 @@ void main()
     gNormal = normalize(cross(A, B));
 
     for (int j = 0; j < 3; j++) {
+        gPosition = tePosition[j];
         gl_Position = gl_in[j].gl_Position;
         EmitVertex();
     }
@@ -179,8 +308,14 @@ void main()
 
 -- Lit.FS
 
+#ifdef DERIVATIVE_NORMALS
+in vec3 tePosition;
+flat in int teInstanceID;
+#else
+in vec3 gPosition;
 in vec3 gNormal;
 flat in int gInstanceID;
+#endif
 out vec4 FragColor;
 uniform vec3 AmbientMaterial = vec3(0.2, 0.2, 0.2);
 uniform vec3 SpecularMaterial = vec3(0.5, 0.5, 0.5);
@@ -190,14 +325,41 @@ uniform float Shininess = 7;
 uniform vec3 Hhat[7];
 uniform vec3 Lhat[7];
 
+#ifdef WIREFRAME
+// The lit-pass wireframe; see OriginalScene.glsl.
+uniform vec2 Lattice;
+uniform vec4 LineColor = vec4(0, 0, 0, 1);
+uniform float LineWidth = 1.5;
+
+float Wire(vec3 p)
+{
+    vec2 cell = vec2(atan(p.z, p.x) / 6.28318531, p.y + 0.5) * Lattice;
+    vec3 dx = dFdx(p), dy = dFdy(p);
+    float da = (abs(p.x * dx.z - p.z * dx.x) + abs(p.x * dy.z - p.z * dy.x)) / dot(p.xz, p.xz);
+    vec2 pitch = vec2(da / 6.28318531, abs(dx.y) + abs(dy.y)) * Lattice;
+    vec2 d = abs(fract(cell + 0.5) - 0.5) / max(pitch, vec2(1e-6));
+    return clamp(0.5 * LineWidth + 0.5 - min(d.x, d.y), 0.0, 1.0);
+}
+#endif
+
 void main()
 {
+#ifdef DERIVATIVE_NORMALS
+    // The position's screen-space derivatives lie in the face, and their
+    // cross product points back at the viewer on either side of it.
+    vec3 position = tePosition;
+    vec3 N = normalize(cross(dFdx(position), dFdy(position)));
+    int instance = teInstanceID;
+#else
+    vec3 position = gPosition;
     vec3 N = -normalize(gNormal);
     if (!gl_FrontFacing)
        N = -N;
+    int instance = gInstanceID;
+#endif
 
-    float df = max(0.0, dot(N, Lhat[gInstanceID]));
-    float sf = max(0.0, dot(N, Hhat[gInstanceID]));
+    float df = max(0.0, dot(N, Lhat[instance]));
+    float sf = max(0.0, dot(N, Hhat[instance]));
     sf = pow(sf, Shininess);
 
     vec3 diffuse = gl_FrontFacing ? FrontMaterial.rgb : BackMaterial.rgb;
@@ -206,4 +368,7 @@ void main()
         lighting += sf * SpecularMaterial;
 
     FragColor = vec4(lighting, FrontMaterial.a);
+#ifdef WIREFRAME
+    FragColor = mix(FragColor, LineColor, Wire(position));
+#endif
 }
@@ -4,8 +4,12 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include "pez.h"
 #include "vmath.h"
+#include "mesh.h"
+#include "warp.h"
 
 struct {
     GLuint Position;
@@ -17,6 +21,8 @@ typedef struct {
     int FillIndexCount;
     GLuint LineVao;
     GLuint FillVao;
+    GLenum IndexType;
+    GLuint RestartIndex;
 } MeshPod;
 
 struct {
@@ -31,19 +37,81 @@ struct {
     GLuint FboHandle;
     GLuint QuadVao;
     float BarrelPower;
+    LensModel Lens;
+    LensChroma Chroma;
+    GLuint RemapProgram;
+    GLuint RemapTexture;
+    WarpCache* RemapCache;
+    bool RemapDirty;
+    GLuint BankProgram;
+    GLuint BankTexture;
+    WarpBank Bank;              // range and count only; the maps live in BankTexture
+    LensTarget Target;
+    LensMultiRes* Layouts;
+    int LayoutStep;
+    GLfloat RegionViewports[9 * 4];
+    GLfloat Regions[9 * 4];
+    bool VertexViewports;       // instances drawn once per region, routed by the VS
+    GLfloat MultiRes[4];
+    int PackedSize[2];
 } Globals;
 
+typedef enum {
+    RemapNone,  // evaluate the warp per fragment
+    RemapTable, // one cached table, rebuilt when the power changes
+    RemapBank,  // blend between tables sampled across the animated range
+} RemapMode;
+
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
 static MeshPod CreateCylinder();
+static GLuint CreateIndexBuffer(const MeshIndices* indices);
 static GLuint CreateQuad();
 static GLuint CreateRenderTarget(GLuint* colorTexture);
+static GLuint CreateRemapTexture(int width, int height);
+static void UpdateRemapTexture();
+static GLuint CreateBankTexture(const WarpBank* bank);
+static void SetLensUniforms(const LensModel* lens);
+static void SetMultiResolution(const LensMultiRes* layout);
+static void UpdateMultiResolution();
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define offset(x) ((const GLvoid*)x)
 
 const int Slices = 24;
 const int Stacks = 8;
+const int RemapBorder = 6;
+const RemapMode Remap = RemapBank;
+const float MinBarrelPower = 1.0;
+const float MaxBarrelPower = 2.0;
+const bool FastDistort = true;
+
+// Replaces the animated barrel power with a calibrated Brown-Conrady lens in
+// Quad.FS.  The remap tables only cover the barrel power.
+const bool CalibratedLens = false;
+
+// Corrects lateral chromatic aberration in Quad.FS, in the same pass.
+const bool ChromaCorrection = false;
+
+// Renders the scene into a lens-matched multi-resolution target: the
+// center at full density and the bands around it with only as many texels
+// as the lens shows there (see lensMultiRes), all in the same pass.  The
+// layout follows the animated power through layouts sampled across its
+// range, like the remap bank.
+const bool MultiResolution = false;
+const int MultiResSteps = 17;
+
+// The render target's size and field of view come from lensSolveTarget,
+// over the animated range, at most this many times the window along each
+// axis.
+const float MaxTargetScale = 1;
+
+// Saves drawing the lines into the render target before it is warped.
+const bool SinglePassWireframe = true;
+
+// Lit.GS still runs for MultiResolution, where the vertex shader can't pick
+// a region.
+const bool DerivativeNormals = true;
 
 PezConfig PezGetConfig()
 {
@@ -67,13 +135,75 @@ void PezInitialize()
     }
 
     // Compile shaders
-    Globals.SimpleProgram = LoadProgram("Simple.VS", 0, "Simple.FS");
+    pezCheck(!CalibratedLens || Remap == RemapNone, "Remap tables only cover the barrel power.");
+    Globals.Lens = CalibratedLens ?
+        lensBrownConradyModel(-0.22f, 0.024f, 0, 0.0012f, -0.0008f) : lensPowerModel(MaxBarrelPower);
+    pezSwAddDirective("*", lensShaderDefine(&Globals.Lens));
+    pezCheck(!ChromaCorrection || Remap == RemapNone, "Remap tables don't correct chromatic aberration.");
+    Globals.Chroma = ChromaCorrection ? lensChroma(0.996f, -0.004f, 1.014f, 0) : lensNoChroma();
+    if (ChromaCorrection) {
+        pezSwAddDirective("*", "#define CHROMA");
+    }
+    if (FastDistort) {
+        pezSwAddDirective("*", "#define FAST_DISTORT");
+    }
+    if (MultiResolution) {
+        pezSwAddDirective("*", "#define MULTI_RESOLUTION");
+    }
+    if (SinglePassWireframe) {
+        pezSwAddDirective("*", "#define WIREFRAME");
+    }
+    Globals.VertexViewports = MultiResolution && DerivativeNormals &&
+        (pezExtension("GL_ARB_shader_viewport_layer_array") ||
+         pezExtension("GL_AMD_vertex_shader_viewport_index")) && !pezOption("gs");
+    if (Globals.VertexViewports) {
+        pezSwAddDirective("*", "#define VERTEX_VIEWPORT");
+    }
+    bool viewportGs = MultiResolution && !Globals.VertexViewports;
+    bool litGs = !DerivativeNormals || viewportGs || pezOption("gs");
+    if (!litGs) {
+        pezSwAddDirective("*", "#define DERIVATIVE_NORMALS");
+    }
+    Globals.SimpleProgram = LoadProgram("Simple.VS", viewportGs ? "Simple.GS" : 0, "Simple.FS");
     Globals.QuadProgram = LoadProgram("Quad.VS", 0, "Quad.FS");
-    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.GS", "Lit.FS");
+    Globals.LitProgram = LoadProgram("Lit.VS", litGs ? "Lit.GS" : 0, "Lit.FS");
+    Globals.RemapProgram = LoadProgram("Quad.VS", 0, "Quad.Remap.FS");
+    glUniform1i(u("RemapTable"), 1);
+    Globals.BankProgram = LoadProgram("Quad.VS", 0, "Quad.Bank.FS");
+    glUniform1i(u("RemapBank"), 1);
+
+    // Fit the render target to the lens at both ends of the animated
+    // range.  The warp only shows the screen inside the border.
+    if (1) {
+        int width = cfg.Width - 2 * RemapBorder;
+        int height = cfg.Height - 2 * RemapBorder;
+        float powers[] = {MinBarrelPower, MaxBarrelPower};
+        for (int k = 0; k < 2; k++) {
+            LensModel lens = Globals.Lens;
+            lens.Power = powers[k];
+            LensTarget target = lensSolveTarget(&lens, width, height, MaxTargetScale);
+            if (k == 0) {
+                Globals.Target = target;
+                continue;
+            }
+            LensTarget* t = &Globals.Target;
+            t->Width = target.Width > t->Width ? target.Width : t->Width;
+            t->Height = target.Height > t->Height ? target.Height : t->Height;
+            t->Extent[0] = fmaxf(t->Extent[0], target.Extent[0]);
+            t->Extent[1] = fmaxf(t->Extent[1], target.Extent[1]);
+            t->Coverage = fminf(t->Coverage, target.Coverage);
+        }
+        pezPrintString("Render target: %d x %d, %.0f%% of the screen sampled at 1:1 or better\n",
+                       Globals.Target.Width, Globals.Target.Height, 100 * Globals.Target.Coverage);
+    }
+    glUseProgram(Globals.QuadProgram);
+    glUniform2fv(u("SourceExtent"), 1, Globals.Target.Extent);
 
-    // Set up viewport
+    // Set up viewport, narrowed to the part of the source that the lens shows
     float fovy = 16 * TwoPi / 180;
     float aspect = (float) cfg.Width / cfg.Height;
+    aspect *= Globals.Target.Extent[0] / Globals.Target.Extent[1];
+    fovy = 2 * atanf(Globals.Target.Extent[1] * tanf(fovy / 2));
     float zNear = 0.1, zFar = 300;
     Globals.Projection = M4MakePerspective(fovy, aspect, zNear, zFar);
     Point3 eye = {0, 1, 4};
@@ -86,6 +216,48 @@ void PezInitialize()
     glUseProgram(Globals.QuadProgram);
     Globals.QuadVao = CreateQuad();
 
+    // Remap tables are computed on the CPU and cached, so the
+    // warp doesn't need any transcendentals per fragment.
+    Globals.RemapCache = warpCreateCache(8, 1.0f / 4096.0f);
+    Globals.RemapTexture = CreateRemapTexture(cfg.Width - 2 * RemapBorder, cfg.Height - 2 * RemapBorder);
+    Globals.RemapDirty = true;
+
+    // The bank covers the whole range swept by PezUpdate, so animating
+    // the power needs no table rebuilds at all.
+    if (Remap == RemapBank) {
+        int width = cfg.Width - 2 * RemapBorder;
+        int height = cfg.Height - 2 * RemapBorder;
+        float maxError = 0.25f; // in texels
+        WarpBank* bank = warpCreateBank(MinBarrelPower, MaxBarrelPower, maxError, 33,
+                                        width, height, Globals.Target.Width, Globals.Target.Height);
+        pezCheckPointer(bank, "Unable to build remap bank.");
+        Globals.BankTexture = CreateBankTexture(bank);
+        Globals.Bank = *bank;
+        Globals.Bank.Maps = 0;
+        warpDestroyBank(bank);
+    }
+
+    // The warp only shows the screen inside the border, so that is what
+    // the layouts match.
+    if (MultiResolution) {
+        int steps = CalibratedLens ? 1 : MultiResSteps;
+        int width = cfg.Width - 2 * RemapBorder;
+        int height = cfg.Height - 2 * RemapBorder;
+        Globals.Layouts = (LensMultiRes*) malloc(sizeof(LensMultiRes) * steps);
+        pezCheckPointer(Globals.Layouts, "Unable to lay out the multi-resolution target.");
+        for (int k = 0; k < steps; k++) {
+            LensModel lens = Globals.Lens;
+            lens.Power = steps > 1 ? MinBarrelPower + (MaxBarrelPower - MinBarrelPower) * k / (steps - 1) : lens.Power;
+            Globals.Layouts[k] = lensMultiRes(&lens, width, height, &Globals.Target);
+        }
+        const LensMultiRes* first = Globals.Layouts;
+        const LensMultiRes* last = Globals.Layouts + steps - 1;
+        pezPrintString("Multi-resolution target: %.0f%% to %.0f%% of the fragments\n",
+                       100 * lensMultiResFraction(first, 0) * lensMultiResFraction(first, 1),
+                       100 * lensMultiResFraction(last, 0) * lensMultiResFraction(last, 1));
+        Globals.LayoutStep = -1;
+    }
+
     // Create geometry
     Globals.Cylinder = CreateCylinder();
 
@@ -98,6 +270,7 @@ void PezInitialize()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_PRIMITIVE_RESTART);
     glPolygonOffset(1,1);
 }
 
@@ -106,7 +279,12 @@ void PezUpdate(float seconds)
     const float RadiansPerSecond = 0.5f;
     Globals.Theta = Pi / 4;
     Globals.Theta += seconds * RadiansPerSecond;
-    Globals.BarrelPower = 2.0 - 0.5 * (sin(Globals.Theta * 4.0f) + 1.0);
+    float power = MaxBarrelPower - 0.5 * (MaxBarrelPower - MinBarrelPower) * (sin(Globals.Theta * 4.0f) + 1.0);
+    if (power != Globals.BarrelPower) {
+        Globals.BarrelPower = power;
+        Globals.Lens.Power = power;
+        Globals.RemapDirty = true;
+    }
 }
 
 void PezRender()
@@ -151,10 +329,16 @@ void PezRender()
         Hhat[i] = V3Normalize(V3Add(Lhat[i], Eye));
     }
 
-    int instanceCount = Instances;
+    int instanceCount = Globals.VertexViewports ? 9 * Instances : Instances;
     MeshPod* mesh = &Globals.Cylinder;
 
     glBindFramebuffer(GL_FRAMEBUFFER, Globals.FboHandle);
+    if (MultiResolution) {
+        UpdateMultiResolution();
+        glViewportArrayv(0, 9, Globals.RegionViewports);
+    } else {
+        glViewport(0, 0, Globals.Target.Width, Globals.Target.Height);
+    }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
@@ -165,32 +349,55 @@ void PezRender()
     glUniform4f(u("BackMaterial"), 0.5, 0.5, 0, 1);
     glUniform3fv(u("Hhat"), Instances, &Hhat[0].x);
     glUniform3fv(u("Lhat"), Instances, &Lhat[0].x);
+    glUniform2f(u("Lattice"), Slices, Stacks);
+    glUniform1f(u("LineWidth"), 1.0);
     glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
 
     glBindVertexArray(mesh->FillVao);
-    glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-
-    glUseProgram(Globals.SimpleProgram);
-    glUniform4f(u("Color"), 0, 0, 0, 1);
-    glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
-
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(mesh->LineVao);
-    glDrawElementsInstanced(GL_LINES, mesh->LineIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-    glDepthMask(GL_TRUE);
+    glPrimitiveRestartIndex(mesh->RestartIndex);
+    glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, mesh->IndexType, 0, instanceCount);
+
+    if (!SinglePassWireframe) {
+        glUseProgram(Globals.SimpleProgram);
+        glUniform4f(u("Color"), 0, 0, 0, 1);
+        glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(mesh->LineVao);
+        glDrawElementsInstanced(GL_LINE_STRIP, mesh->LineIndexCount, mesh->IndexType, 0, instanceCount);
+        glDepthMask(GL_TRUE);
+    }
 
     glDisable(GL_DEPTH_TEST);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     PezConfig cfg = PezGetConfig();
-    glViewport(6,6,cfg.Width-12,cfg.Height-12);
+    glViewport(RemapBorder, RemapBorder, cfg.Width - 2 * RemapBorder, cfg.Height - 2 * RemapBorder);
     glClearColor(1,1,1,1);
     glClear(GL_COLOR_BUFFER_BIT);
     glClearColor(0.8, 0.8, 0.9, 1);
 
-    glUseProgram(Globals.QuadProgram);
-    glUniform1f(u("BarrelPower"), Globals.BarrelPower);
+    if (Remap == RemapBank) {
+        glUseProgram(Globals.BankProgram);
+        glUniform1f(u("BankPosition"), warpBankPosition(&Globals.Bank, Globals.BarrelPower));
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, Globals.BankTexture);
+        glActiveTexture(GL_TEXTURE0);
+    } else if (Remap == RemapTable) {
+        if (Globals.RemapDirty) {
+            UpdateRemapTexture();
+        }
+        glUseProgram(Globals.RemapProgram);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, Globals.RemapTexture);
+        glActiveTexture(GL_TEXTURE0);
+    } else {
+        glUseProgram(Globals.QuadProgram);
+        SetLensUniforms(&Globals.Lens);
+        glUniform3fv(u("ChromaScale"), 1, Globals.Chroma.Scale);
+        glUniform3fv(u("ChromaRadial"), 1, Globals.Chroma.Radial);
+    }
     glBindTexture(GL_TEXTURE_2D, Globals.FboTexture);
     glBindVertexArray(Globals.QuadVao);
     glDisable(GL_BLEND);
@@ -205,6 +412,13 @@ void PezHandleMouse(int x, int y, int action)
 {
 }
 
+static void SetLensUniforms(const LensModel* lens)
+{
+    glUniform1f(u("Lens.Power"), lens->Power);
+    glUniform3f(u("Lens.K"), lens->K1, lens->K2, lens->K3);
+    glUniform2f(u("Lens.P"), lens->P1, lens->P2);
+}
+
 static GLuint CurrentProgram()
 {
     GLuint p;
@@ -269,20 +483,30 @@ static Point3 EvaluateCylinder(float s, float t)
     return range;
 }
 
+static GLuint CreateIndexBuffer(const MeshIndices* indices)
+{
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->Size * indices->Count, indices->Data, GL_STATIC_DRAW);
+    return vbo;
+}
+
 static MeshPod CreateCylinder()
 {
     const int VertexCount = (Slices+1) * (Stacks+1);
-    const int FillIndexCount = (Slices+1) * Stacks * 6;
 
-    const int circles = (Stacks+1)*Slices;
-    const int longitudinal = Stacks*Slices;
-    const int LineIndexCount = 2 * (circles + longitudinal);
- 
+    // Stacks are the lattice's columns and slices its rows.
+    MeshIndices* triangles = meshLatticeTriangles(Slices, Stacks);
+    MeshIndices* lines = meshLatticeLines(Slices, Stacks);
+    pezCheck(triangles && lines, "Unable to build cylinder indices.");
+
     // Create a buffer with positions
     GLuint positionsVbo;
     if (1) {
-        Point3 verts[VertexCount];
-        Point3* pVert = &verts[0];
+        Point3* verts = (Point3*) malloc(sizeof(Point3) * VertexCount);
+        pezCheck(verts != 0, "Unable to allocate cylinder vertices.");
+        Point3* pVert = verts;
         float ds = 1.0f / Stacks;
         float dt = 1.0f / Slices;
 
@@ -296,85 +520,25 @@ static MeshPod CreateCylinder()
 
         pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Point3) * VertexCount;
         const GLvoid* data = &verts[0].x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            int vps = Slices+1; // vertices per stack
-            for (GLushort i = 0; i < vps; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1) % vps;
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) % vps + vps);
-                *pIndex++ = (n + (i + 1) % vps);
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-
-        GLushort inds[LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Circles:
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks+1; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += Slices + 1;
-        }
-
-        // Longitudinal:
-        n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (Slices + 1);
-            }
-            n += Slices + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
     MeshPod mesh;
     mesh.VertexCount = VertexCount;
-    mesh.FillIndexCount = FillIndexCount;
-    mesh.LineIndexCount = LineIndexCount;
+    mesh.FillIndexCount = triangles->Count;
+    mesh.LineIndexCount = lines->Count;
+    mesh.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
 
     glGenVertexArrays(1, &mesh.FillVao);
     glBindVertexArray(mesh.FillVao);
@@ -396,7 +560,7 @@ static MeshPod CreateCylinder()
 static GLuint CreateRenderTarget(GLuint* colorTexture)
 {
     pezCheck(GL_NO_ERROR == glGetError(), "OpenGL error on line %d",  __LINE__);
-    PezConfig cfg = PezGetConfig();
+    int width = Globals.Target.Width, height = Globals.Target.Height;
 
     glGenTextures(1, colorTexture);
     glBindTexture(GL_TEXTURE_2D, *colorTexture);
@@ -404,7 +568,7 @@ static GLuint CreateRenderTarget(GLuint* colorTexture)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cfg.Width, cfg.Height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
     pezCheck(GL_NO_ERROR == glGetError(), "Unable to create color texture.");
 
     GLuint fboHandle;
@@ -415,7 +579,7 @@ static GLuint CreateRenderTarget(GLuint* colorTexture)
     GLuint depthBuffer;
     glGenRenderbuffers(1, &depthBuffer);
     glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cfg.Width, cfg.Height);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
 
     pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
@@ -443,3 +607,131 @@ static GLuint CreateQuad()
     glEnableVertexAttribArray(Attr.Position);
     return vao;
 }
+
+static GLuint CreateRemapTexture(int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16UI, width, height, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, 0);
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create remap texture.");
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+// Called only when PezUpdate has changed the barrel power.  Most of
+// the time the table is already in the cache and only needs uploading.
+static void UpdateRemapTexture()
+{
+    PezConfig cfg = PezGetConfig();
+    int width = cfg.Width - 2 * RemapBorder;
+    int height = cfg.Height - 2 * RemapBorder;
+    const WarpMap* map = warpCacheMap(Globals.RemapCache, Globals.BarrelPower,
+                                      width, height, Globals.Target.Width, Globals.Target.Height);
+    pezCheckPointer((void*) map, "Unable to build remap table.");
+
+    glBindTexture(GL_TEXTURE_2D, Globals.RemapTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, map->Taps);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    Globals.RemapDirty = false;
+}
+
+static GLuint CreateBankTexture(const WarpBank* bank)
+{
+    const WarpMap* map = bank->Maps[0];
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16UI, map->Width, map->Height, bank->Count,
+                 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, 0);
+    for (int layer = 0; layer < bank->Count; layer++) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, map->Width, map->Height, 1,
+                        GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, bank->Maps[layer]->Taps);
+    }
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create remap bank texture.");
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture;
+}
+
+// Lays the scene out in the multi-resolution target.  Along each axis the
+// screen is cut into a left band, the center and a right band, snapped to
+// pixels; the bands keep Scale of their pixels and the center all of them.
+// Region r of the 3 x 3 product gets a viewport in the packed target and
+// a clip-space scale and offset that fill it with its part of the screen.
+static void SetMultiResolution(const LensMultiRes* layout)
+{
+    int size[2] = {Globals.Target.Width, Globals.Target.Height};
+    int scene[2][4], packed[2][4];
+    for (int axis = 0; axis < 2; axis++) {
+        int n = size[axis];
+        int band = (int) roundf(0.5f * (1 - layout->Center[axis]) * n);
+        int squeezed = (int) ceilf(band * layout->Scale[axis]);
+        int center = n - 2 * band;
+        int s[4] = {0, band, band + center, n};
+        int p[4] = {0, squeezed, squeezed + center, 2 * squeezed + center};
+        memcpy(scene[axis], s, sizeof(s));
+        memcpy(packed[axis], p, sizeof(p));
+        Globals.PackedSize[axis] = p[3];
+        Globals.MultiRes[axis] = (float) band / n;
+        Globals.MultiRes[axis + 2] = band ? (float) squeezed / band : 1;
+    }
+
+    for (int r = 0; r < 9; r++) {
+        int slab[2] = {r % 3, r / 3};
+        GLfloat* viewport = Globals.RegionViewports + 4 * r;
+        GLfloat* region = Globals.Regions + 4 * r;
+        for (int axis = 0; axis < 2; axis++) {
+            int k = slab[axis];
+            float a = 2.0f * scene[axis][k] / size[axis] - 1;
+            float b = 2.0f * scene[axis][k + 1] / size[axis] - 1;
+            viewport[axis] = packed[axis][k];
+            viewport[axis + 2] = packed[axis][k + 1] - packed[axis][k];
+            bool empty = viewport[axis + 2] == 0;
+            region[axis] = empty ? 0 : 2 / (b - a);
+            region[axis + 2] = empty ? 0 : -(a + b) / (b - a);
+        }
+    }
+
+    GLuint programs[] = {Globals.LitProgram, Globals.SimpleProgram, Globals.QuadProgram,
+                         Globals.RemapProgram, Globals.BankProgram};
+    for (int i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        glUseProgram(programs[i]);
+        glUniform4fv(u("Regions"), 9, Globals.Regions);
+        glUniform4fv(u("MultiResolution"), 1, Globals.MultiRes);
+    }
+}
+
+// Lays the target out for the current barrel power, with the larger of the
+// two sampled layouts around it in each field so that both are covered.
+static void UpdateMultiResolution()
+{
+    int steps = CalibratedLens ? 1 : MultiResSteps;
+    int k = 0;
+    if (steps > 1) {
+        float t = (Globals.BarrelPower - MinBarrelPower) / (MaxBarrelPower - MinBarrelPower) * (steps - 1);
+        k = (int) fminf(fmaxf(t, 0), steps - 2);
+    }
+    if (k == Globals.LayoutStep) {
+        return;
+    }
+    Globals.LayoutStep = k;
+
+    LensMultiRes layout = Globals.Layouts[k];
+    if (steps > 1) {
+        const LensMultiRes* next = Globals.Layouts + k + 1;
+        for (int axis = 0; axis < 2; axis++) {
+            layout.Center[axis] = fmaxf(layout.Center[axis], next->Center[axis]);
+            layout.Scale[axis] = fmaxf(layout.Scale[axis], next->Scale[axis]);
+        }
+    }
+    SetMultiResolution(&layout);
+}
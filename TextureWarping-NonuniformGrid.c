@@ -4,8 +4,12 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include "pez.h"
 #include "vmath.h"
+#include "lens.h"
+#include "mesh.h"
 
 struct {
     GLuint Position;
@@ -18,6 +22,8 @@ typedef struct {
     int FillIndexCount;
     GLuint LineVao;
     GLuint FillVao;
+    GLenum IndexType;
+    GLuint RestartIndex;
 } MeshPod;
 
 struct {
@@ -33,6 +39,14 @@ struct {
     GLuint FboHandle;
     GLuint QuadVao;
     MeshPod Grid;
+    LensModel Lens;
+    LensTarget Target;
+    LensMultiRes Layout;
+    GLfloat RegionViewports[9 * 4];
+    GLfloat Regions[9 * 4];
+    bool VertexViewports;       // instances drawn once per region, routed by the VS
+    GLfloat MultiRes[4];
+    int PackedSize[2];
 } Globals;
 
 typedef struct {
@@ -45,7 +59,10 @@ static GLuint CurrentProgram();
 static MeshPod CreateCylinder();
 static GLuint CreateQuad();
 static MeshPod CreateGrid(int rows, int cols);
+static GLuint CreateIndexBuffer(const MeshIndices* indices);
 static GLuint CreateRenderTarget(GLuint* colorTexture);
+static void SetMultiResolution(const LensMultiRes* layout);
+static Vector2 TargetTexCoord(float x, float y);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define offset(x) ((const GLvoid*)x)
@@ -55,6 +72,26 @@ const int Stacks = 8;
 const int GridRows = 20;
 const int GridCols = 36;
 
+// The grid corrects for a barrel power of 2 unless this is set, in which
+// case it corrects for a calibrated Brown-Conrady lens.
+const bool CalibratedLens = false;
+
+// Renders the scene into a lens-matched multi-resolution target: the
+// center at full density and the bands around it with only as many texels
+// as the lens shows there (see lensMultiRes), all in the same pass.
+const bool MultiResolution = false;
+
+// The render target's size and field of view come from lensSolveTarget,
+// at most this many times the window along each axis.
+const float MaxTargetScale = 1;
+
+// Saves drawing the lines into the render target before it is warped.
+const bool SinglePassWireframe = true;
+
+// Lit.GS still runs for MultiResolution, where the vertex shader can't pick
+// a region.
+const bool DerivativeNormals = true;
+
 PezConfig PezGetConfig()
 {
     PezConfig config;
@@ -77,14 +114,40 @@ void PezInitialize()
     }
 
     // Compile shaders
-    Globals.SimpleProgram = LoadProgram("Simple.VS", 0, "Simple.FS");
+    if (MultiResolution) {
+        pezSwAddDirective("*", "#define MULTI_RESOLUTION");
+    }
+    if (SinglePassWireframe) {
+        pezSwAddDirective("*", "#define WIREFRAME");
+    }
+    Globals.VertexViewports = MultiResolution && DerivativeNormals &&
+        (pezExtension("GL_ARB_shader_viewport_layer_array") ||
+         pezExtension("GL_AMD_vertex_shader_viewport_index")) && !pezOption("gs");
+    if (Globals.VertexViewports) {
+        pezSwAddDirective("*", "#define VERTEX_VIEWPORT");
+    }
+    bool viewportGs = MultiResolution && !Globals.VertexViewports;
+    bool litGs = !DerivativeNormals || viewportGs || pezOption("gs");
+    if (!litGs) {
+        pezSwAddDirective("*", "#define DERIVATIVE_NORMALS");
+    }
+    Globals.SimpleProgram = LoadProgram("Simple.VS", viewportGs ? "Simple.GS" : 0, "Simple.FS");
     Globals.QuadProgram = LoadProgram("Quad.VS", 0, "Quad.FS");
     Globals.GridProgram = LoadProgram("Grid.VS", 0, "Grid.FS");
-    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.GS", "Lit.FS");
+    Globals.LitProgram = LoadProgram("Lit.VS", litGs ? "Lit.GS" : 0, "Lit.FS");
+
+    // Fit the render target to the lens
+    Globals.Lens = CalibratedLens ?
+        lensBrownConradyModel(-0.22f, 0.024f, 0, 0.0012f, -0.0008f) : lensPowerModel(2);
+    Globals.Target = lensSolveTarget(&Globals.Lens, cfg.Width, cfg.Height, MaxTargetScale);
+    pezPrintString("Render target: %d x %d, %.0f%% of the screen sampled at 1:1 or better\n",
+                   Globals.Target.Width, Globals.Target.Height, 100 * Globals.Target.Coverage);
 
-    // Set up viewport
+    // Set up viewport, narrowed to the part of the source that the lens shows
     float fovy = 16 * TwoPi / 180;
     float aspect = (float) cfg.Width / cfg.Height;
+    aspect *= Globals.Target.Extent[0] / Globals.Target.Extent[1];
+    fovy = 2 * atanf(Globals.Target.Extent[1] * tanf(fovy / 2));
     float zNear = 0.1, zFar = 300;
     Globals.Projection = M4MakePerspective(fovy, aspect, zNear, zFar);
     Point3 eye = {0, 1, 4};
@@ -96,6 +159,14 @@ void PezInitialize()
     Globals.FboHandle = CreateRenderTarget(&Globals.FboTexture);
     glUseProgram(Globals.QuadProgram);
     Globals.QuadVao = CreateQuad();
+    if (MultiResolution) {
+        Globals.Layout = lensMultiRes(&Globals.Lens, cfg.Width, cfg.Height, &Globals.Target);
+        SetMultiResolution(&Globals.Layout);
+        pezPrintString("Multi-resolution target: %d x %d, %.0f%% of the fragments\n",
+                       Globals.PackedSize[0], Globals.PackedSize[1],
+                       100.0 * Globals.PackedSize[0] * Globals.PackedSize[1] /
+                       (Globals.Target.Width * Globals.Target.Height));
+    }
     Globals.Grid = CreateGrid(GridRows, GridCols);
 
     // Create geometry
@@ -110,6 +181,7 @@ void PezInitialize()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_PRIMITIVE_RESTART);
     glPolygonOffset(1,1);
 }
 
@@ -162,10 +234,16 @@ void PezRender()
         Hhat[i] = V3Normalize(V3Add(Lhat[i], Eye));
     }
 
-    int instanceCount = Instances;
+    int instanceCount = Globals.VertexViewports ? 9 * Instances : Instances;
     MeshPod* mesh = &Globals.Cylinder;
 
+    PezConfig cfg = PezGetConfig();
     glBindFramebuffer(GL_FRAMEBUFFER, Globals.FboHandle);
+    if (MultiResolution) {
+        glViewportArrayv(0, 9, Globals.RegionViewports);
+    } else {
+        glViewport(0, 0, Globals.Target.Width, Globals.Target.Height);
+    }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
@@ -176,32 +254,38 @@ void PezRender()
     glUniform4f(u("BackMaterial"), 0.5, 0.5, 0, 1);
     glUniform3fv(u("Hhat"), Instances, &Hhat[0].x);
     glUniform3fv(u("Lhat"), Instances, &Lhat[0].x);
+    glUniform2f(u("Lattice"), Slices, Stacks);
     glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
 
     glBindVertexArray(mesh->FillVao);
-    glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-
-    glUseProgram(Globals.SimpleProgram);
-    glUniform4f(u("Color"), 0, 0, 0, 1);
-    glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
-
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(mesh->LineVao);
-    glDrawElementsInstanced(GL_LINES, mesh->LineIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-    glDepthMask(GL_TRUE);
+    glPrimitiveRestartIndex(mesh->RestartIndex);
+    glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, mesh->IndexType, 0, instanceCount);
+
+    if (!SinglePassWireframe) {
+        glUseProgram(Globals.SimpleProgram);
+        glUniform4f(u("Color"), 0, 0, 0, 1);
+        glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(mesh->LineVao);
+        glDrawElementsInstanced(GL_LINE_STRIP, mesh->LineIndexCount, mesh->IndexType, 0, instanceCount);
+        glDepthMask(GL_TRUE);
+    }
 
     glDisable(GL_DEPTH_TEST);
 
+    glViewport(0, 0, cfg.Width, cfg.Height);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glUseProgram(Globals.QuadProgram);
     glBindTexture(GL_TEXTURE_2D, Globals.FboTexture);
     glBindVertexArray(Globals.Grid.FillVao);
-    glDrawElements(GL_TRIANGLES, Globals.Grid.FillIndexCount, GL_UNSIGNED_SHORT, 0);
+    glPrimitiveRestartIndex(Globals.Grid.RestartIndex);
+    glDrawElements(GL_TRIANGLE_STRIP, Globals.Grid.FillIndexCount, Globals.Grid.IndexType, 0);
 
     if (1) {
         glUseProgram(Globals.GridProgram);
         glBindVertexArray(Globals.Grid.LineVao);
-        glDrawElements(GL_LINES, Globals.Grid.LineIndexCount, GL_UNSIGNED_SHORT, 0);
+        glDrawElements(GL_LINE_STRIP, Globals.Grid.LineIndexCount, Globals.Grid.IndexType, 0);
     }
 
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -278,17 +362,18 @@ static Point3 EvaluateCylinder(float s, float t)
 static MeshPod CreateCylinder()
 {
     const int VertexCount = (Slices+1) * (Stacks+1);
-    const int FillIndexCount = (Slices+1) * Stacks * 6;
 
-    const int circles = (Stacks+1)*Slices;
-    const int longitudinal = Stacks*Slices;
-    const int LineIndexCount = 2 * (circles + longitudinal);
- 
+    // Stacks are the lattice's columns and slices its rows.
+    MeshIndices* triangles = meshLatticeTriangles(Slices, Stacks);
+    MeshIndices* lines = meshLatticeLines(Slices, Stacks);
+    pezCheck(triangles && lines, "Unable to build cylinder indices.");
+
     // Create a buffer with positions
     GLuint positionsVbo;
     if (1) {
-        Point3 verts[VertexCount];
-        Point3* pVert = &verts[0];
+        Point3* verts = (Point3*) malloc(sizeof(Point3) * VertexCount);
+        pezCheck(verts != 0, "Unable to allocate cylinder vertices.");
+        Point3* pVert = verts;
         float ds = 1.0f / Stacks;
         float dt = 1.0f / Slices;
 
@@ -302,85 +387,25 @@ static MeshPod CreateCylinder()
 
         pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Point3) * VertexCount;
         const GLvoid* data = &verts[0].x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            int vps = Slices+1; // vertices per stack
-            for (GLushort i = 0; i < vps; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1) % vps;
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) % vps + vps);
-                *pIndex++ = (n + (i + 1) % vps);
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-
-        GLushort inds[LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Circles:
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks+1; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += Slices + 1;
-        }
-
-        // Longitudinal:
-        n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (Slices + 1);
-            }
-            n += Slices + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
     MeshPod mesh;
     mesh.VertexCount = VertexCount;
-    mesh.FillIndexCount = FillIndexCount;
-    mesh.LineIndexCount = LineIndexCount;
+    mesh.FillIndexCount = triangles->Count;
+    mesh.LineIndexCount = lines->Count;
+    mesh.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
 
     glGenVertexArrays(1, &mesh.FillVao);
     glBindVertexArray(mesh.FillVao);
@@ -402,7 +427,7 @@ static MeshPod CreateCylinder()
 static GLuint CreateRenderTarget(GLuint* colorTexture)
 {
     pezCheck(GL_NO_ERROR == glGetError(), "OpenGL error on line %d",  __LINE__);
-    PezConfig cfg = PezGetConfig();
+    int width = Globals.Target.Width, height = Globals.Target.Height;
 
     glGenTextures(1, colorTexture);
     glBindTexture(GL_TEXTURE_2D, *colorTexture);
@@ -410,7 +435,7 @@ static GLuint CreateRenderTarget(GLuint* colorTexture)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cfg.Width, cfg.Height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
     pezCheck(GL_NO_ERROR == glGetError(), "Unable to create color texture.");
 
     GLuint fboHandle;
@@ -421,7 +446,7 @@ static GLuint CreateRenderTarget(GLuint* colorTexture)
     GLuint depthBuffer;
     glGenRenderbuffers(1, &depthBuffer);
     glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cfg.Width, cfg.Height);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
 
     pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
@@ -429,20 +454,25 @@ static GLuint CreateRenderTarget(GLuint* colorTexture)
     return fboHandle;
 }
 
+static GLuint CreateIndexBuffer(const MeshIndices* indices)
+{
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->Size * indices->Count, indices->Data, GL_STATIC_DRAW);
+    return vbo;
+}
+
 static MeshPod CreateGrid(int rows, int columns)
 {
     MeshPod grid;
     grid.VertexCount = (columns+1) * (rows+1);
-    grid.FillIndexCount = 6 * columns * rows;
-    int horizontalLines = rows * (columns + 1);
-    int verticalLines = columns * (rows + 1);
-    grid.LineIndexCount = 2 * (horizontalLines + verticalLines);
 
     // Create a buffer with interleaved positions and texture coordinates
     GLuint positionsVbo;
     if (1) {
-        Vertex verts[grid.VertexCount];
-        Vertex* pVert = &verts[0];
+        Vertex* verts = (Vertex*) malloc(sizeof(Vertex) * grid.VertexCount);
+        Vertex* pVert = verts;
         float ds = 1.0f / columns;
         float dt = 1.0f / rows;
 
@@ -459,94 +489,41 @@ static MeshPod CreateGrid(int rows, int columns)
                 float x = u*2-1;
                 float y = v*2-1;
 
-                float theta  = atan2(y,x);
-                float radius = sqrt(x*x+y*y);
-                radius = sqrt(radius);
-                x = radius * cos(theta);
-                y = radius * sin(theta);
-                pVert->Position = (Point3){x, y, 0};
-                pVert->TexCoord.x = u;
-                pVert->TexCoord.y = v;
+                // Move the vertex to where the lens shows this texel.
+                float xy[2] = {x, y};
+                lensUndistort(&Globals.Lens, xy, 1, 1e-6f, 8);
+
+                pVert->Position = (Point3){xy[0], xy[1], 0};
+                pVert->TexCoord = TargetTexCoord(x, y);
                 ++pVert;
             }
         }
 
         pezCheck(pVert - &verts[0] == grid.VertexCount, "Tessellation error.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Vertex) * grid.VertexCount;
         const GLvoid* data = &verts[0].Position.x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[grid.FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < columns; j++) {
-            int vps = rows+1; // vertices per row
-            for (GLushort i = 0; i < rows; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1);
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) + vps);
-                *pIndex++ = (n + (i + 1));
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == grid.FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-        GLushort inds[grid.LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Horizontal:
-        GLushort n = 0;
-        for (GLushort j = 0; j < columns+1; j++) {
-            for (GLushort i = 0; i < rows; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += rows + 1;
-        }
+    // Triangle strips down each column and line strips along both
+    // directions, with 32-bit indices only if the grid needs them.
+    MeshIndices* triangles = meshLatticeStrips(rows, columns);
+    MeshIndices* lines = meshLatticeLines(rows, columns);
+    pezCheck(triangles && lines, "Unable to build grid indices.");
+    grid.FillIndexCount = triangles->Count;
+    grid.LineIndexCount = lines->Count;
+    grid.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    grid.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
 
-        // Vertical:
-        n = 0;
-        for (GLushort j = 0; j < columns; j++) {
-            for (GLushort i = 0; i < rows+1; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (rows + 1);
-            }
-            n += rows + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == grid.LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-    
     glGenVertexArrays(1, &grid.FillVao);
     glBindVertexArray(grid.FillVao);
     glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
@@ -620,3 +597,57 @@ static GLuint CreateQuad()
     glEnableVertexAttribArray(Attr.TexCoord);
     return vao;
 }
+
+// Where a source point, in normalized device coordinates, lands in the
+// render target, which only reaches Globals.Target.Extent into the source.
+static Vector2 TargetTexCoord(float x, float y)
+{
+    return (Vector2){0.5f * (x / Globals.Target.Extent[0] + 1), 0.5f * (y / Globals.Target.Extent[1] + 1)};
+}
+
+// Lays the scene out in the multi-resolution target.  Along each axis the
+// screen is cut into a left band, the center and a right band, snapped to
+// pixels; the bands keep Scale of their pixels and the center all of them.
+// Region r of the 3 x 3 product gets a viewport in the packed target and
+// a clip-space scale and offset that fill it with its part of the screen.
+static void SetMultiResolution(const LensMultiRes* layout)
+{
+    int size[2] = {Globals.Target.Width, Globals.Target.Height};
+    int scene[2][4], packed[2][4];
+    for (int axis = 0; axis < 2; axis++) {
+        int n = size[axis];
+        int band = (int) roundf(0.5f * (1 - layout->Center[axis]) * n);
+        int squeezed = (int) ceilf(band * layout->Scale[axis]);
+        int center = n - 2 * band;
+        int s[4] = {0, band, band + center, n};
+        int p[4] = {0, squeezed, squeezed + center, 2 * squeezed + center};
+        memcpy(scene[axis], s, sizeof(s));
+        memcpy(packed[axis], p, sizeof(p));
+        Globals.PackedSize[axis] = p[3];
+        Globals.MultiRes[axis] = (float) band / n;
+        Globals.MultiRes[axis + 2] = band ? (float) squeezed / band : 1;
+    }
+
+    for (int r = 0; r < 9; r++) {
+        int slab[2] = {r % 3, r / 3};
+        GLfloat* viewport = Globals.RegionViewports + 4 * r;
+        GLfloat* region = Globals.Regions + 4 * r;
+        for (int axis = 0; axis < 2; axis++) {
+            int k = slab[axis];
+            float a = 2.0f * scene[axis][k] / size[axis] - 1;
+            float b = 2.0f * scene[axis][k + 1] / size[axis] - 1;
+            viewport[axis] = packed[axis][k];
+            viewport[axis + 2] = packed[axis][k + 1] - packed[axis][k];
+            bool empty = viewport[axis + 2] == 0;
+            region[axis] = empty ? 0 : 2 / (b - a);
+            region[axis + 2] = empty ? 0 : -(a + b) / (b - a);
+        }
+    }
+
+    GLuint programs[] = {Globals.LitProgram, Globals.SimpleProgram, Globals.QuadProgram};
+    for (int i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        glUseProgram(programs[i]);
+        glUniform4fv(u("Regions"), 9, Globals.Regions);
+        glUniform4fv(u("MultiResolution"), 1, Globals.MultiRes);
+    }
+}
@@ -34,21 +34,105 @@ in vec2 vTexCoord;
 out vec4 FragColor;
 uniform sampler2D Sampler;
 
+#ifdef MULTI_RESOLUTION
+// Where a texture coordinate of the screen lands in the multi-resolution
+// target: the center keeps its texels and the bands on either side are
+// squeezed.  MultiResolution holds the width of the bands and their scale.
+uniform vec4 MultiResolution;
+
+vec2 Packed(vec2 tc)
+{
+    vec2 lo = MultiResolution.xy;
+    vec2 hi = 1.0 - lo;
+    vec2 scale = MultiResolution.zw;
+    return scale * min(tc, lo) + clamp(tc, lo, hi) - lo + scale * max(tc - hi, 0.0);
+}
+#else
+vec2 Packed(vec2 tc)
+{
+    return tc;
+}
+#endif
+
 void main()
 {
-    FragColor = texture(Sampler, vTexCoord);
+    FragColor = texture(Sampler, Packed(vTexCoord));
 }
 
 -- Simple.VS
 
+#ifdef VERTEX_VIEWPORT
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+#endif
+
 layout(location = 0) in vec4 Position;
 uniform mat4 ModelviewProjection[7];
 
+#ifdef VERTEX_VIEWPORT
+// Instance i draws object i / 9 into region i % 9, in place of Simple.GS's
+// invocations.  The regions clip what they miss, and empty ones move the
+// vertices past the far plane.
+uniform vec4 Regions[9];
+
+vec4 Route(vec4 p, int region)
+{
+    vec4 r = Regions[region];
+    gl_ViewportIndex = region;
+    p.xy = p.xy * r.xy + r.zw * p.w;
+    return r.x == 0 || r.y == 0 ? vec4(0, 0, 2, 1) : p;
+}
+
+void main()
+{
+    gl_Position = Route(ModelviewProjection[gl_InstanceID / 9] * Position, gl_InstanceID % 9);
+}
+#else
 void main()
 {
     gl_Position = ModelviewProjection[gl_InstanceID] * Position;
 }
+#endif
+
+
+-- Simple.GS
+
+layout(lines, invocations = 9) in;
+layout(line_strip, max_vertices = 2) out;
+
+// Each invocation draws into one region of the multi-resolution target,
+// scaling and offsetting clip space so that the region's part of the
+// screen fills its viewport (see SetMultiResolution).  Regions that the
+// primitive misses, and empty ones, are skipped.
+uniform vec4 Regions[9];
+
+bool Outside(vec4 a, vec4 b, vec4 c)
+{
+    vec3 x = vec3(a.x, b.x, c.x);
+    vec3 y = vec3(a.y, b.y, c.y);
+    vec3 w = vec3(a.w, b.w, c.w);
+    return all(greaterThan(x, w)) || all(lessThan(x, -w)) ||
+           all(greaterThan(y, w)) || all(lessThan(y, -w));
+}
+
+void main()
+{
+    vec4 region = Regions[gl_InvocationID];
+    vec4 p[2];
+    for (int j = 0; j < 2; j++) {
+        p[j] = gl_in[j].gl_Position;
+        p[j].xy = p[j].xy * region.xy + region.zw * p[j].w;
+    }
+    if (region.x == 0 || region.y == 0 || Outside(p[0], p[1], p[1]))
+        return;
 
+    for (int j = 0; j < 2; j++) {
+        gl_ViewportIndex = gl_InvocationID;
+        gl_Position = p[j];
+        EmitVertex();
+    }
+    EndPrimitive();
+}
 
 -- Simple.FS
 
@@ -61,29 +145,77 @@ void main()
 
 -- Lit.VS
 
+#ifdef VERTEX_VIEWPORT
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+#endif
+
 layout(location = 0) in vec4 Position;
 out vec3 vPosition;
+#ifdef DERIVATIVE_NORMALS
+flat out int vInstanceID;
+#else
 out int vInstanceID;
+#endif
 uniform mat4 ModelviewProjection[7];
 
+#ifdef VERTEX_VIEWPORT
+// Same routing as Simple.VS.
+uniform vec4 Regions[9];
+
+vec4 Route(vec4 p, int region)
+{
+    vec4 r = Regions[region];
+    gl_ViewportIndex = region;
+    p.xy = p.xy * r.xy + r.zw * p.w;
+    return r.x == 0 || r.y == 0 ? vec4(0, 0, 2, 1) : p;
+}
+#endif
+
 void main()
 {
-    vInstanceID = gl_InstanceID;
+#ifdef VERTEX_VIEWPORT
+    int id = gl_InstanceID / 9;
+#else
+    int id = gl_InstanceID;
+#endif
+    vInstanceID = id;
     vPosition = Position.xyz;
-    gl_Position = ModelviewProjection[gl_InstanceID] * Position;
+    gl_Position = ModelviewProjection[id] * Position;
+#ifdef VERTEX_VIEWPORT
+    gl_Position = Route(gl_Position, gl_InstanceID % 9);
+#endif
 }
 
 
 -- Lit.GS
 
+#ifdef MULTI_RESOLUTION
+layout(triangles, invocations = 9) in;
+#else
 layout(triangles) in;
+#endif
 layout(triangle_strip, max_vertices = 3) out;
 in vec3 vPosition[3];
 out vec3 gNormal;
 in int vInstanceID[3];
-out float gDistance[4];
+out vec3 gPosition;
 flat out int gInstanceID;
 
+#ifdef MULTI_RESOLUTION
+// Same regions as Simple.GS.
+uniform vec4 Regions[9];
+
+bool Outside(vec4 a, vec4 b, vec4 c)
+{
+    vec3 x = vec3(a.x, b.x, c.x);
+    vec3 y = vec3(a.y, b.y, c.y);
+    vec3 w = vec3(a.w, b.w, c.w);
+    return all(greaterThan(x, w)) || all(lessThan(x, -w)) ||
+           all(greaterThan(y, w)) || all(lessThan(y, -w));
+}
+#endif
+
 void main()
 {
     gInstanceID = vInstanceID[0];
@@ -91,8 +223,25 @@ void main()
     vec3 B = vPosition[1] - vPosition[0];
     gNormal = normalize(cross(A, B));
 
+#ifdef MULTI_RESOLUTION
+    vec4 region = Regions[gl_InvocationID];
+    vec4 p[3];
     for (int j = 0; j < 3; j++) {
+        p[j] = gl_in[j].gl_Position;
+        p[j].xy = p[j].xy * region.xy + region.zw * p[j].w;
+    }
+    if (region.x == 0 || region.y == 0 || Outside(p[0], p[1], p[2]))
+        return;
+#endif
+
+    for (int j = 0; j < 3; j++) {
+        gPosition = vPosition[j];
+#ifdef MULTI_RESOLUTION
+        gl_ViewportIndex = gl_InvocationID;
+        gl_Position = p[j];
+#else
         gl_Position = gl_in[j].gl_Position;
+#endif
         EmitVertex();
     }
     EndPrimitive();
@@ -100,8 +249,14 @@ void main()
 
 -- Lit.FS
 
+#ifdef DERIVATIVE_NORMALS
+in vec3 vPosition;
+flat in int vInstanceID;
+#else
+in vec3 gPosition;
 in vec3 gNormal;
 flat in int gInstanceID;
+#endif
 out vec4 FragColor;
 uniform vec3 AmbientMaterial = vec3(0.2, 0.2, 0.2);
 uniform vec3 SpecularMaterial = vec3(0.5, 0.5, 0.5);
@@ -111,14 +266,41 @@ uniform float Shininess = 7;
 uniform vec3 Hhat[7];
 uniform vec3 Lhat[7];
 
+#ifdef WIREFRAME
+// The lit-pass wireframe; see OriginalScene.glsl.
+uniform vec2 Lattice;
+uniform vec4 LineColor = vec4(0, 0, 0, 1);
+uniform float LineWidth = 1.5;
+
+float Wire(vec3 p)
+{
+    vec2 cell = vec2(atan(p.z, p.x) / 6.28318531, p.y + 0.5) * Lattice;
+    vec3 dx = dFdx(p), dy = dFdy(p);
+    float da = (abs(p.x * dx.z - p.z * dx.x) + abs(p.x * dy.z - p.z * dy.x)) / dot(p.xz, p.xz);
+    vec2 pitch = vec2(da / 6.28318531, abs(dx.y) + abs(dy.y)) * Lattice;
+    vec2 d = abs(fract(cell + 0.5) - 0.5) / max(pitch, vec2(1e-6));
+    return clamp(0.5 * LineWidth + 0.5 - min(d.x, d.y), 0.0, 1.0);
+}
+#endif
+
 void main()
 {
+#ifdef DERIVATIVE_NORMALS
+    // The position's screen-space derivatives lie in the face, and their
+    // cross product points back at the viewer on either side of it.
+    vec3 position = vPosition;
+    vec3 N = normalize(cross(dFdx(position), dFdy(position)));
+    int instance = vInstanceID;
+#else
+    vec3 position = gPosition;
     vec3 N = -normalize(gNormal);
     if (!gl_FrontFacing)
        N = -N;
+    int instance = gInstanceID;
+#endif
 
-    float df = max(0.0, dot(N, Lhat[gInstanceID]));
-    float sf = max(0.0, dot(N, Hhat[gInstanceID]));
+    float df = max(0.0, dot(N, Lhat[instance]));
+    float sf = max(0.0, dot(N, Hhat[instance]));
     sf = pow(sf, Shininess);
 
     vec3 diffuse = gl_FrontFacing ? FrontMaterial.rgb : BackMaterial.rgb;
@@ -127,4 +309,7 @@ void main()
         lighting += sf * SpecularMaterial;
 
     FragColor = vec4(lighting, FrontMaterial.a);
+#ifdef WIREFRAME
+    FragColor = mix(FragColor, LineColor, Wire(position));
+#endif
 }
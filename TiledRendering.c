@@ -6,6 +6,9 @@
 #include <stdbool.h>
 #include "pez.h"
 #include "vmath.h"
+#include "lens.h"
+#include "mesh.h"
+#include "cull.h"
 
 struct {
     GLuint Position;
@@ -18,6 +21,8 @@ typedef struct {
     int FillIndexCount;
     GLuint LineVao;
     GLuint FillVao;
+    GLenum IndexType;
+    GLuint RestartIndex;
 } MeshPod;
 
 struct {
@@ -25,36 +30,70 @@ struct {
     GLuint LitProgram;
     GLuint SimpleProgram;
     GLuint QuadProgram;
-    GLuint GridProgram;
     MeshPod Cylinder;
     Matrix4 Projection;
     Matrix4 View;
     GLuint FboTexture;
     GLuint FboHandle;
     GLuint QuadVao;
-    MeshPod Grid;
+    LensModel Lens;
+    int Rows;                   // of cells
+    int Columns;
+    float* ColumnEdges;         // in pixels, Columns + 1 of them
+    float* RowEdges;
+    GLfloat* CellViewports;     // x, y, width and height, row by row
+    GLuint CellTexture;
+    int MaxViewports;
+    CullGrid* Cells;
+    CullBins* Bins;
+    GLuint CellObjectBuffer;
+    GLuint CellObjectTexture;
+    GLint* CellObjects;
+    int CellObjectCapacity;
 } Globals;
 
-typedef struct {
-    Point3 Position;
-    Vector2 TexCoord;
-} Vertex;
-
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
 static MeshPod CreateCylinder();
+static GLuint CreateIndexBuffer(const MeshIndices* indices);
 static GLuint CreateQuad();
-static MeshPod CreateGrid(int rows, int cols);
 static GLuint CreateRenderTarget(GLuint* colorTexture);
+static GLuint CreateCellTexture();
+static Matrix4 CellProjection(int row, int col, GLfloat* viewport);
+static void CreatePartition(int rows, int columns);
+static CullGrid* CreateCullGrid();
+static void BinInstances(int instanceCount, Matrix4* modelviews);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define offset(x) ((const GLvoid*)x)
 
 const int Slices = 24;
 const int Stacks = 8;
-const int GridRows = 20;
-const int GridCols = 36;
-Vector2 GridPoints[37][21];
+
+// Cells of the screen partition, which is fitted to the lens at startup.
+// With either lens, 13 x 23 fitted cells stray less from it than the 20 x
+// 36 cells of the old fixed u * |u| partition did.
+const int CellRows = 13;
+const int CellCols = 23;
+
+// Radius of the sphere around the cylinder, from its center to a rim.
+const float CylinderRadius = 0.70710678f;
+
+// The grid corrects for a barrel power of 2 unless this is set, in which
+// case it corrects for a calibrated Brown-Conrady lens.
+const bool CalibratedLens = false;
+
+// Draws as many cells at once as there are viewports, rather than one
+// draw per cell.  Each instance is an object in a cell, and the geometry
+// shader sends it to the cell's viewport.
+const bool ViewportArrays = true;
+
+// Halves the draws per cell.
+const bool SinglePassWireframe = true;
+
+// Lit.GS still runs for ViewportArrays, where the vertex shader can't pick
+// a viewport.
+const bool DerivativeNormals = true;
 
 PezConfig PezGetConfig()
 {
@@ -72,20 +111,9 @@ void PezInitialize()
     const PezConfig cfg = PezGetConfig();
 
     // Partition the screen
-    float ds = 1.0f / GridCols;
-    float dt = 1.0f / GridRows;
-    int i = 0;
-    for (float s = 0; s < 1 + ds / 2; s += ds, i++) {
-        int j = 0;
-        for (float t = 0; t < 1 + dt / 2; t += dt, j++) {
-            float u = s*2.0 - 1.0;
-            float v = t*2.0 - 1.0;
-            u = (u*u*copysign(1.0,u) + 1.0) / 2.0;
-            v = (v*v*copysign(1.0,v) + 1.0) / 2.0;
-            GridPoints[i][j].x = floor(u * cfg.Width);
-            GridPoints[i][j].y = floor(v * cfg.Height);
-        }
-    }
+    Globals.Lens = CalibratedLens ?
+        lensBrownConradyModel(-0.22f, 0.024f, 0, 0.0012f, -0.0008f) : lensPowerModel(2);
+    CreatePartition(CellRows, CellCols);
 
     // Assign the vertex attributes to integer slots:
     GLuint* pAttr = (GLuint*) &Attr;
@@ -94,10 +122,26 @@ void PezInitialize()
     }
 
     // Compile shaders
-    Globals.SimpleProgram = LoadProgram("Simple.VS", 0, "Simple.FS");
+    if (ViewportArrays) {
+        pezSwAddDirective("*", "#define VIEWPORT_ARRAY");
+    }
+    if (SinglePassWireframe) {
+        pezSwAddDirective("*", "#define WIREFRAME");
+    }
+    bool vertexViewports = ViewportArrays && DerivativeNormals &&
+        (pezExtension("GL_ARB_shader_viewport_layer_array") ||
+         pezExtension("GL_AMD_vertex_shader_viewport_index")) && !pezOption("gs");
+    if (vertexViewports) {
+        pezSwAddDirective("*", "#define VERTEX_VIEWPORT");
+    }
+    bool viewportGs = ViewportArrays && !vertexViewports;
+    bool litGs = !DerivativeNormals || viewportGs || pezOption("gs");
+    if (!litGs) {
+        pezSwAddDirective("*", "#define DERIVATIVE_NORMALS");
+    }
+    Globals.SimpleProgram = LoadProgram("Simple.VS", viewportGs ? "Simple.GS" : 0, "Simple.FS");
     Globals.QuadProgram = LoadProgram("Quad.VS", 0, "Quad.FS");
-    Globals.GridProgram = LoadProgram("Grid.VS", 0, "Grid.FS");
-    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.GS", "Lit.FS");
+    Globals.LitProgram = LoadProgram("Lit.VS", litGs ? "Lit.GS" : 0, "Lit.FS");
 
     // Set up viewport
     float fovy = 16 * TwoPi / 180;
@@ -113,10 +157,25 @@ void PezInitialize()
     Globals.FboHandle = CreateRenderTarget(&Globals.FboTexture);
     glUseProgram(Globals.QuadProgram);
     Globals.QuadVao = CreateQuad();
-    Globals.Grid = CreateGrid(GridRows, GridCols);
 
     // Create geometry
     Globals.Cylinder = CreateCylinder();
+    Globals.Cells = CreateCullGrid();
+    Globals.Bins = cullCreateBins();
+    pezCheck(Globals.Cells && Globals.Bins, "Unable to create the cell bins.");
+    if (ViewportArrays) {
+        glGetIntegerv(GL_MAX_VIEWPORTS, &Globals.MaxViewports);
+        Globals.CellTexture = CreateCellTexture();
+    }
+    glGenBuffers(1, &Globals.CellObjectBuffer);
+    glGenTextures(1, &Globals.CellObjectTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, Globals.CellObjectTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(Globals.SimpleProgram);
+    glUniform1i(u("CellObjects"), 1);
+    glUseProgram(Globals.LitProgram);
+    glUniform1i(u("CellObjects"), 1);
 
     // Misc Initialization
     Globals.Theta = 0;
@@ -127,6 +186,7 @@ void PezInitialize()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_PRIMITIVE_RESTART);
     glPolygonOffset(1,1);
 }
 
@@ -154,6 +214,7 @@ Matrix4 M4PickMatrix(GLfloat x, GLfloat y, GLfloat width, GLfloat height, GLint*
 }
 
 static void RenderCells(GLenum mode, int indexCount, int instanceCount, Matrix4* modelviews);
+static void RenderCellBatches(GLenum mode, int indexCount, int instanceCount, Matrix4* modelviews);
 
 void PezRender()
 {
@@ -195,6 +256,7 @@ void PezRender()
         Vector3 Eye =  M3MulV3(m, V3Normalize(EyePosition)); // object space
         Hhat[i] = V3Normalize(V3Add(Lhat[i], Eye));
     }
+    BinInstances(Instances, MV);
 
     MeshPod* mesh = &Globals.Cylinder;
 
@@ -207,44 +269,203 @@ void PezRender()
     glUniform4f(u("BackMaterial"), 0.5, 0.5, 0, 1);
     glUniform3fv(u("Hhat"), Instances, &Hhat[0].x);
     glUniform3fv(u("Lhat"), Instances, &Lhat[0].x);
+    glUniform2f(u("Lattice"), Slices, Stacks);
     glBindVertexArray(mesh->FillVao);
-    RenderCells(GL_TRIANGLES, mesh->FillIndexCount, Instances, MV);
+    glPrimitiveRestartIndex(mesh->RestartIndex);
+    if (ViewportArrays) {
+        RenderCellBatches(GL_TRIANGLES, mesh->FillIndexCount, Instances, MV);
+    } else {
+        RenderCells(GL_TRIANGLES, mesh->FillIndexCount, Instances, MV);
+    }
 
-    glUseProgram(Globals.SimpleProgram);
-    glUniform4f(u("Color"), 0, 0, 0, 1);
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(mesh->LineVao);
-    RenderCells(GL_LINES, mesh->LineIndexCount, Instances, MV);
+    if (!SinglePassWireframe) {
+        glUseProgram(Globals.SimpleProgram);
+        glUniform4f(u("Color"), 0, 0, 0, 1);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(mesh->LineVao);
+        if (ViewportArrays) {
+            RenderCellBatches(GL_LINE_STRIP, mesh->LineIndexCount, Instances, MV);
+        } else {
+            RenderCells(GL_LINE_STRIP, mesh->LineIndexCount, Instances, MV);
+        }
+
+        glDepthMask(GL_TRUE);
+    }
 
-    glDepthMask(GL_TRUE);
+    #undef Instances
 }
 
-static void RenderCells(GLenum mode, int indexCount, int instanceCount, Matrix4* MV)
+// The projection that fills a cell's viewport with its part of the
+// screen; viewport receives x, y, width and height.
+static Matrix4 CellProjection(int row, int col, GLfloat* viewport)
 {
     PezConfig cfg = PezGetConfig();
-    GLint viewport[] = {0, 0, cfg.Width, cfg.Height};
+    GLint screen[] = {0, 0, cfg.Width, cfg.Height};
+    Vector2 c0 = {Globals.ColumnEdges[col], Globals.RowEdges[row]};
+    Vector2 c1 = {Globals.ColumnEdges[col], Globals.RowEdges[row+1]};
+    Vector2 c2 = {Globals.ColumnEdges[col+1], Globals.RowEdges[row]};
+    float x = (c0.x + c2.x) * 0.5;
+    float y = (c0.y + c1.y) * 0.5;
+    float cellWidth = (c2.x - c1.x);
+    float cellHeight = (c1.y - c0.y);
+    Matrix4 pickmatrix = M4PickMatrix(x, y, cellWidth, cellHeight, screen);
+    viewport[0] = c0.x;
+    viewport[1] = c0.y;
+    viewport[2] = cellWidth;
+    viewport[3] = cellHeight;
+    return M4Mul(M4Transpose(pickmatrix), Globals.Projection);
+}
+
+// Finds the cells that each instance's bounding sphere reaches, and lists
+// them in CellObjects.
+static void BinInstances(int instanceCount, Matrix4* MV)
+{
+    CullSphere spheres[instanceCount];
+    for (int i = 0; i < instanceCount; i++) {
+        float scale = fmaxf(V3Length(V4GetXYZ(MV[i].col0)),
+                            fmaxf(V3Length(V4GetXYZ(MV[i].col1)), V3Length(V4GetXYZ(MV[i].col2))));
+        spheres[i] = (CullSphere){MV[i].col3.x, MV[i].col3.y, MV[i].col3.z, CylinderRadius * scale};
+    }
+    pezCheck(cullBin(Globals.Cells, spheres, instanceCount, Globals.Bins), "Unable to bin the cells.");
+
+    const CullBins* bins = Globals.Bins;
+    if (Globals.CellObjectCapacity < bins->Count) {
+        Globals.CellObjectCapacity = bins->Count;
+        Globals.CellObjects = (GLint*) realloc(Globals.CellObjects, sizeof(GLint) * bins->Count);
+        pezCheck(Globals.CellObjects != 0, "Unable to list the cells.");
+    }
+    for (int cell = 0; cell < bins->CellCount; cell++) {
+        for (int k = bins->Offsets[cell]; k < bins->Offsets[cell + 1]; k++) {
+            Globals.CellObjects[k] = cell * instanceCount + bins->Instances[k];
+        }
+    }
+
+    // Orphan last frame's list rather than wait for the draws reading it.
+    glBindBuffer(GL_TEXTURE_BUFFER, Globals.CellObjectBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(GLint) * (bins->Count ? bins->Count : 1), 0, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(GLint) * bins->Count, Globals.CellObjects);
+    glActiveTexture(GL_TEXTURE1);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, Globals.CellObjectBuffer);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Cells are smallest where the lens's magnification changes fastest, so
+// that each is about as far from the lens as the next, and their edges
+// fall on whole pixels.
+static void CreatePartition(int rows, int columns)
+{
+    PezConfig cfg = PezGetConfig();
+    Globals.Rows = rows;
+    Globals.Columns = columns;
+    Globals.ColumnEdges = (float*) malloc(sizeof(float) * (columns + 1));
+    Globals.RowEdges = (float*) malloc(sizeof(float) * (rows + 1));
+    Globals.CellViewports = (GLfloat*) malloc(sizeof(GLfloat) * 4 * rows * columns);
+    pezCheck(Globals.ColumnEdges && Globals.RowEdges && Globals.CellViewports, "Out of memory.");
+
+    int ok = meshLensEdges(&Globals.Lens, 0, columns, cfg.Width, cfg.Width, cfg.Height, Globals.ColumnEdges) &&
+             meshLensEdges(&Globals.Lens, 1, rows, cfg.Height, cfg.Width, cfg.Height, Globals.RowEdges);
+    pezCheck(ok, "Unable to partition the screen into %d x %d cells.", rows, columns);
+    for (int col = 0; col <= columns; col++) {
+        Globals.ColumnEdges[col] = floor((Globals.ColumnEdges[col] + 1) * cfg.Width / 2 + 0.5);
+    }
+    for (int row = 0; row <= rows; row++) {
+        Globals.RowEdges[row] = floor((Globals.RowEdges[row] + 1) * cfg.Height / 2 + 0.5);
+    }
+}
+
+// The cell frusta, from the same edges as CellProjection.
+static CullGrid* CreateCullGrid()
+{
+    PezConfig cfg = PezGetConfig();
+    float xEdges[Globals.Columns + 1], yEdges[Globals.Rows + 1];
+    for (int col = 0; col <= Globals.Columns; col++) {
+        xEdges[col] = Globals.ColumnEdges[col] * 2 / cfg.Width - 1;
+    }
+    for (int row = 0; row <= Globals.Rows; row++) {
+        yEdges[row] = Globals.RowEdges[row] * 2 / cfg.Height - 1;
+    }
+    return cullCreateGrid((float*) &Globals.Projection, xEdges, Globals.Columns, yEdges, Globals.Rows);
+}
+
+// One draw per cell that some instance reaches, of just the instances in
+// its bin, looked up in CellObjects as the batches do.
+static void RenderCells(GLenum mode, int indexCount, int instanceCount, Matrix4* MV)
+{
+    const int* offsets = Globals.Bins->Offsets;
     Matrix4 MVP[instanceCount];
-    for (int row = 0; row < GridRows; row++) {
-        for (int col = 0; col < GridCols; col++) {
-            Vector2 c0 = GridPoints[col][row];
-            Vector2 c1 = GridPoints[col][row+1];
-            Vector2 c2 = GridPoints[col+1][row];
-            float x = (c0.x + c2.x) * 0.5;
-            float y = (c0.y + c1.y) * 0.5;
-            float cellWidth = (c2.x - c1.x);
-            float cellHeight = (c1.y - c0.y);
-            Matrix4 pickmatrix = M4PickMatrix(x, y, cellWidth, cellHeight, viewport);
-            glViewport(c0.x, c0.y, cellWidth, cellHeight);
+    glUniform1i(u("Objects"), instanceCount);
+    for (int row = 0; row < Globals.Rows; row++) {
+        for (int col = 0; col < Globals.Columns; col++) {
+            int cell = row * Globals.Columns + col;
+            if (offsets[cell] == offsets[cell + 1]) {
+                continue;
+            }
+            GLfloat viewport[4];
+            Matrix4 projection = CellProjection(row, col, viewport);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
             for (int i = 0; i < instanceCount; i++) {
-                Matrix4 projection = M4Mul(M4Transpose(pickmatrix),Globals.Projection);
                 MVP[i] = M4Mul(projection, MV[i]);
             }
-            glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
-            glDrawElementsInstanced(mode, indexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
+            glUniformMatrix4fv(u("ModelviewProjection"), instanceCount, 0, (float*) &MVP[0]);
+            glUniform1i(u("FirstCellObject"), offsets[cell]);
+            glDrawElementsInstanced(mode, indexCount, Globals.Cylinder.IndexType, 0,
+                                    offsets[cell + 1] - offsets[cell]);
+        }
+    }
+}
+
+// A few calls per batch of cells instead of three per cell.  The cell
+// projections never change, so they live in a buffer texture; only the
+// modelviews are sent each frame.  Batches start at the next cell that
+// some instance reaches, and draw just the objects in their cells.
+static void RenderCellBatches(GLenum mode, int indexCount, int instanceCount, Matrix4* MV)
+{
+    const int cellCount = Globals.Rows * Globals.Columns;
+    const int* offsets = Globals.Bins->Offsets;
+    glUniformMatrix4fv(u("Modelview"), instanceCount, 0, (float*) &MV[0]);
+    glUniform1i(u("Objects"), instanceCount);
+    for (int first = 0; first < cellCount; ) {
+        if (offsets[first] == offsets[first + 1]) {
+            first++;
+            continue;
         }
+        int count = cellCount - first < Globals.MaxViewports ? cellCount - first : Globals.MaxViewports;
+        glViewportArrayv(0, count, Globals.CellViewports + 4 * first);
+        glUniform1i(u("FirstCell"), first);
+        glUniform1i(u("FirstCellObject"), offsets[first]);
+        glDrawElementsInstanced(mode, indexCount, Globals.Cylinder.IndexType, 0,
+                                offsets[first + count] - offsets[first]);
+        first += count;
     }
 }
 
+// Cell projections as four RGBA32F texels each, row by row, and their
+// viewports in Globals.CellViewports.
+static GLuint CreateCellTexture()
+{
+    const int cellCount = Globals.Rows * Globals.Columns;
+    Matrix4* projections = (Matrix4*) malloc(sizeof(Matrix4) * cellCount);
+    for (int row = 0; row < Globals.Rows; row++) {
+        for (int col = 0; col < Globals.Columns; col++) {
+            int cell = row * Globals.Columns + col;
+            projections[cell] = CellProjection(row, col, Globals.CellViewports + 4 * cell);
+        }
+    }
+
+    GLuint buffer, texture;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(Matrix4) * cellCount, projections, GL_STATIC_DRAW);
+    free(projections);
+
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create the cell texture.");
+    return texture;
+}
+
 void PezHandleMouse(int x, int y, int action)
 {
 }
@@ -313,20 +534,30 @@ static Point3 EvaluateCylinder(float s, float t)
     return range;
 }
 
+static GLuint CreateIndexBuffer(const MeshIndices* indices)
+{
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->Size * indices->Count, indices->Data, GL_STATIC_DRAW);
+    return vbo;
+}
+
 static MeshPod CreateCylinder()
 {
     const int VertexCount = (Slices+1) * (Stacks+1);
-    const int FillIndexCount = (Slices+1) * Stacks * 6;
 
-    const int circles = (Stacks+1)*Slices;
-    const int longitudinal = Stacks*Slices;
-    const int LineIndexCount = 2 * (circles + longitudinal);
- 
+    // Stacks are the lattice's columns and slices its rows.
+    MeshIndices* triangles = meshLatticeTriangles(Slices, Stacks);
+    MeshIndices* lines = meshLatticeLines(Slices, Stacks);
+    pezCheck(triangles && lines, "Unable to build cylinder indices.");
+
     // Create a buffer with positions
     GLuint positionsVbo;
     if (1) {
-        Point3 verts[VertexCount];
-        Point3* pVert = &verts[0];
+        Point3* verts = (Point3*) malloc(sizeof(Point3) * VertexCount);
+        pezCheck(verts != 0, "Unable to allocate cylinder vertices.");
+        Point3* pVert = verts;
         float ds = 1.0f / Stacks;
         float dt = 1.0f / Slices;
 
@@ -340,85 +571,25 @@ static MeshPod CreateCylinder()
 
         pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Point3) * VertexCount;
         const GLvoid* data = &verts[0].x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            int vps = Slices+1; // vertices per stack
-            for (GLushort i = 0; i < vps; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1) % vps;
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) % vps + vps);
-                *pIndex++ = (n + (i + 1) % vps);
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-
-        GLushort inds[LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Circles:
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks+1; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += Slices + 1;
-        }
-
-        // Longitudinal:
-        n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (Slices + 1);
-            }
-            n += Slices + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
     MeshPod mesh;
     mesh.VertexCount = VertexCount;
-    mesh.FillIndexCount = FillIndexCount;
-    mesh.LineIndexCount = LineIndexCount;
+    mesh.FillIndexCount = triangles->Count;
+    mesh.LineIndexCount = lines->Count;
+    mesh.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
 
     glGenVertexArrays(1, &mesh.FillVao);
     glBindVertexArray(mesh.FillVao);
@@ -467,146 +638,6 @@ static GLuint CreateRenderTarget(GLuint* colorTexture)
     return fboHandle;
 }
 
-static MeshPod CreateGrid(int rows, int columns)
-{
-    MeshPod grid;
-    grid.VertexCount = (columns+1) * (rows+1);
-    grid.FillIndexCount = 6 * columns * rows;
-    int horizontalLines = rows * (columns + 1);
-    int verticalLines = columns * (rows + 1);
-    grid.LineIndexCount = 2 * (horizontalLines + verticalLines);
-
-    // Create a buffer with interleaved positions and texture coordinates
-    GLuint positionsVbo;
-    if (1) {
-        Vertex verts[grid.VertexCount];
-        Vertex* pVert = &verts[0];
-        float ds = 1.0f / columns;
-        float dt = 1.0f / rows;
-
-        // The upper bounds in these loops are tweaked to reduce the
-        // chance of precision error causing an incorrect # of iterations.
-        for (float s = 0; s < 1 + ds / 2; s += ds) {
-            for (float t = 0; t < 1 + dt / 2; t += dt) {
-
-                float u = s*2.0 - 1.0;
-                float v = t*2.0 - 1.0;
-                u = (u*u*copysign(1.0,u) + 1.0) / 2.0;
-                v = (v*v*copysign(1.0,v) + 1.0) / 2.0;
-                
-                float x = u*2-1;
-                float y = v*2-1;
-
-                float theta  = atan2(y,x);
-                float radius = sqrt(x*x+y*y);
-                radius = sqrt(radius);
-                x = radius * cos(theta);
-                y = radius * sin(theta);
-                pVert->Position = (Point3){x, y, 0};
-                pVert->TexCoord.x = u;
-                pVert->TexCoord.y = v;
-                ++pVert;
-            }
-        }
-
-        pezCheck(pVert - &verts[0] == grid.VertexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(verts);
-        const GLvoid* data = &verts[0].Position.x;
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &positionsVbo);
-        glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
-        glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[grid.FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < columns; j++) {
-            int vps = rows+1; // vertices per row
-            for (GLushort i = 0; i < rows; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1);
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) + vps);
-                *pIndex++ = (n + (i + 1));
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == grid.FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-        GLushort inds[grid.LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Horizontal:
-        GLushort n = 0;
-        for (GLushort j = 0; j < columns+1; j++) {
-            for (GLushort i = 0; i < rows; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += rows + 1;
-        }
-
-        // Vertical:
-        n = 0;
-        for (GLushort j = 0; j < columns; j++) {
-            for (GLushort i = 0; i < rows+1; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (rows + 1);
-            }
-            n += rows + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == grid.LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-    
-    glGenVertexArrays(1, &grid.FillVao);
-    glBindVertexArray(grid.FillVao);
-    glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-    glVertexAttribPointer(Attr.Position, 3, GL_FLOAT, GL_FALSE, 20, 0);
-    glEnableVertexAttribArray(Attr.Position);
-    glVertexAttribPointer(Attr.TexCoord, 2, GL_FLOAT, GL_FALSE, 20, offset(12));
-    glEnableVertexAttribArray(Attr.TexCoord);
-
-    glGenVertexArrays(1, &grid.LineVao);
-    glBindVertexArray(grid.LineVao);
-    glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-    glVertexAttribPointer(Attr.Position, 3, GL_FLOAT, GL_FALSE, 20, 0);
-    glEnableVertexAttribArray(Attr.Position);
-    glDisableVertexAttribArray(Attr.TexCoord);
-
-    glBindVertexArray(0);
-
-    return grid;
-}
-
 static GLuint CreateQuad()
 {
     const PezConfig cfg = PezGetConfig();
@@ -1,21 +1,3 @@
--- Grid.VS
-
-layout(location = 0) in vec3 Position;
-
-void main()
-{
-    gl_Position = vec4(Position, 1);
-}
-
--- Grid.FS
-
-out vec4 FragColor;
-
-void main()
-{
-    FragColor = vec4(0,0,0.5,0.25);
-}
-
 -- Quad.VS
 
 layout(location = 0) in vec3 Position;
@@ -41,12 +23,76 @@ void main()
 
 -- Simple.VS
 
+#ifdef VERTEX_VIEWPORT
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+#endif
+
 layout(location = 0) in vec4 Position;
+
+// Each instance is one object in one cell, listed as cell * Objects +
+// object in CellObjects.  The list is rebuilt every frame from the cells
+// that each object's bounding sphere reaches.
+uniform isamplerBuffer CellObjects;
+uniform int Objects;
+uniform int FirstCellObject;
+
+#ifdef VIEWPORT_ARRAY
+// The cells' pick projections are four columns apiece in a buffer texture
+// that is filled at startup.  The cell's viewport is set here where vertex
+// shaders may, and otherwise passed on for Simple.GS and Lit.GS to set.
+uniform samplerBuffer CellProjections;
+uniform mat4 Modelview[7];
+uniform int FirstCell;
+#ifndef VERTEX_VIEWPORT
+out int vViewport;
+#endif
+
+mat4 CellProjection(int cell)
+{
+    return mat4(texelFetch(CellProjections, 4 * cell),
+                texelFetch(CellProjections, 4 * cell + 1),
+                texelFetch(CellProjections, 4 * cell + 2),
+                texelFetch(CellProjections, 4 * cell + 3));
+}
+
+void main()
+{
+    int cellObject = texelFetch(CellObjects, FirstCellObject + gl_InstanceID).r;
+    int cell = cellObject / Objects;
+    int object = cellObject % Objects;
+#ifdef VERTEX_VIEWPORT
+    gl_ViewportIndex = cell - FirstCell;
+#else
+    vViewport = cell - FirstCell;
+#endif
+    gl_Position = CellProjection(cell) * (Modelview[object] * Position);
+}
+#else
+// One cell per draw, whose projection is already in ModelviewProjection.
 uniform mat4 ModelviewProjection[7];
 
 void main()
 {
-    gl_Position = ModelviewProjection[gl_InstanceID] * Position;
+    int object = texelFetch(CellObjects, FirstCellObject + gl_InstanceID).r % Objects;
+    gl_Position = ModelviewProjection[object] * Position;
+}
+#endif
+
+-- Simple.GS
+
+layout(lines) in;
+layout(line_strip, max_vertices = 2) out;
+in int vViewport[2];
+
+void main()
+{
+    for (int j = 0; j < 2; j++) {
+        gl_ViewportIndex = vViewport[0];
+        gl_Position = gl_in[j].gl_Position;
+        EmitVertex();
+    }
+    EndPrimitive();
 }
 
 
@@ -61,17 +107,65 @@ void main()
 
 -- Lit.VS
 
+#ifdef VERTEX_VIEWPORT
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+#endif
+
 layout(location = 0) in vec4 Position;
 out vec3 vPosition;
+#ifdef DERIVATIVE_NORMALS
+flat out int vInstanceID;
+#else
 out int vInstanceID;
+#endif
+
+// Same routing as Simple.VS.
+uniform isamplerBuffer CellObjects;
+uniform int Objects;
+uniform int FirstCellObject;
+
+#ifdef VIEWPORT_ARRAY
+uniform samplerBuffer CellProjections;
+uniform mat4 Modelview[7];
+uniform int FirstCell;
+#ifndef VERTEX_VIEWPORT
+out int vViewport;
+#endif
+
+mat4 CellProjection(int cell)
+{
+    return mat4(texelFetch(CellProjections, 4 * cell),
+                texelFetch(CellProjections, 4 * cell + 1),
+                texelFetch(CellProjections, 4 * cell + 2),
+                texelFetch(CellProjections, 4 * cell + 3));
+}
+
+void main()
+{
+    int cellObject = texelFetch(CellObjects, FirstCellObject + gl_InstanceID).r;
+    int cell = cellObject / Objects;
+    int object = cellObject % Objects;
+    vInstanceID = object;
+#ifdef VERTEX_VIEWPORT
+    gl_ViewportIndex = cell - FirstCell;
+#else
+    vViewport = cell - FirstCell;
+#endif
+    vPosition = Position.xyz;
+    gl_Position = CellProjection(cell) * (Modelview[object] * Position);
+}
+#else
 uniform mat4 ModelviewProjection[7];
 
 void main()
 {
-    vInstanceID = gl_InstanceID;
+    int object = texelFetch(CellObjects, FirstCellObject + gl_InstanceID).r % Objects;
+    vInstanceID = object;
     vPosition = Position.xyz;
-    gl_Position = ModelviewProjection[gl_InstanceID] * Position;
+    gl_Position = ModelviewProjection[object] * Position;
 }
+#endif
 
 
 -- Lit.GS
@@ -81,9 +175,13 @@ layout(triangle_strip, max_vertices = 3) out;
 in vec3 vPosition[3];
 out vec3 gNormal;
 in int vInstanceID[3];
-out float gDistance[4];
+out vec3 gPosition;
 flat out int gInstanceID;
 
+#ifdef VIEWPORT_ARRAY
+in int vViewport[3];
+#endif
+
 void main()
 {
     gInstanceID = vInstanceID[0];
@@ -92,6 +190,10 @@ void main()
     gNormal = normalize(cross(A, B));
 
     for (int j = 0; j < 3; j++) {
+        gPosition = vPosition[j];
+#ifdef VIEWPORT_ARRAY
+        gl_ViewportIndex = vViewport[0];
+#endif
         gl_Position = gl_in[j].gl_Position;
         EmitVertex();
     }
@@ -100,8 +202,14 @@ void main()
 
 -- Lit.FS
 
+#ifdef DERIVATIVE_NORMALS
+in vec3 vPosition;
+flat in int vInstanceID;
+#else
+in vec3 gPosition;
 in vec3 gNormal;
 flat in int gInstanceID;
+#endif
 out vec4 FragColor;
 uniform vec3 AmbientMaterial = vec3(0.2, 0.2, 0.2);
 uniform vec3 SpecularMaterial = vec3(0.5, 0.5, 0.5);
@@ -111,14 +219,41 @@ uniform float Shininess = 7;
 uniform vec3 Hhat[7];
 uniform vec3 Lhat[7];
 
+#ifdef WIREFRAME
+// The lit-pass wireframe; see OriginalScene.glsl.
+uniform vec2 Lattice;
+uniform vec4 LineColor = vec4(0, 0, 0, 1);
+uniform float LineWidth = 1.5;
+
+float Wire(vec3 p)
+{
+    vec2 cell = vec2(atan(p.z, p.x) / 6.28318531, p.y + 0.5) * Lattice;
+    vec3 dx = dFdx(p), dy = dFdy(p);
+    float da = (abs(p.x * dx.z - p.z * dx.x) + abs(p.x * dy.z - p.z * dy.x)) / dot(p.xz, p.xz);
+    vec2 pitch = vec2(da / 6.28318531, abs(dx.y) + abs(dy.y)) * Lattice;
+    vec2 d = abs(fract(cell + 0.5) - 0.5) / max(pitch, vec2(1e-6));
+    return clamp(0.5 * LineWidth + 0.5 - min(d.x, d.y), 0.0, 1.0);
+}
+#endif
+
 void main()
 {
+#ifdef DERIVATIVE_NORMALS
+    // The position's screen-space derivatives lie in the face, and their
+    // cross product points back at the viewer on either side of it.
+    vec3 position = vPosition;
+    vec3 N = normalize(cross(dFdx(position), dFdy(position)));
+    int instance = vInstanceID;
+#else
+    vec3 position = gPosition;
     vec3 N = -normalize(gNormal);
     if (!gl_FrontFacing)
        N = -N;
+    int instance = gInstanceID;
+#endif
 
-    float df = max(0.0, dot(N, Lhat[gInstanceID]));
-    float sf = max(0.0, dot(N, Hhat[gInstanceID]));
+    float df = max(0.0, dot(N, Lhat[instance]));
+    float sf = max(0.0, dot(N, Hhat[instance]));
     sf = pow(sf, Shininess);
 
     vec3 diffuse = gl_FrontFacing ? FrontMaterial.rgb : BackMaterial.rgb;
@@ -127,4 +262,7 @@ void main()
         lighting += sf * SpecularMaterial;
 
     FragColor = vec4(lighting, FrontMaterial.a);
+#ifdef WIREFRAME
+    FragColor = mix(FragColor, LineColor, Wire(position));
+#endif
 }
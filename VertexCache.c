@@ -0,0 +1,132 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+// Post-transform cache report for the meshes the demos generate.  Each
+// mesh is drawn through a simulated FIFO cache in its original column by
+// column order, as strips where it has them, and after meshOptimizeTriangles.
+// ACMR is the number of vertices transformed per triangle, and ATVR per
+// distinct vertex; 1 is the best ATVR possible.  With every vertex running
+// Distort(), as in VertexWarping, ATVR is the factor that lens work is
+// multiplied by.
+//
+// Usage: VertexCache [-c cacheSize]
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "mesh.h"
+
+typedef struct LatticeRec {
+    const char* Name;
+    int Rows;
+    int Columns;
+} Lattice;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Report(const char* name, const char* order, const MeshIndices* indices,
+                   int triangleCount, int vertexCount, int cacheSize, double seconds)
+{
+    int misses = meshCacheMisses(indices, cacheSize);
+    printf("%-20s  %-9s  %8d  %8d  %7.3f  %6.3f", name, order, triangleCount, indices->Count,
+           (double) misses / triangleCount, (double) misses / vertexCount);
+    if (seconds > 0) {
+        printf("  %8.2f", seconds * 1e3);
+    }
+    printf("\n");
+}
+
+// The triangle list as it was generated, and after optimization.
+static int ReportList(const char* name, MeshIndices* triangles, int vertexCount, int cacheSize)
+{
+    unsigned int* remap = (unsigned int*) malloc(sizeof(unsigned int) * vertexCount);
+    if (!remap) {
+        return 0;
+    }
+    Report(name, "original", triangles, triangles->Count / 3, vertexCount, cacheSize, 0);
+    double start = Now();
+    int ok = meshOptimizeTriangles(triangles, vertexCount, cacheSize, remap);
+    double seconds = Now() - start;
+    if (ok) {
+        Report(name, "tipsify", triangles, triangles->Count / 3, vertexCount, cacheSize, seconds);
+    }
+    free(remap);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    int cacheSize = 16;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            cacheSize = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-c cacheSize]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (cacheSize < 3) {
+        fprintf(stderr, "The cache must hold a triangle\n");
+        return 1;
+    }
+
+    // Grids as rows by columns, cylinders as slices by stacks.
+    const Lattice lattices[] = {
+        {"grid 20x36", 20, 36},
+        {"grid 80x144", 80, 144},
+        {"cylinder 24x8", 24, 8},
+        {"cylinder 96x32", 96, 32},
+        {"cylinder 512x256", 512, 256},
+    };
+    const int latticeCount = sizeof(lattices) / sizeof(lattices[0]);
+
+    printf("FIFO cache of %d vertices\n\n", cacheSize);
+    printf("mesh                  order      triangles   indices     ACMR    ATVR  optimize ms\n");
+
+    for (int m = 0; m < latticeCount; m++) {
+        const Lattice* lattice = lattices + m;
+        int vertexCount = (lattice->Rows + 1) * (lattice->Columns + 1);
+        int triangleCount = 2 * lattice->Rows * lattice->Columns;
+        MeshIndices* strips = meshLatticeStrips(lattice->Rows, lattice->Columns);
+        MeshIndices* triangles = meshLatticeTriangles(lattice->Rows, lattice->Columns);
+        if (!strips || !triangles) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        Report(lattice->Name, "strips", strips, triangleCount, vertexCount, cacheSize, 0);
+        if (!ReportList(lattice->Name, triangles, vertexCount, cacheSize)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        meshDestroyIndices(strips);
+        meshDestroyIndices(triangles);
+    }
+
+    // The adaptive grid's fans are a list only.
+    LensModel lens = lensPowerModel(2);
+    MeshGrid* adaptive = meshCreateAdaptive(&lens, 0.25f, 0, 8, 1280, 720);
+    MeshIndices* triangles = adaptive ? meshCreateIndices(adaptive->VertexCount, 3 * adaptive->TriangleCount) : 0;
+    if (!triangles) {
+        fprintf(stderr, "Unable to build the adaptive grid\n");
+        return 1;
+    }
+    for (int i = 0; i < 3 * adaptive->TriangleCount; i++) {
+        meshPushIndex(triangles, adaptive->Indices[i]);
+    }
+    if (!ReportList("adaptive 0.25px", triangles, adaptive->VertexCount, cacheSize)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    meshDestroyIndices(triangles);
+    meshDestroy(adaptive);
+    return 0;
+}
@@ -3,9 +3,12 @@
 // http://creativecommons.org/licenses/by/3.0/
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "pez.h"
 #include "vmath.h"
+#include "lens.h"
+#include "mesh.h"
 
 typedef struct {
     int VertexCount;
@@ -13,16 +16,21 @@ typedef struct {
     int FillIndexCount;
     GLuint LineVao;
     GLuint FillVao;
+    GLenum IndexType;
+    GLuint RestartIndex;
 } MeshPod;
 
 struct {
     float Theta;
     GLuint LitProgram;
     GLuint SimpleProgram;
-    MeshPod Cylinder;
+    GLuint WarpProgram;
+    GLuint WarpBuffer;
+    GLuint WarpTexture;
+    MeshPod* Cylinders;
     Matrix4 Projection;
     Matrix4 View;
-    float Power;
+    LensModel Lens;
 } Globals;
 
 typedef struct {
@@ -31,7 +39,12 @@ typedef struct {
 
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
-static MeshPod CreateCylinder();
+static MeshPod CreateCylinder(int slices, int stacks);
+static int ChooseLod(Matrix4 model, Matrix4 mvp);
+static GLuint CreateIndexBuffer(const MeshIndices* indices);
+static void SetLensUniforms(const LensModel* lens);
+static void CreateWarpBuffer(int vertexCount);
+static void SetLodUniforms(int lod, int first, int warpBase);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define a(x) glGetAttribLocation(CurrentProgram(), x)
@@ -39,6 +52,31 @@ static MeshPod CreateCylinder();
 
 const int Slices = 24;
 const int Stacks = 8;
+const int VertexCacheSize = 16;
+const bool FastDistort = true;
+
+// Each coarser cylinder halves the slices and stacks of the one before.
+// Instances get the coarsest one whose rim strays no more than LodError
+// pixels from a true circle, once the lens has scaled it on screen, and
+// whose stacks stray no more than that from the curve the lens bends the
+// straight sides into.
+const int LodCount = 3;
+const float LodError = 0.75f;
+
+// Replaces the animated power curve with a calibrated Brown-Conrady lens.
+// Only the terms it uses are compiled into the shaders.
+const bool CalibratedLens = false;
+
+// Distorts each instance's vertices once per frame into a transform
+// feedback buffer, which the fill and line passes then fetch from
+// instead of running Distort() themselves.  With SinglePassWireframe
+// there is no line pass to share the work with, so this is off.
+const bool CaptureWarp = false;
+
+// Saves distorting every vertex a second time for the lines.
+const bool SinglePassWireframe = true;
+
+const bool DerivativeNormals = true;
 
 PezConfig PezGetConfig()
 {
@@ -56,8 +94,25 @@ void PezInitialize()
     const PezConfig cfg = PezGetConfig();
 
     // Compile shaders
+    Globals.Lens = CalibratedLens ?
+        lensBrownConradyModel(0.22f, 0.024f, 0, 0.0012f, -0.0008f) : lensPowerModel(1);
+    pezSwAddDirective("*", lensShaderDefine(&Globals.Lens));
+    if (FastDistort) {
+        pezSwAddDirective("*", "#define FAST_DISTORT");
+    }
+    if (SinglePassWireframe) {
+        pezSwAddDirective("*", "#define WIREFRAME");
+    }
+    bool litGs = !DerivativeNormals || pezOption("gs");
+    if (!litGs) {
+        pezSwAddDirective("*", "#define DERIVATIVE_NORMALS");
+    }
+    if (CaptureWarp) {
+        pezSwAddDirective("*", "#define CAPTURE_WARP");
+        Globals.WarpProgram = LoadProgram("Warp.VS", 0, 0);
+    }
     Globals.SimpleProgram = LoadProgram("Simple.VS", 0, "Simple.FS");
-    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.GS", "Lit.FS");
+    Globals.LitProgram = LoadProgram("Lit.VS", litGs ? "Lit.GS" : 0, "Lit.FS");
 
     // Set up viewport
     float fovy = 16 * TwoPi / 180;
@@ -70,7 +125,14 @@ void PezInitialize()
     Globals.View = M4MakeLookAt(eye, target, up);
 
     // Create geometry
-    Globals.Cylinder = CreateCylinder();
+    Globals.Cylinders = (MeshPod*) malloc(sizeof(MeshPod) * LodCount);
+    pezCheck(Globals.Cylinders != 0, "Unable to allocate the cylinder LODs.");
+    for (int lod = 0; lod < LodCount; lod++) {
+        Globals.Cylinders[lod] = CreateCylinder(Slices >> lod, Stacks >> lod);
+    }
+    if (CaptureWarp) {
+        CreateWarpBuffer(Globals.Cylinders[0].VertexCount);
+    }
 
     // Misc Initialization
     Globals.Theta = 0;
@@ -82,6 +144,7 @@ void PezInitialize()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_PRIMITIVE_RESTART);
     glPolygonOffset(1,1);
 }
 
@@ -90,7 +153,7 @@ void PezUpdate(float seconds)
     const float RadiansPerSecond = 0.5f;
     Globals.Theta += seconds * RadiansPerSecond;
     //Globals.Theta = Pi / 4;
-    Globals.Power = 1.0 - 0.25 * (sin(Globals.Theta * 4.0f) + 1.0);
+    Globals.Lens.Power = 1.0 - 0.25 * (sin(Globals.Theta * 4.0f) + 1.0);
 }
 
 void PezRender()
@@ -135,8 +198,52 @@ void PezRender()
         Hhat[i] = V3Normalize(V3Add(Lhat[i], Eye));
     }
 
-    int instanceCount = Instances;
-    MeshPod* mesh = &Globals.Cylinder;
+    // Group the instances by level of detail; each group is one instanced
+    // draw that looks its instances up in Objects.
+    int lods[Instances];
+    for (int i = 0; i < Instances; i++) {
+        lods[i] = ChooseLod(Model[i], MVP[i]);
+    }
+    int objects[Instances];
+    int first[LodCount + 1];
+    int warpBase[LodCount];
+    int count = 0, warped = 0;
+    for (int lod = 0; lod < LodCount; lod++) {
+        first[lod] = count;
+        for (int i = 0; i < Instances; i++) {
+            if (lods[i] == lod) {
+                objects[count++] = i;
+            }
+        }
+        warpBase[lod] = warped;
+        warped += (count - first[lod]) * Globals.Cylinders[lod].VertexCount;
+    }
+    first[LodCount] = count;
+
+    if (CaptureWarp) {
+        glUseProgram(Globals.WarpProgram);
+        SetLensUniforms(&Globals.Lens);
+        glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+        glUniform1iv(u("Objects"), Instances, objects);
+
+        // Each vertex is captured once per instance.  The groups follow
+        // each other in the buffer, starting at warpBase.
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, Globals.WarpBuffer);
+        glBeginTransformFeedback(GL_POINTS);
+        for (int lod = 0; lod < LodCount; lod++) {
+            int instanceCount = first[lod + 1] - first[lod];
+            if (instanceCount) {
+                MeshPod* mesh = &Globals.Cylinders[lod];
+                glUniform1i(u("First"), first[lod]);
+                glBindVertexArray(mesh->FillVao);
+                glDrawArraysInstanced(GL_POINTS, 0, mesh->VertexCount, instanceCount);
+            }
+        }
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+    }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   
@@ -146,25 +253,119 @@ void PezRender()
     glUniform4f(u("BackMaterial"), 0.5, 0.5, 0, 1);
     glUniform3fv(u("Hhat"), Instances, &Hhat[0].x);
     glUniform3fv(u("Lhat"), Instances, &Lhat[0].x);
-    glUniform1f(u("Power"), Globals.Power);
+    SetLensUniforms(&Globals.Lens);
     glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+    glUniform1iv(u("Objects"), Instances, objects);
+
+    for (int lod = 0; lod < LodCount; lod++) {
+        int instanceCount = first[lod + 1] - first[lod];
+        if (instanceCount) {
+            MeshPod* mesh = &Globals.Cylinders[lod];
+            SetLodUniforms(lod, first[lod], warpBase[lod]);
+            glBindVertexArray(mesh->FillVao);
+            glPrimitiveRestartIndex(mesh->RestartIndex);
+            glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, mesh->IndexType, 0, instanceCount);
+        }
+    }
+
+    if (!SinglePassWireframe) {
+        glUseProgram(Globals.SimpleProgram);
+        glUniform4f(u("Color"), 0, 0, 0, 1);
+        SetLensUniforms(&Globals.Lens);
+        glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+        glUniform1iv(u("Objects"), Instances, objects);
+
+        glDepthMask(GL_FALSE);
+        for (int lod = 0; lod < LodCount; lod++) {
+            int instanceCount = first[lod + 1] - first[lod];
+            if (instanceCount) {
+                MeshPod* mesh = &Globals.Cylinders[lod];
+                SetLodUniforms(lod, first[lod], warpBase[lod]);
+                glBindVertexArray(mesh->LineVao);
+                glPrimitiveRestartIndex(mesh->RestartIndex);
+                glDrawElementsInstanced(GL_LINE_STRIP, mesh->LineIndexCount, mesh->IndexType, 0, instanceCount);
+            }
+        }
+        glDepthMask(GL_TRUE);
+    }
+}
+
+void PezHandleMouse(int x, int y, int action)
+{
+}
 
-    glBindVertexArray(mesh->FillVao);
-    glDrawElementsInstanced(GL_TRIANGLES, mesh->FillIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
+static void SetLensUniforms(const LensModel* lens)
+{
+    glUniform1f(u("Lens.Power"), lens->Power);
+    glUniform3f(u("Lens.K"), lens->K1, lens->K2, lens->K3);
+    glUniform2f(u("Lens.P"), lens->P1, lens->P2);
+}
+
+static void CreateWarpBuffer(int vertexCount)
+{
+    glGenBuffers(1, &Globals.WarpBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, Globals.WarpBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(Vector4) * vertexCount * Instances, 0, GL_DYNAMIC_COPY);
+
+    glGenTextures(1, &Globals.WarpTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, Globals.WarpTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, Globals.WarpBuffer);
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create the warp buffer.");
 
     glUseProgram(Globals.SimpleProgram);
-    glUniform4f(u("Color"), 0, 0, 0, 1);
-    glUniform1f(u("Power"), Globals.Power);
-    glUniformMatrix4fv(u("ModelviewProjection"), Instances, 0, (float*) &MVP[0]);
+    glUniform1i(u("Warped"), 0);
+    glUseProgram(Globals.LitProgram);
+    glUniform1i(u("Warped"), 0);
+}
 
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(mesh->LineVao);
-    glDrawElementsInstanced(GL_LINES, mesh->LineIndexCount, GL_UNSIGNED_SHORT, 0, instanceCount);
-    glDepthMask(GL_TRUE);
+static void SetLodUniforms(int lod, int first, int warpBase)
+{
+    glUniform1i(u("First"), first);
+    glUniform1i(u("VertexCount"), Globals.Cylinders[lod].VertexCount);
+    glUniform1i(u("WarpBase"), warpBase);
+    glUniform2f(u("Lattice"), Slices >> lod, Stacks >> lod);
 }
 
-void PezHandleMouse(int x, int y, int action)
+static int ChooseLod(Matrix4 model, Matrix4 mvp)
 {
+    // The rim's radius on screen, in pixels, at the cylinder's center.
+    Vector4 center = mvp.col3;
+    if (center.w <= 0) {
+        return 0;
+    }
+    float scale = fmaxf(V3Length(V4GetXYZ(model.col0)),
+                        fmaxf(V3Length(V4GetXYZ(model.col1)), V3Length(V4GetXYZ(model.col2))));
+    float radius = 0.5f * scale * Globals.Projection.col1.y / center.w;
+    radius *= 0.5f * PezGetConfig().Height;
+    radius *= lensMagnification(&Globals.Lens, center.x / center.w, center.y / center.w);
+
+    // The axis is straight until the lens bends it.  How far the middle of
+    // the warped axis strays from the chord between its ends, in pixels;
+    // a stack spans 1 / stacks of it and so strays 1 / stacks^2 as far.
+    float sag = 0;
+    Vector4 top = V4Add(center, V4ScalarMul(mvp.col1, 0.5f));
+    Vector4 bottom = V4Sub(center, V4ScalarMul(mvp.col1, 0.5f));
+    if (top.w > 0 && bottom.w > 0) {
+        float xy[] = {top.x / top.w, top.y / top.w, bottom.x / bottom.w, bottom.y / bottom.w,
+                      center.x / center.w, center.y / center.w};
+        lensDistort(&Globals.Lens, xy, 3);
+        const PezConfig cfg = PezGetConfig();
+        float dx = 0.25f * cfg.Width * (xy[0] + xy[2] - 2 * xy[4]);
+        float dy = 0.25f * cfg.Height * (xy[1] + xy[3] - 2 * xy[5]);
+        sag = sqrtf(dx * dx + dy * dy);
+    }
+
+    int lod = 0;
+    while (lod + 1 < LodCount) {
+        int slices = Slices >> (lod + 1), stacks = Stacks >> (lod + 1);
+        float rim = radius * (1 - cosf(Pi / slices));
+        if (fmaxf(rim, sag / (stacks * stacks)) > LodError) {
+            break;
+        }
+        lod++;
+    }
+    return lod;
 }
 
 static GLuint CurrentProgram()
@@ -174,6 +375,21 @@ static GLuint CurrentProgram()
     return p;
 }
 
+// Puts the Distort section between a vertex stage's directives and its
+// own text, so that the stages share one copy of the lens.
+static void SpliceDistort(const char* source, const char** strings, GLint* lengths)
+{
+    const char* shared = pezGetShader("Distort");
+    pezCheck(shared != 0, "Can't find shader: Distort\n");
+    const char* body = strstr(source, "#line");
+    strings[0] = source;
+    lengths[0] = (GLint) (body - source);
+    strings[1] = strstr(shared, "#line");
+    lengths[1] = -1;
+    strings[2] = body;
+    lengths[2] = -1;
+}
+
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey)
 {
     GLchar spew[256];
@@ -183,7 +399,10 @@ static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKe
     const char* vsSource = pezGetShader(vsKey);
     pezCheck(vsSource != 0, "Can't find vshader: %s\n", vsKey);
     GLuint vsHandle = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vsHandle, 1, &vsSource, 0);
+    const char* vsStrings[3];
+    GLint vsLengths[3];
+    SpliceDistort(vsSource, vsStrings, vsLengths);
+    glShaderSource(vsHandle, 3, vsStrings, vsLengths);
     glCompileShader(vsHandle);
     glGetShaderiv(vsHandle, GL_COMPILE_STATUS, &compileSuccess);
     glGetShaderInfoLog(vsHandle, sizeof(spew), 0, spew);
@@ -202,15 +421,21 @@ static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKe
         glAttachShader(programHandle, gsHandle);
     }
 
-    const char* fsSource = pezGetShader(fsKey);
-    pezCheck(fsSource != 0, "Can't find fshader: %s\n", fsKey);
-    GLuint fsHandle = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fsHandle, 1, &fsSource, 0);
-    glCompileShader(fsHandle);
-    glGetShaderiv(fsHandle, GL_COMPILE_STATUS, &compileSuccess);
-    glGetShaderInfoLog(fsHandle, sizeof(spew), 0, spew);
-    pezCheck(compileSuccess, "Can't compile fshader:\n%s", spew);
-    glAttachShader(programHandle, fsHandle);
+    if (fsKey) {
+        const char* fsSource = pezGetShader(fsKey);
+        pezCheck(fsSource != 0, "Can't find fshader: %s\n", fsKey);
+        GLuint fsHandle = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fsHandle, 1, &fsSource, 0);
+        glCompileShader(fsHandle);
+        glGetShaderiv(fsHandle, GL_COMPILE_STATUS, &compileSuccess);
+        glGetShaderInfoLog(fsHandle, sizeof(spew), 0, spew);
+        pezCheck(compileSuccess, "Can't compile fshader:\n%s", spew);
+        glAttachShader(programHandle, fsHandle);
+    } else {
+        // Programs without a fragment shader only feed transform feedback.
+        const GLchar* varyings[] = {"gl_Position"};
+        glTransformFeedbackVaryings(programHandle, 1, varyings, GL_INTERLEAVED_ATTRIBS);
+    }
 
     glLinkProgram(programHandle);
     GLint linkSuccess;
@@ -231,22 +456,39 @@ static Vector3 EvaluateCylinder(float s, float t)
     return range;
 }
 
-static MeshPod CreateCylinder()
+static GLuint CreateIndexBuffer(const MeshIndices* indices)
 {
-    const int VertexCount = (Slices+1) * (Stacks+1);
-    const int FillIndexCount = (Slices+1) * Stacks * 6;
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->Size * indices->Count, indices->Data, GL_STATIC_DRAW);
+    return vbo;
+}
+
+static MeshPod CreateCylinder(int slices, int stacks)
+{
+    const int VertexCount = (slices+1) * (stacks+1);
+
+    // Every vertex here runs Distort(), so the triangles are ordered for
+    // the post-transform cache instead of being drawn as strips.  Line
+    // strips around each circle and along each slice follow the same
+    // renumbering.  Finer tessellations switch to 32-bit indices by
+    // themselves.
+    MeshIndices* triangles = meshLatticeTriangles(slices, stacks);
+    MeshIndices* lines = meshLatticeLines(slices, stacks);
+    unsigned int* remap = (unsigned int*) malloc(sizeof(unsigned int) * VertexCount);
+    pezCheck(triangles && lines && remap, "Unable to build cylinder indices.");
+    pezCheck(meshOptimizeTriangles(triangles, VertexCount, VertexCacheSize, remap),
+             "Unable to optimize cylinder indices.");
+    meshRemapIndices(lines, remap);
 
-    const int circles = (Stacks+1)*Slices;
-    const int longitudinal = Stacks*Slices;
-    const int LineIndexCount = 2 * (circles + longitudinal);
- 
     // Create a buffer with positions
     GLuint positionsVbo;
     if (1) {
-        Vertex verts[VertexCount];
-        Vertex* pVert = &verts[0];
-        float ds = 1.0f / Stacks;
-        float dt = 1.0f / Slices;
+        Vertex* verts = (Vertex*) malloc(sizeof(Vertex) * VertexCount);
+        Vertex* pVert = verts;
+        float ds = 1.0f / stacks;
+        float dt = 1.0f / slices;
 
         // The upper bounds in these loops are tweaked to reduce the
         // chance of precision error causing an incorrect # of iterations.
@@ -258,86 +500,29 @@ static MeshPod CreateCylinder()
         }
 
         pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
+        pezCheck(meshRemapVertices(verts, sizeof(Vertex), VertexCount, remap),
+                 "Unable to reorder cylinder vertices.");
 
-        GLsizeiptr size = sizeof(verts);
+        GLsizeiptr size = sizeof(Vertex) * VertexCount;
         const GLvoid* data = &verts[0].Position.x;
         GLenum usage = GL_STATIC_DRAW;
         glGenBuffers(1, &positionsVbo);
         glBindBuffer(GL_ARRAY_BUFFER, positionsVbo);
         glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit triangle indices
-    GLuint trianglesVbo;
-    if (1) {
-        GLushort inds[FillIndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            int vps = Slices+1; // vertices per stack
-            for (GLushort i = 0; i < vps; i++) {
-                *pIndex++ = (n + i + vps);
-                *pIndex++ = n + (i + 1) % vps;
-                *pIndex++ = n + i;
-                
-                *pIndex++ = (n + (i + 1) % vps + vps);
-                *pIndex++ = (n + (i + 1) % vps);
-                *pIndex++ = (n + i + vps);
-            }
-            n += vps;
-        }
-
-        pezCheck(pIndex - &inds[0] == FillIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &trianglesVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trianglesVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit line indices
-    GLuint lineVbo;
-    if (1) {
-
-        GLushort inds[LineIndexCount];
-        GLushort* pIndex = &inds[0];
-
-        // Circles:
-        GLushort n = 0;
-        for (GLushort j = 0; j < Stacks+1; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + 1;
-            }
-            n += Slices + 1;
-        }
-
-        // Longitudinal:
-        n = 0;
-        for (GLushort j = 0; j < Stacks; j++) {
-            for (GLushort i = 0; i < Slices; i++) {
-                *pIndex++ = n + i;
-                *pIndex++ = n + i + (Slices + 1);
-            }
-            n += Slices + 1;
-        }
-
-        pezCheck(pIndex - &inds[0] == LineIndexCount, "Tessellation error.");
-
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &lineVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineVbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+        free(verts);
     }
 
     MeshPod mesh;
     mesh.VertexCount = VertexCount;
-    mesh.FillIndexCount = FillIndexCount;
-    mesh.LineIndexCount = LineIndexCount;
+    mesh.FillIndexCount = triangles->Count;
+    mesh.LineIndexCount = lines->Count;
+    mesh.IndexType = triangles->Size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.RestartIndex = triangles->Restart;
+    GLuint trianglesVbo = CreateIndexBuffer(triangles);
+    GLuint lineVbo = CreateIndexBuffer(lines);
+    meshDestroyIndices(triangles);
+    meshDestroyIndices(lines);
+    free(remap);
 
     glGenVertexArrays(1, &mesh.FillVao);
     glBindVertexArray(mesh.FillVao);
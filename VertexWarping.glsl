@@ -1,34 +1,105 @@
--- Simple.VS
+-- Distort
 
-in vec4 Position;
-uniform mat4 ModelviewProjection[7];
-uniform float Power;
+// Shared by the vertex stages, which LoadProgram compiles with this
+// section ahead of their own.
+
+struct LensModel {
+    float Power;
+    vec3 K;
+    vec2 P;
+};
+uniform LensModel Lens;
 
 vec4 Distort(vec4 p)
 {
     vec2 v = p.xy / p.w;
 
+#if defined(LENS_K1) || defined(LENS_RADIAL) || defined(LENS_BROWN_CONRADY)
+    // Brown-Conrady, with only the terms this lens has compiled in
+    // (see lensShaderDefine in lens.h).
+    float r2 = dot(v, v);
+#ifdef LENS_K1
+    float radial = 1.0 + Lens.K.x * r2;
+#else
+    float radial = 1.0 + r2 * (Lens.K.x + r2 * (Lens.K.y + r2 * Lens.K.z));
+#endif
+    vec2 d = v * radial;
+#ifdef LENS_BROWN_CONRADY
+    float xy = 2.0 * v.x * v.y;
+    d.x += Lens.P.x * xy + Lens.P.y * (r2 + 2.0 * v.x * v.x);
+    d.y += Lens.P.x * (r2 + 2.0 * v.y * v.y) + Lens.P.y * xy;
+#endif
+    v = d;
+#elif defined(FAST_DISTORT)
+    // Same as the polar round trip below, since scaling v by
+    // radius^(Lens.Power-1) leaves its angle alone.
+    float r2 = dot(v, v);
+    if (r2 > 0) {
+        if (Lens.Power == 2.0)
+            v *= sqrt(r2);
+        else if (Lens.Power == 0.5)
+            v *= inversesqrt(sqrt(r2));
+        else
+            v *= exp2(0.5 * (Lens.Power - 1.0) * log2(r2));
+    }
+#else
     // Convert to polar coords:
     float theta  = atan(v.y,v.x);
     float radius = length(v);
 
     // Distort:
-    radius = pow(radius, Power);
+    radius = pow(radius, Lens.Power);
 
     // Convert back to Cartesian:
     v.x = radius * cos(theta);
     v.y = radius * sin(theta);
+#endif
     p.xy = v.xy * p.w;
     return p;
 }
 
+-- Warp.VS
+
+layout(location = 0) in vec4 Position;
+uniform mat4 ModelviewProjection[7];
+uniform int Objects[7];
+uniform int First;
+
+// Captured into the buffer that Simple.VS and Lit.VS fetch from.
 void main()
 {
-    vec4 p = ModelviewProjection[gl_InstanceID] * Position;
+    vec4 p = ModelviewProjection[Objects[First + gl_InstanceID]] * Position;
     gl_Position = Distort(p);
 }
 
 
+-- Simple.VS
+
+in vec4 Position;
+uniform mat4 ModelviewProjection[7];
+uniform int Objects[7];
+uniform int First;
+
+#ifdef CAPTURE_WARP
+// Warp.VS has already distorted every vertex of every instance.  Each
+// level of detail's instances start at WarpBase.
+uniform samplerBuffer Warped;
+uniform int VertexCount;
+uniform int WarpBase;
+
+void main()
+{
+    gl_Position = texelFetch(Warped, WarpBase + gl_InstanceID * VertexCount + gl_VertexID);
+}
+#else
+void main()
+{
+    vec4 p = ModelviewProjection[Objects[First + gl_InstanceID]] * Position;
+    gl_Position = Distort(p);
+}
+#endif
+
+
 -- Simple.FS
 
 out vec4 FragColor;
@@ -42,34 +113,31 @@ void main()
 
 in vec4 Position;
 out vec3 vPosition;
+#ifdef DERIVATIVE_NORMALS
+flat out int vInstanceID;
+#else
 out int vInstanceID;
+#endif
 uniform mat4 ModelviewProjection[7];
-uniform float Power;
+uniform int Objects[7];
+uniform int First;
 
-vec4 Distort(vec4 p)
-{
-    vec2 v = p.xy / p.w;
-
-    // Convert to polar coords:
-    float theta  = atan(v.y,v.x);
-    float radius = length(v);
-
-    // Distort:
-    radius = pow(radius, Power);
-
-    // Convert back to Cartesian:
-    v.x = radius * cos(theta);
-    v.y = radius * sin(theta);
-    p.xy = v.xy * p.w;
-    return p;
-}
+#ifdef CAPTURE_WARP
+uniform samplerBuffer Warped;
+uniform int VertexCount;
+uniform int WarpBase;
+#endif
 
 void main()
 {
-    vInstanceID = gl_InstanceID;
+    vInstanceID = Objects[First + gl_InstanceID];
     vPosition = Position.xyz;
-    vec4 p = ModelviewProjection[gl_InstanceID] * Position;
+#ifdef CAPTURE_WARP
+    gl_Position = texelFetch(Warped, WarpBase + gl_InstanceID * VertexCount + gl_VertexID);
+#else
+    vec4 p = ModelviewProjection[vInstanceID] * Position;
     gl_Position = Distort(p);
+#endif
 }
 
 
@@ -80,7 +148,7 @@ layout(triangle_strip, max_vertices = 3) out;
 in vec3 vPosition[3];
 out vec3 gNormal;
 in int vInstanceID[3];
-out float gDistance[4];
+out vec3 gPosition;
 flat out int gInstanceID;
 
 void main()
@@ -91,6 +159,7 @@ void main()
     gNormal = normalize(cross(A, B));
 
     for (int j = 0; j < 3; j++) {
+        gPosition = vPosition[j];
         gl_Position = gl_in[j].gl_Position;
         EmitVertex();
     }
@@ -99,8 +168,14 @@ void main()
 
 -- Lit.FS
 
+#ifdef DERIVATIVE_NORMALS
+in vec3 vPosition;
+flat in int vInstanceID;
+#else
+in vec3 gPosition;
 in vec3 gNormal;
 flat in int gInstanceID;
+#endif
 out vec4 FragColor;
 uniform vec3 AmbientMaterial = vec3(0.2, 0.2, 0.2);
 uniform vec3 SpecularMaterial = vec3(0.5, 0.5, 0.5);
@@ -110,14 +185,42 @@ uniform float Shininess = 7;
 uniform vec3 Hhat[7];
 uniform vec3 Lhat[7];
 
+#ifdef WIREFRAME
+// The lit-pass wireframe; see OriginalScene.glsl.  Lattice follows the
+// level of detail being drawn.
+uniform vec2 Lattice;
+uniform vec4 LineColor = vec4(0, 0, 0, 1);
+uniform float LineWidth = 1.5;
+
+float Wire(vec3 p)
+{
+    vec2 cell = vec2(atan(p.z, p.x) / 6.28318531, p.y + 0.5) * Lattice;
+    vec3 dx = dFdx(p), dy = dFdy(p);
+    float da = (abs(p.x * dx.z - p.z * dx.x) + abs(p.x * dy.z - p.z * dy.x)) / dot(p.xz, p.xz);
+    vec2 pitch = vec2(da / 6.28318531, abs(dx.y) + abs(dy.y)) * Lattice;
+    vec2 d = abs(fract(cell + 0.5) - 0.5) / max(pitch, vec2(1e-6));
+    return clamp(0.5 * LineWidth + 0.5 - min(d.x, d.y), 0.0, 1.0);
+}
+#endif
+
 void main()
 {
+#ifdef DERIVATIVE_NORMALS
+    // The position's screen-space derivatives lie in the face, and their
+    // cross product points back at the viewer on either side of it.
+    vec3 position = vPosition;
+    vec3 N = normalize(cross(dFdx(position), dFdy(position)));
+    int instance = vInstanceID;
+#else
+    vec3 position = gPosition;
     vec3 N = -normalize(gNormal);
     if (!gl_FrontFacing)
        N = -N;
+    int instance = gInstanceID;
+#endif
 
-    float df = max(0.0, dot(N, Lhat[gInstanceID]));
-    float sf = max(0.0, dot(N, Hhat[gInstanceID]));
+    float df = max(0.0, dot(N, Lhat[instance]));
+    float sf = max(0.0, dot(N, Hhat[instance]));
     sf = pow(sf, Shininess);
 
     vec3 diffuse = gl_FrontFacing ? FrontMaterial.rgb : BackMaterial.rgb;
@@ -126,4 +229,7 @@ void main()
         lighting += sf * SpecularMaterial;
 
     FragColor = vec4(lighting, FrontMaterial.a);
+#ifdef WIREFRAME
+    FragColor = mix(FragColor, LineColor, Wire(position));
+#endif
 }
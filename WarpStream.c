@@ -0,0 +1,453 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+// Warps a stream of Y4M or raw frames with one of the TextureWarping demos.
+// Reading, warping and writing run on their own threads, connected by
+// bounded rings that block when full or empty, so I/O overlaps compute.
+// Throughput and queue depths are reported on stderr about once a second.
+//
+// Usage: WarpStream [-m gridless|uniform|pincushion|nonuniform] [-p power]
+//                   [-raw WxHxC] [-chroma] [-q depth] input output
+//
+// Use - for stdin or stdout.  Without -raw the input must be YUV4MPEG2;
+// each plane is warped at its own resolution.  Raw frames hold C
+// interleaved 8-bit channels.  With -chroma, raw RGB or RGBA frames get
+// the gridless warp with lateral chromatic aberration correction, all
+// channels in one pass.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include "warp.h"
+
+const int GridRows = 20;
+const int GridCols = 36;
+
+typedef enum { ModelGridless, ModelUniform, ModelPincushion, ModelNonuniform } Model;
+
+typedef struct PlaneRec {
+    int Width;
+    int Height;
+    int Channels;
+    size_t Offset;
+    WarpMap* Map;
+    WarpFill Fill;
+    WarpMap* Chroma[3];     // per-channel maps, used instead of Map
+} Plane;
+
+typedef struct FrameRec {
+    unsigned char* In;
+    unsigned char* Out;
+    char Header[256];           // FRAME line of a Y4M stream, with its newline
+    bool Last;
+} Frame;
+
+// A lock per push and pop costs nothing next to warping a frame, and lets a
+// stage with nothing to do sleep instead of spinning.  Depth is sampled on
+// every pop; Full and Empty count the pushes and pops that had to wait,
+// once each.
+typedef struct RingRec {
+    Frame** Slots;
+    unsigned int Mask;
+    unsigned int Tail;
+    unsigned int Head;
+    pthread_mutex_t Lock;
+    pthread_cond_t NotFull;
+    pthread_cond_t NotEmpty;
+    unsigned int Pops;
+    unsigned int DepthSum;
+    unsigned int MaxDepth;
+    unsigned int Full;
+    unsigned int Empty;
+} Ring;
+
+static struct {
+    FILE* Input;
+    FILE* Output;
+    bool Y4m;
+    char StreamHeader[256];
+    int PlaneCount;
+    Plane Planes[3];
+    size_t FrameSize;
+    Ring Filled;                // reader -> warper
+    Ring Warped;                // warper -> writer
+    Ring Free;                  // writer -> reader
+} Stream;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool InitRing(Ring* ring, int capacity)
+{
+    unsigned int size = 1;
+    while (size < (unsigned int) capacity) {
+        size *= 2;
+    }
+    memset(ring, 0, sizeof(Ring));
+    ring->Slots = (Frame**) calloc(size, sizeof(Frame*));
+    ring->Mask = size - 1;
+    pthread_mutex_init(&ring->Lock, 0);
+    pthread_cond_init(&ring->NotFull, 0);
+    pthread_cond_init(&ring->NotEmpty, 0);
+    return ring->Slots != 0;
+}
+
+static void Push(Ring* ring, Frame* frame)
+{
+    pthread_mutex_lock(&ring->Lock);
+    if (ring->Tail - ring->Head > ring->Mask) {
+        ring->Full++;
+        do {
+            pthread_cond_wait(&ring->NotFull, &ring->Lock);
+        } while (ring->Tail - ring->Head > ring->Mask);
+    }
+    ring->Slots[ring->Tail++ & ring->Mask] = frame;
+    pthread_cond_signal(&ring->NotEmpty);
+    pthread_mutex_unlock(&ring->Lock);
+}
+
+static Frame* Pop(Ring* ring)
+{
+    pthread_mutex_lock(&ring->Lock);
+    if (ring->Tail == ring->Head) {
+        ring->Empty++;
+        do {
+            pthread_cond_wait(&ring->NotEmpty, &ring->Lock);
+        } while (ring->Tail == ring->Head);
+    }
+    unsigned int depth = ring->Tail - ring->Head;
+    ring->Pops++;
+    ring->DepthSum += depth;
+    if (depth > ring->MaxDepth) {
+        ring->MaxDepth = depth;
+    }
+
+    Frame* frame = ring->Slots[ring->Head++ & ring->Mask];
+    pthread_cond_signal(&ring->NotFull);
+    pthread_mutex_unlock(&ring->Lock);
+    return frame;
+}
+
+static void PrintRing(const char* name, Ring* ring)
+{
+    pthread_mutex_lock(&ring->Lock);
+    fprintf(stderr, "  %s depth %.1f max %u", name,
+            ring->Pops ? (double) ring->DepthSum / ring->Pops : 0.0, ring->MaxDepth);
+    pthread_mutex_unlock(&ring->Lock);
+}
+
+static bool ReadLine(FILE* file, char* line, int size)
+{
+    if (!fgets(line, size, file)) {
+        return false;
+    }
+    return strchr(line, '\n') != 0;
+}
+
+// Parses the stream header and lays out the planes of a frame.
+static bool ParseY4m()
+{
+    char* header = Stream.StreamHeader;
+    if (!ReadLine(Stream.Input, header, sizeof(Stream.StreamHeader)) ||
+        strncmp(header, "YUV4MPEG2 ", 10)) {
+        fprintf(stderr, "Input is not a YUV4MPEG2 stream\n");
+        return false;
+    }
+
+    int width = 0, height = 0;
+    const char* chroma = "420";
+    for (char* tag = strchr(header, ' '); tag; tag = strchr(tag + 1, ' ')) {
+        if (tag[1] == 'W') width = atoi(tag + 2);
+        if (tag[1] == 'H') height = atoi(tag + 2);
+        if (tag[1] == 'C') chroma = tag + 2;
+    }
+
+    int chromaWidth, chromaHeight;
+    if (!strncmp(chroma, "420", 3)) {
+        chromaWidth = (width + 1) / 2;
+        chromaHeight = (height + 1) / 2;
+    } else if (!strncmp(chroma, "422", 3)) {
+        chromaWidth = (width + 1) / 2;
+        chromaHeight = height;
+    } else if (!strncmp(chroma, "444", 3) && chroma[3] != 'a') {
+        chromaWidth = width;
+        chromaHeight = height;
+    } else if (!strncmp(chroma, "mono", 4)) {
+        chromaWidth = chromaHeight = 0;
+    } else {
+        fprintf(stderr, "Unsupported Y4M colorspace C%.*s\n", (int) strcspn(chroma, " \n"), chroma);
+        return false;
+    }
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "Y4M header has no frame size\n");
+        return false;
+    }
+
+    // White background and black border, in studio-range YCbCr.
+    Plane luma = {width, height, 1, 0, 0, {{235}, {16}}};
+    Plane cb = {chromaWidth, chromaHeight, 1, (size_t) width * height, 0, {{128}, {128}}};
+    Plane cr = cb;
+    cr.Offset += (size_t) chromaWidth * chromaHeight;
+
+    Stream.Planes[0] = luma;
+    Stream.PlaneCount = 1;
+    if (chromaWidth) {
+        Stream.Planes[1] = cb;
+        Stream.Planes[2] = cr;
+        Stream.PlaneCount = 3;
+    }
+    return true;
+}
+
+static bool ParseRaw(const char* size)
+{
+    Plane plane = {0, 0, 0, 0, 0, warpDefaultFill()};
+    if (sscanf(size, "%dx%dx%d", &plane.Width, &plane.Height, &plane.Channels) != 3 ||
+        plane.Width <= 0 || plane.Height <= 0 || plane.Channels < 1 || plane.Channels > 4) {
+        fprintf(stderr, "Bad raw frame size '%s', expected WxHxC\n", size);
+        return false;
+    }
+    Stream.Planes[0] = plane;
+    Stream.PlaneCount = 1;
+    return true;
+}
+
+static bool CreateMaps(Model model, float power, bool chroma)
+{
+    static const int layouts[] = {0, WARP_GRID_UNIFORM, WARP_GRID_PINCUSHION, WARP_GRID_NONUNIFORM};
+
+    // Typical HMD values: red lands inside green, blue outside.
+    LensModel lens = lensPowerModel(power);
+    LensChroma shift = lensChroma(0.996f, -0.004f, 1.014f, 0);
+
+    Stream.FrameSize = 0;
+    for (int i = 0; i < Stream.PlaneCount; i++) {
+        Plane* plane = Stream.Planes + i;
+        int w = plane->Width, h = plane->Height;
+        if (chroma) {
+            if (!warpCreateChromaMaps(&lens, &shift, w, h, w, h, plane->Chroma)) {
+                return false;
+            }
+            plane->Map = plane->Chroma[1];
+        } else if (model == ModelGridless) {
+            plane->Map = warpCreateMap(power, w, h, w, h);
+        } else {
+            plane->Map = warpCreateGridMap(layouts[model], power, GridRows, GridCols, w, h, w, h);
+        }
+        if (!plane->Map) {
+            return false;
+        }
+        size_t end = plane->Offset + (size_t) w * h * plane->Channels;
+        Stream.FrameSize = end > Stream.FrameSize ? end : Stream.FrameSize;
+    }
+    return true;
+}
+
+static void* ReadMain(void* arg)
+{
+    for (;;) {
+        Frame* frame = Pop(&Stream.Free);
+        frame->Last = true;
+        if (Stream.Y4m) {
+            if (!ReadLine(Stream.Input, frame->Header, sizeof(frame->Header))) {
+                Push(&Stream.Filled, frame);
+                return 0;
+            }
+            if (strncmp(frame->Header, "FRAME", 5)) {
+                fprintf(stderr, "Expected a FRAME header\n");
+                Push(&Stream.Filled, frame);
+                return 0;
+            }
+        }
+
+        size_t count = fread(frame->In, 1, Stream.FrameSize, Stream.Input);
+        if (count != Stream.FrameSize) {
+            if (count) {
+                fprintf(stderr, "Dropped a partial frame of %zu bytes\n", count);
+            }
+            Push(&Stream.Filled, frame);
+            return 0;
+        }
+
+        frame->Last = false;
+        Push(&Stream.Filled, frame);
+    }
+}
+
+static void* WarpMain(void* arg)
+{
+    for (;;) {
+        Frame* frame = Pop(&Stream.Filled);
+        if (!frame->Last) {
+            for (int i = 0; i < Stream.PlaneCount; i++) {
+                const Plane* plane = Stream.Planes + i;
+                int stride = plane->Width * plane->Channels;
+                WarpImage src = {plane->Width, plane->Height, plane->Channels, stride,
+                                 frame->In + plane->Offset};
+                WarpImage dst = {plane->Width, plane->Height, plane->Channels, stride,
+                                 frame->Out + plane->Offset};
+                if (plane->Chroma[0]) {
+                    warpApplyChromaMaps(&src, plane->Chroma, &dst, &plane->Fill);
+                } else {
+                    warpApplyMap(&src, plane->Map, &dst, &plane->Fill);
+                }
+            }
+        }
+        Push(&Stream.Warped, frame);
+        if (frame->Last) {
+            return 0;
+        }
+    }
+}
+
+// Runs on the main thread, which also does the reporting.
+static int WriteFrames()
+{
+    double start = Now(), lastReport = start;
+    int frames = 0, reported = 0;
+    bool failed = false;
+
+    if (Stream.Y4m) {
+        fputs(Stream.StreamHeader, Stream.Output);
+    }
+
+    for (;;) {
+        Frame* frame = Pop(&Stream.Warped);
+        if (frame->Last) {
+            break;
+        }
+
+        if (!failed) {
+            if (Stream.Y4m) {
+                fputs(frame->Header, Stream.Output);
+            }
+            if (fwrite(frame->Out, 1, Stream.FrameSize, Stream.Output) != Stream.FrameSize) {
+                fprintf(stderr, "Write failed\n");
+                failed = true;
+            }
+        }
+        Push(&Stream.Free, frame);
+        frames++;
+
+        double now = Now();
+        if (now - lastReport >= 1.0) {
+            fprintf(stderr, "%6d frames  %7.2f fps", frames, (frames - reported) / (now - lastReport));
+            PrintRing("read->warp", &Stream.Filled);
+            PrintRing("warp->write", &Stream.Warped);
+            fprintf(stderr, "\n");
+            lastReport = now;
+            reported = frames;
+        }
+    }
+    fflush(Stream.Output);
+
+    double elapsed = Now() - start;
+    fprintf(stderr, "%6d frames in %.2f s, %.2f fps sustained\n",
+            frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0);
+    PrintRing("read->warp", &Stream.Filled);
+    fprintf(stderr, "  warp waited %u, reader blocked %u\n", Stream.Filled.Empty, Stream.Filled.Full);
+    PrintRing("warp->write", &Stream.Warped);
+    fprintf(stderr, "  writer waited %u, warp blocked %u\n", Stream.Warped.Empty, Stream.Warped.Full);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    Model model = ModelGridless;
+    float power = 2.0f;
+    int depth = 4;
+    bool chroma = false;
+    const char* rawSize = 0;
+    const char* paths[2] = {0, 0};
+    int pathCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-m") && hasValue) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "gridless")) model = ModelGridless;
+            else if (!strcmp(name, "uniform")) model = ModelUniform;
+            else if (!strcmp(name, "pincushion")) model = ModelPincushion;
+            else if (!strcmp(name, "nonuniform")) model = ModelNonuniform;
+            else pathCount = 3;
+        } else if (!strcmp(argv[i], "-p") && hasValue) {
+            power = (float) atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-raw") && hasValue) {
+            rawSize = argv[++i];
+        } else if (!strcmp(argv[i], "-chroma")) {
+            chroma = true;
+        } else if (!strcmp(argv[i], "-q") && hasValue) {
+            depth = atoi(argv[++i]);
+        } else if (pathCount < 2) {
+            paths[pathCount++] = argv[i];
+        } else {
+            pathCount = 3;
+        }
+    }
+    if (pathCount != 2 || depth < 1 || power <= 0) {
+        fprintf(stderr, "Usage: %s [-m gridless|uniform|pincushion|nonuniform] [-p power] "
+                "[-raw WxHxC] [-chroma] [-q depth] input output\n", argv[0]);
+        return 1;
+    }
+
+    Stream.Input = strcmp(paths[0], "-") ? fopen(paths[0], "rb") : stdin;
+    Stream.Output = strcmp(paths[1], "-") ? fopen(paths[1], "wb") : stdout;
+    if (!Stream.Input || !Stream.Output) {
+        fprintf(stderr, "Unable to open %s\n", Stream.Input ? paths[1] : paths[0]);
+        return 1;
+    }
+
+    Stream.Y4m = !rawSize;
+    if (!(rawSize ? ParseRaw(rawSize) : ParseY4m())) {
+        return 1;
+    }
+    if (chroma && (model != ModelGridless || Stream.Y4m || Stream.Planes[0].Channels < 3)) {
+        fprintf(stderr, "-chroma needs the gridless model and raw RGB or RGBA frames\n");
+        return 1;
+    }
+    if (!CreateMaps(model, power, chroma)) {
+        fprintf(stderr, "Unable to build the warp\n");
+        return 1;
+    }
+
+    // Enough frames to fill both queues while each stage holds one.
+    // Queue depths are rounded up to a power of two.
+    int frameCount = 2 * depth + 3;
+    if (!InitRing(&Stream.Filled, depth) || !InitRing(&Stream.Warped, depth) ||
+        !InitRing(&Stream.Free, frameCount)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < frameCount; i++) {
+        Frame* frame = (Frame*) calloc(1, sizeof(Frame));
+        if (frame) {
+            frame->In = (unsigned char*) malloc(Stream.FrameSize);
+            frame->Out = (unsigned char*) malloc(Stream.FrameSize);
+        }
+        if (!frame || !frame->In || !frame->Out) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        Push(&Stream.Free, frame);
+    }
+
+    pthread_t reader, warper;
+    if (pthread_create(&reader, 0, ReadMain, 0) || pthread_create(&warper, 0, WarpMain, 0)) {
+        fprintf(stderr, "Unable to start threads\n");
+        return 1;
+    }
+    int result = WriteFrames();
+    pthread_join(reader, 0);
+    pthread_join(warper, 0);
+    return result;
+}
@@ -0,0 +1,162 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+// Benchmarks the tiled CPU warp against the single-threaded one on a
+// synthetic frame, checks that both produce the same pixels, and reports
+// how the tiles were spread over the threads.
+//
+// Usage: WarpTiles [-p barrelPower] [-t threads] [-s tileSize]
+//                  [-w width] [-h height] [-tiles]
+//
+// The barrel power has the same meaning as BarrelPower in
+// TextureWarping-Gridless.glsl.  With -tiles, every tile's position, thread
+// and time is listed as well.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "warp.h"
+
+const int Frames = 10;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static WarpImage CreateImage(int width, int height)
+{
+    WarpImage image = {width, height, 4, width * 4, 0};
+    image.Pixels = (unsigned char*) malloc(image.Stride * height);
+    return image;
+}
+
+static void FillChecker(WarpImage* image)
+{
+    for (int y = 0; y < image->Height; y++) {
+        unsigned char* p = image->Pixels + y * image->Stride;
+        for (int x = 0; x < image->Width; x++, p += 4) {
+            bool odd = ((x >> 5) ^ (y >> 5)) & 1;
+            p[0] = odd ? 255 : (unsigned char) (x * 255 / image->Width);
+            p[1] = odd ? 255 : (unsigned char) (y * 255 / image->Height);
+            p[2] = odd ? 0 : 128;
+            p[3] = 255;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    float power = 2.0f;
+    int threads = 0, tileSize = 0, width = 3840, height = 2160;
+    bool listTiles = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-tiles")) {
+            listTiles = true;
+        } else if (!strcmp(argv[i], "-p") && hasValue) {
+            power = (float) atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && hasValue) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && hasValue) {
+            tileSize = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && hasValue) {
+            width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-h") && hasValue) {
+            height = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-p barrelPower] [-t threads] [-s tileSize] "
+                    "[-w width] [-h height] [-tiles]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    WarpImage src = CreateImage(width, height);
+    WarpImage reference = CreateImage(width, height);
+    WarpImage dst = CreateImage(width, height);
+    WarpPool* pool = warpCreatePool(threads);
+    int tileCount = warpTileCount(width, height, tileSize);
+    WarpTileStats* stats = (WarpTileStats*) calloc(tileCount, sizeof(WarpTileStats));
+    if (!src.Pixels || !reference.Pixels || !dst.Pixels || !pool || !stats) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    threads = warpPoolThreads(pool);
+
+    FillChecker(&src);
+    WarpFill fill = warpDefaultFill();
+
+    double single = 1e9, tiled = 1e9;
+    for (int frame = 0; frame < Frames; frame++) {
+        double start = Now();
+        warpBarrel(&src, &reference, power, &fill);
+        double middle = Now();
+        if (!warpBarrelTiled(pool, &src, &dst, power, &fill, tileSize, stats)) {
+            fprintf(stderr, "Tiled warp failed\n");
+            return 1;
+        }
+        double end = Now();
+        single = middle - start < single ? middle - start : single;
+        tiled = end - middle < tiled ? end - middle : tiled;
+    }
+
+    bool match = true;
+    for (int y = 0; y < height && match; y++) {
+        match = !memcmp(reference.Pixels + y * reference.Stride,
+                        dst.Pixels + y * dst.Stride, width * 4);
+    }
+
+    printf("%d x %d, barrel power %g, %d tiles, %d threads\n",
+           width, height, power, tileCount, threads);
+    printf("single-threaded  %8.2f ms\n", single * 1e3);
+    printf("tiled            %8.2f ms  (%.2fx)\n", tiled * 1e3, single / tiled);
+    printf("output           %s\n\n", match ? "identical" : "DIFFERS");
+
+    // Per-thread breakdown of the last frame.
+    printf("thread  tiles  stolen  busy ms\n");
+    for (int t = 0; t < threads; t++) {
+        int count = 0, stolen = 0;
+        double busy = 0;
+        for (int i = 0; i < tileCount; i++) {
+            if (stats[i].Thread == t) {
+                count++;
+                stolen += stats[i].Stolen;
+                busy += stats[i].Seconds;
+            }
+        }
+        printf("%6d  %5d  %6d  %7.2f\n", t, count, stolen, busy * 1e3);
+    }
+
+    double fastest = 1e9, slowest = 0, total = 0;
+    for (int i = 0; i < tileCount; i++) {
+        fastest = stats[i].Seconds < fastest ? stats[i].Seconds : fastest;
+        slowest = stats[i].Seconds > slowest ? stats[i].Seconds : slowest;
+        total += stats[i].Seconds;
+    }
+    printf("\ntile us  min %.1f  mean %.1f  max %.1f\n",
+           fastest * 1e6, total / tileCount * 1e6, slowest * 1e6);
+
+    if (listTiles) {
+        printf("\n    x     y  width height thread stolen      us\n");
+        for (int i = 0; i < tileCount; i++) {
+            const WarpTileStats* s = stats + i;
+            printf("%5d %5d  %5d  %5d  %5d  %5d  %6.1f\n",
+                   s->X, s->Y, s->Width, s->Height, s->Thread, s->Stolen, s->Seconds * 1e6);
+        }
+    }
+
+    warpDestroyPool(pool);
+    free(stats);
+    free(src.Pixels);
+    free(reference.Pixels);
+    free(dst.Pixels);
+    return match ? 0 : 1;
+}
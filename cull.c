@@ -0,0 +1,273 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cull.h"
+#include "warp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CULL_X86 1
+#include <immintrin.h>
+#define CULL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// One plane per edge, through the eye, normalized so that the signed
+// distance of a sphere's center can be compared with its radius.  The
+// planes are kept as separate arrays of coefficients, padded to a multiple
+// of four, so that four edges are tested at once.
+typedef struct EdgesRec {
+    int Count;
+    float A[CULL_MAX_EDGES];
+    float B[CULL_MAX_EDGES];
+    float C[CULL_MAX_EDGES];
+    float D[CULL_MAX_EDGES];
+} Edges;
+
+struct CullGridRec {
+    int Rows;
+    int Columns;
+    Edges X;
+    Edges Y;
+    float Near[4];
+};
+
+// Row i of a column-major matrix.
+static void Row(const float* m, int i, float* row)
+{
+    for (int k = 0; k < 4; k++) {
+        row[k] = m[4 * k + i];
+    }
+}
+
+static void Normalize(float* plane)
+{
+    float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+    for (int k = 0; k < 4; k++) {
+        plane[k] = length > 0 ? plane[k] / length : 0;
+    }
+}
+
+// The clip-space plane x = edge * w, say, is row0 - edge * row3 in view
+// space; points to its right are on the positive side.
+static void SetEdges(Edges* edges, const float* row, const float* w, const float* ndc, int count)
+{
+    edges->Count = count;
+    for (int k = 0; k < CULL_MAX_EDGES; k++) {
+        float plane[4] = {0, 0, 0, 0};
+        if (k < count) {
+            for (int c = 0; c < 4; c++) {
+                plane[c] = row[c] - ndc[k] * w[c];
+            }
+            Normalize(plane);
+        }
+        edges->A[k] = plane[0];
+        edges->B[k] = plane[1];
+        edges->C[k] = plane[2];
+        edges->D[k] = plane[3];
+    }
+}
+
+CullGrid* cullCreateGrid(const float* projection, const float* xEdges, int columns,
+                         const float* yEdges, int rows)
+{
+    if (columns < 1 || rows < 1 || columns >= CULL_MAX_EDGES || rows >= CULL_MAX_EDGES) {
+        return 0;
+    }
+    CullGrid* grid = (CullGrid*) malloc(sizeof(CullGrid));
+    if (!grid) {
+        return 0;
+    }
+
+    float x[4], y[4], z[4], w[4];
+    Row(projection, 0, x);
+    Row(projection, 1, y);
+    Row(projection, 2, z);
+    Row(projection, 3, w);
+
+    grid->Rows = rows;
+    grid->Columns = columns;
+    SetEdges(&grid->X, x, w, xEdges, columns + 1);
+    SetEdges(&grid->Y, y, w, yEdges, rows + 1);
+    for (int c = 0; c < 4; c++) {
+        grid->Near[c] = z[c] + w[c];
+    }
+    Normalize(grid->Near);
+    return grid;
+}
+
+void cullDestroyGrid(CullGrid* grid)
+{
+    free(grid);
+}
+
+CullBins* cullCreateBins()
+{
+    CullBins* bins = (CullBins*) calloc(1, sizeof(CullBins));
+    return bins;
+}
+
+void cullDestroyBins(CullBins* bins)
+{
+    if (bins) {
+        free(bins->Offsets);
+        free(bins->Instances);
+        free(bins->Ranges);
+        free(bins);
+    }
+}
+
+// Bit k of inside is set when the sphere reaches the positive side of edge
+// k, and bit k of outside when it reaches the negative side.
+static void TestEdges(const Edges* edges, const CullSphere* s, unsigned long long* inside,
+                      unsigned long long* outside)
+{
+    *inside = *outside = 0;
+    for (int k = 0; k < edges->Count; k++) {
+        float d = edges->A[k] * s->X + edges->B[k] * s->Y + edges->C[k] * s->Z + edges->D[k];
+        *inside |= (unsigned long long) (d >= -s->Radius) << k;
+        *outside |= (unsigned long long) (d <= s->Radius) << k;
+    }
+}
+
+#ifdef CULL_X86
+
+CULL_TARGET("sse2")
+static void TestEdgesSSE2(const Edges* edges, const CullSphere* s, unsigned long long* inside,
+                          unsigned long long* outside)
+{
+    __m128 x = _mm_set1_ps(s->X), y = _mm_set1_ps(s->Y), z = _mm_set1_ps(s->Z);
+    __m128 r = _mm_set1_ps(s->Radius), nr = _mm_set1_ps(-s->Radius);
+    unsigned long long in = 0, out = 0;
+    for (int k = 0; k < edges->Count; k += 4) {
+        __m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(edges->A + k), x),
+                              _mm_mul_ps(_mm_loadu_ps(edges->B + k), y));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(edges->C + k), z));
+        d = _mm_add_ps(d, _mm_loadu_ps(edges->D + k));
+        in |= (unsigned long long) _mm_movemask_ps(_mm_cmpge_ps(d, nr)) << k;
+        out |= (unsigned long long) _mm_movemask_ps(_mm_cmple_ps(d, r)) << k;
+    }
+    // Drop the padding.
+    unsigned long long mask = edges->Count < 64 ? (1ull << edges->Count) - 1 : ~0ull;
+    *inside = in & mask;
+    *outside = out & mask;
+}
+
+#endif
+
+// Slab i lies between edges i and i + 1; the sphere overlaps it when it
+// reaches the right of the one and the left of the other.  Returns 0 if it
+// overlaps none of them.
+static int Span(unsigned long long inside, unsigned long long outside, int slabs, int* first, int* last)
+{
+    unsigned long long overlap = inside & (outside >> 1) & ((1ull << slabs) - 1);
+    if (!overlap) {
+        return 0;
+    }
+    *first = __builtin_ctzll(overlap);
+    *last = 63 - __builtin_clzll(overlap);
+    return 1;
+}
+
+// The cells are chosen in two passes, first finding the columns and rows
+// that each sphere spans and counting them into their cells, then laying
+// the instances out cell by cell.
+int cullBin(const CullGrid* grid, const CullSphere* spheres, int count, CullBins* bins)
+{
+    int cellCount = grid->Rows * grid->Columns;
+    if (bins->CellCount != cellCount || !bins->Offsets) {
+        free(bins->Offsets);
+        bins->Offsets = (int*) malloc(sizeof(int) * (cellCount + 1));
+        if (!bins->Offsets) {
+            bins->CellCount = 0;
+            return 0;
+        }
+        bins->CellCount = cellCount;
+    }
+    if (bins->RangeCapacity < count) {
+        int* ranges = (int*) realloc(bins->Ranges, sizeof(int) * 4 * count);
+        if (!ranges) {
+            return 0;
+        }
+        bins->Ranges = ranges;
+        bins->RangeCapacity = count;
+    }
+
+    int simd = 0;
+#ifdef CULL_X86
+    simd = warpGetIsa() != WARP_ISA_SCALAR;
+#endif
+
+    int* offsets = bins->Offsets;
+    memset(offsets, 0, sizeof(int) * (cellCount + 1));
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        const CullSphere* s = spheres + i;
+        int* range = bins->Ranges + 4 * i;
+        range[0] = -1;
+
+        const float* n = grid->Near;
+        if (n[0] * s->X + n[1] * s->Y + n[2] * s->Z + n[3] < -s->Radius) {
+            continue;
+        }
+
+        unsigned long long xIn, xOut, yIn, yOut;
+#ifdef CULL_X86
+        if (simd) {
+            TestEdgesSSE2(&grid->X, s, &xIn, &xOut);
+            TestEdgesSSE2(&grid->Y, s, &yIn, &yOut);
+        } else
+#endif
+        {
+            TestEdges(&grid->X, s, &xIn, &xOut);
+            TestEdges(&grid->Y, s, &yIn, &yOut);
+        }
+        if (!Span(xIn, xOut, grid->Columns, range, range + 1) ||
+            !Span(yIn, yOut, grid->Rows, range + 2, range + 3)) {
+            range[0] = -1;
+            continue;
+        }
+
+        for (int row = range[2]; row <= range[3]; row++) {
+            for (int col = range[0]; col <= range[1]; col++) {
+                offsets[row * grid->Columns + col + 1]++;
+            }
+        }
+        total += (range[1] - range[0] + 1) * (range[3] - range[2] + 1);
+    }
+
+    if (bins->Capacity < total) {
+        int* instances = (int*) realloc(bins->Instances, sizeof(int) * total);
+        if (!instances) {
+            return 0;
+        }
+        bins->Instances = instances;
+        bins->Capacity = total;
+    }
+    bins->Count = total;
+
+    // After the running sum Offsets[c] is where cell c starts.  It serves as
+    // the cell's cursor, which leaves it where the next cell starts, so the
+    // offsets are shifted back into place at the end.
+    for (int c = 0; c < cellCount; c++) {
+        offsets[c + 1] += offsets[c];
+    }
+    for (int i = 0; i < count; i++) {
+        const int* range = bins->Ranges + 4 * i;
+        if (range[0] < 0) {
+            continue;
+        }
+        for (int row = range[2]; row <= range[3]; row++) {
+            for (int col = range[0]; col <= range[1]; col++) {
+                bins->Instances[offsets[row * grid->Columns + col]++] = i;
+            }
+        }
+    }
+    for (int c = cellCount; c > 0; c--) {
+        offsets[c] = offsets[c - 1];
+    }
+    offsets[0] = 0;
+    return 1;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bins instances into the cells of a tiled render, so that each cell only
+// draws what can reach it.  Cells are the products of column and row
+// slabs of the screen, like the GridPoints partition in TiledRendering,
+// and each instance is a bounding sphere in view space.  A sphere lands in
+// every cell whose frustum it touches, conservatively.
+//
+// Since the cells share their edges, a sphere is tested against each
+// column and row edge once, rather than against every cell; the edge
+// tests run four at a time when warpGetIsa allows SSE2.
+
+enum { CULL_MAX_EDGES = 64 };   // per axis, so up to 63 columns and rows
+
+typedef struct CullSphereRec {
+    float X;
+    float Y;
+    float Z;
+    float Radius;
+} CullSphere;
+
+typedef struct CullGridRec CullGrid;
+
+// Projection is column-major, as passed to glUniformMatrix4fv.  Edges are
+// in normalized device coordinates and increasing, columns + 1 and rows
+// + 1 of them.
+CullGrid* cullCreateGrid(const float* projection, const float* xEdges, int columns,
+                         const float* yEdges, int rows);
+void cullDestroyGrid(CullGrid* grid);
+
+// Cells are numbered row by row.  The instances in cell c are
+// Instances[Offsets[c]] up to Instances[Offsets[c + 1]], in increasing
+// order.
+typedef struct CullBinsRec {
+    int CellCount;
+    int Count;
+    int* Offsets;
+    int* Instances;
+    int Capacity;
+    int* Ranges;                // column and row range of each sphere
+    int RangeCapacity;
+} CullBins;
+
+CullBins* cullCreateBins();
+void cullDestroyBins(CullBins* bins);
+int cullBin(const CullGrid* grid, const CullSphere* spheres, int count, CullBins* bins);
+
+#ifdef __cplusplus
+}
+#endif
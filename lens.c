@@ -0,0 +1,586 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "lens.h"
+
+void lensDistortReference(float* xy, int count, float power)
+{
+    for (int i = 0; i < count; i++, xy += 2) {
+        float theta = atan2f(xy[1], xy[0]);
+        float radius = sqrtf(xy[0] * xy[0] + xy[1] * xy[1]);
+        radius = powf(radius, power);
+        xy[0] = radius * cosf(theta);
+        xy[1] = radius * sinf(theta);
+    }
+}
+
+// Minimax fit of log2(1+t)/t for t in [sqrt(1/2)-1, sqrt(2)-1].
+// The absolute error of t * P(t) is under 3.1e-7.  Zero comes out as -127
+// rather than -inf.  Everything is branch-free so that loops vectorize.
+static inline float FastLog2(float x)
+{
+    // Split off the exponent so that the mantissa lands in [sqrt(1/2), sqrt(2)).
+    int bits;
+    memcpy(&bits, &x, 4);
+    int e = (bits - 0x3F3504F3) >> 23;
+    bits -= e << 23;
+    float m;
+    memcpy(&m, &bits, 4);
+
+    float t = m - 1.0f;
+    float p = 0.17063450f;
+    p = p * t - 0.27269793f;
+    p = p * t + 0.29726259f;
+    p = p * t - 0.35896185f;
+    p = p * t + 0.48046503f;
+    p = p * t - 0.72137587f;
+    p = p * t + 1.44269973f;
+    return e + t * p;
+}
+
+// Minimax fit of 2^f for f in [0, 1], with a relative error under 7.5e-8.
+// The result is clamped to [2^-126, 2^128).
+static inline float FastExp2(float x)
+{
+    // Adding 1.5 * 2^23 rounds to an integer in the low mantissa bits;
+    // rounding x - 0.5 gives floor(x), give or take an exact integer.
+    float r = (x - 0.5f) + 12582912.0f;
+    int n;
+    memcpy(&n, &r, 4);
+    n -= 0x4B400000;
+    float f = x - (r - 12582912.0f);
+    n = n > -126 ? n : -126;
+    n = n < 127 ? n : 127;
+
+    float p = 0.0018775767f;
+    p = p * f + 0.0089893401f;
+    p = p * f + 0.055826318f;
+    p = p * f + 0.24015362f;
+    p = p * f + 0.69315307f;
+    p = p * f + 0.99999993f;
+
+    int bits = (n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, 4);
+    return p * scale;
+}
+
+float lensFastLog2(float x)
+{
+    return FastLog2(x);
+}
+
+float lensFastExp2(float x)
+{
+    return FastExp2(x);
+}
+
+// r^power * (cos theta, sin theta) = v * r^(power-1) = v * (r^2)^((power-1)/2),
+// so the polar round trip reduces to a log2, a multiply and an exp2.
+// Powers of 2 and 0.5 don't need either.  The origin stays put because
+// the scale factor is always finite.
+void lensDistortFast(float* xy, int count, float power)
+{
+    if (power == 1.0f) {
+        return;
+    }
+
+    if (power == 2.0f) {
+        for (int i = 0; i < count; i++, xy += 2) {
+            float s = sqrtf(xy[0] * xy[0] + xy[1] * xy[1]);
+            xy[0] *= s;
+            xy[1] *= s;
+        }
+        return;
+    }
+
+    if (power == 0.5f) {
+        for (int i = 0; i < count; i++, xy += 2) {
+            float r2 = xy[0] * xy[0] + xy[1] * xy[1];
+            float s = r2 > 0 ? 1.0f / sqrtf(sqrtf(r2)) : 0;
+            xy[0] *= s;
+            xy[1] *= s;
+        }
+        return;
+    }
+
+    float k = 0.5f * (power - 1.0f);
+    for (int i = 0; i < count; i++, xy += 2) {
+        float r2 = xy[0] * xy[0] + xy[1] * xy[1];
+        float s = FastExp2(k * FastLog2(r2));
+        xy[0] *= s;
+        xy[1] *= s;
+    }
+}
+
+LensModel lensPowerModel(float power)
+{
+    LensModel model = {LENS_POWER, power, 0, 0, 0, 0, 0};
+    return model;
+}
+
+LensModel lensPolynomialModel(float k1, float k2, float k3)
+{
+    return lensBrownConradyModel(k1, k2, k3, 0, 0);
+}
+
+LensModel lensBrownConradyModel(float k1, float k2, float k3, float p1, float p2)
+{
+    LensModel model = {LENS_POLYNOMIAL, 1, k1, k2, k3, p1, p2};
+    return model;
+}
+
+int lensVariant(const LensModel* model)
+{
+    if (model->Type == LENS_POWER) {
+        return LENS_VARIANT_POWER;
+    }
+    if (model->P1 != 0 || model->P2 != 0) {
+        return LENS_VARIANT_TANGENTIAL;
+    }
+    return model->K2 == 0 && model->K3 == 0 ? LENS_VARIANT_K1 : LENS_VARIANT_RADIAL;
+}
+
+const char* lensShaderDefine(const LensModel* model)
+{
+    switch (lensVariant(model)) {
+        case LENS_VARIANT_K1: return "#define LENS_K1";
+        case LENS_VARIANT_RADIAL: return "#define LENS_RADIAL";
+        case LENS_VARIANT_TANGENTIAL: return "#define LENS_BROWN_CONRADY";
+    }
+    return "#define LENS_POWER";
+}
+
+LensChroma lensNoChroma()
+{
+    return lensChroma(1, 0, 1, 0);
+}
+
+LensChroma lensChroma(float redScale, float redRadial, float blueScale, float blueRadial)
+{
+    LensChroma chroma = {{redScale, 1, blueScale}, {redRadial, 0, blueRadial}};
+    return chroma;
+}
+
+void lensChromaShift(const LensChroma* chroma, int channel, float* xy, int count)
+{
+    float scale = chroma->Scale[channel], radial = chroma->Radial[channel];
+    if (scale == 1 && radial == 0) {
+        return;
+    }
+    for (int i = 0; i < count; i++, xy += 2) {
+        float s = scale + radial * (xy[0] * xy[0] + xy[1] * xy[1]);
+        xy[0] *= s;
+        xy[1] *= s;
+    }
+}
+
+static inline float Polynomial(const LensModel* model, float r)
+{
+    float r2 = r * r;
+    return r * (1 + r2 * (model->K1 + r2 * (model->K2 + r2 * model->K3)));
+}
+
+static inline float PolynomialSlope(const LensModel* model, float r)
+{
+    float r2 = r * r;
+    return 1 + r2 * (3 * model->K1 + r2 * (5 * model->K2 + r2 * 7 * model->K3));
+}
+
+// Nothing past this radius is ever looked at: it's well outside the corners
+// of the viewport, even after a strong pincushion.
+#define LENS_RADIUS_LIMIT 8.0f
+
+float lensMaxRadius(const LensModel* model)
+{
+    if (model->Type == LENS_POWER) {
+        return LENS_RADIUS_LIMIT;
+    }
+
+    // Step outward to the first sign change of the slope, then bisect.
+    const int steps = 1024;
+    float lo = 0;
+    for (int i = 1; i <= steps; i++) {
+        float hi = LENS_RADIUS_LIMIT * i / steps;
+        if (PolynomialSlope(model, hi) <= 0) {
+            for (int j = 0; j < 32; j++) {
+                float mid = 0.5f * (lo + hi);
+                if (PolynomialSlope(model, mid) > 0) lo = mid; else hi = mid;
+            }
+            return lo;
+        }
+        lo = hi;
+    }
+    return LENS_RADIUS_LIMIT;
+}
+
+// Stamps out a Brown-Conrady kernel with the given terms compiled in.  The
+// flags are constants, so the k1-only variant is a single multiply-add per
+// point, and none of them branch.
+#define LENS_POLYNOMIAL_KERNEL(Name, HasK2K3, HasTangential)                  \
+static void Name(const LensModel* model, float* xy, int count)               \
+{                                                                            \
+    float k1 = model->K1, k2 = model->K2, k3 = model->K3;                    \
+    float p1 = model->P1, p2 = model->P2;                                    \
+    for (int i = 0; i < count; i++, xy += 2) {                               \
+        float x = xy[0], y = xy[1];                                          \
+        float r2 = x * x + y * y;                                            \
+        float radial = HasK2K3 ?                                             \
+            1 + r2 * (k1 + r2 * (k2 + r2 * k3)) : 1 + r2 * k1;               \
+        xy[0] = x * radial;                                                  \
+        xy[1] = y * radial;                                                  \
+        if (HasTangential) {                                                 \
+            xy[0] += 2 * p1 * x * y + p2 * (r2 + 2 * x * x);                 \
+            xy[1] += p1 * (r2 + 2 * y * y) + 2 * p2 * x * y;                 \
+        }                                                                    \
+    }                                                                        \
+}
+
+LENS_POLYNOMIAL_KERNEL(DistortK1, 0, 0)
+LENS_POLYNOMIAL_KERNEL(DistortRadial, 1, 0)
+LENS_POLYNOMIAL_KERNEL(DistortBrownConrady, 1, 1)
+
+void lensDistort(const LensModel* model, float* xy, int count)
+{
+    switch (lensVariant(model)) {
+        case LENS_VARIANT_POWER: lensDistortReference(xy, count, model->Power); break;
+        case LENS_VARIANT_K1: DistortK1(model, xy, count); break;
+        case LENS_VARIANT_RADIAL: DistortRadial(model, xy, count); break;
+        case LENS_VARIANT_TANGENTIAL: DistortBrownConrady(model, xy, count); break;
+    }
+}
+
+float lensMagnification(const LensModel* model, float x, float y)
+{
+    const float h = 1e-2f;
+    float xy[] = {x + h, y, x - h, y, x, y + h, x, y - h};
+    lensDistort(model, xy, 4);
+    float a = (xy[0] - xy[2]) / (2 * h), b = (xy[4] - xy[6]) / (2 * h);
+    float c = (xy[1] - xy[3]) / (2 * h), d = (xy[5] - xy[7]) / (2 * h);
+    return sqrtf(fabsf(a * d - b * c));
+}
+
+#define LENS_CHUNK 64
+
+// Each radius keeps a bracket around the root.  Halley steps that leave it
+// fall back to bisection, which keeps flat stretches of the curve from
+// throwing the solve out of range.  Returns the largest residual seen
+// before the step.
+static inline float Step(float x, float g, float d1, float d2, float* lo, float* hi)
+{
+    float l = g < 0 ? x : *lo;
+    float h = g > 0 ? x : *hi;
+    float den = 2 * d1 * d1 - g * d2;
+    den = den != 0 ? den : 1;
+    float next = x - 2 * g * d1 / den;
+    bool inside = next >= l && next <= h;
+    *lo = l;
+    *hi = h;
+    return inside ? next : 0.5f * (l + h);
+}
+
+static float HalleyPower(float power, const float* target, float* r, float* lo, float* hi, int n)
+{
+    float worst = 0;
+    for (int i = 0; i < n; i++) {
+        float x = r[i] > 1e-30f ? r[i] : 1e-30f;
+        float f = FastExp2(power * FastLog2(x));
+        float g = f - target[i];
+        float d1 = power * f / x;
+        float d2 = (power - 1) * d1 / x;
+        r[i] = Step(x, g, d1, d2, lo + i, hi + i);
+        float e = fabsf(g);
+        worst = e > worst ? e : worst;
+    }
+    return worst;
+}
+
+static float HalleyPolynomial(const LensModel* model, const float* target, float* r,
+                              float* lo, float* hi, int n)
+{
+    float k1 = model->K1, k2 = model->K2, k3 = model->K3;
+    float worst = 0;
+    for (int i = 0; i < n; i++) {
+        float x = r[i], x2 = x * x;
+        float g = x * (1 + x2 * (k1 + x2 * (k2 + x2 * k3))) - target[i];
+        float d1 = 1 + x2 * (3 * k1 + x2 * (5 * k2 + x2 * 7 * k3));
+        float d2 = x * (6 * k1 + x2 * (20 * k2 + x2 * 42 * k3));
+        r[i] = Step(x, g, d1, d2, lo + i, hi + i);
+        float e = fabsf(g);
+        worst = e > worst ? e : worst;
+    }
+    return worst;
+}
+
+// Tangential terms are small, so evaluating them at the previous estimate
+// and solving the radial part again converges in a handful of passes.
+// Passes stop once the tangential offsets settle within tolerance.
+#define LENS_TANGENTIAL_PASSES 16
+
+int lensUndistort(const LensModel* model, float* xy, int count, float tolerance, int maxIterations)
+{
+    float rMax = lensMaxRadius(model);
+    float fMax = model->Type == LENS_POWER ? powf(rMax, model->Power) : Polynomial(model, rMax);
+    bool tangential = lensVariant(model) == LENS_VARIANT_TANGENTIAL;
+    int passes = tangential ? LENS_TANGENTIAL_PASSES : 1;
+    float target[LENS_CHUNK], r[LENS_CHUNK], lo[LENS_CHUNK], hi[LENS_CHUNK];
+    float distorted[2 * LENS_CHUNK], q[2 * LENS_CHUNK];
+    int failed = 0;
+
+    for (int start = 0; start < count; start += LENS_CHUNK) {
+        int n = count - start < LENS_CHUNK ? count - start : LENS_CHUNK;
+        float* p = xy + 2 * start;
+        memcpy(distorted, p, sizeof(float) * 2 * n);
+        memcpy(q, p, sizeof(float) * 2 * n);
+
+        bool settled = false;
+        for (int pass = 0; pass < passes && !settled; pass++) {
+
+            // q is what the radial curve alone has to produce.
+            if (pass > 0) {
+                float change = 0;
+                for (int i = 0; i < n; i++) {
+                    float x = p[2 * i], y = p[2 * i + 1], r2 = x * x + y * y;
+                    float qx = distorted[2 * i] - (2 * model->P1 * x * y + model->P2 * (r2 + 2 * x * x));
+                    float qy = distorted[2 * i + 1] - (model->P1 * (r2 + 2 * y * y) + 2 * model->P2 * x * y);
+                    float e = fabsf(qx - q[2 * i]) + fabsf(qy - q[2 * i + 1]);
+                    change = e > change ? e : change;
+                    q[2 * i] = qx;
+                    q[2 * i + 1] = qy;
+                }
+                settled = change <= tolerance;
+            }
+
+            for (int i = 0; i < n; i++) {
+                float rd = sqrtf(q[2 * i] * q[2 * i] + q[2 * i + 1] * q[2 * i + 1]);
+                target[i] = rd < fMax ? rd : fMax;
+                lo[i] = 0;
+                hi[i] = rMax;
+            }
+
+            // Start from the exact inverse for powers, and from the identity
+            // for polynomials, which are close to it near the center.  Later
+            // passes start from the previous solution.
+            if (pass > 0) {
+                // r is already within [0, rMax].
+            } else if (model->Type == LENS_POWER) {
+                float inverse = 1.0f / model->Power;
+                for (int i = 0; i < n; i++) {
+                    r[i] = FastExp2(inverse * FastLog2(target[i]));
+                }
+            } else {
+                for (int i = 0; i < n; i++) {
+                    r[i] = target[i] < rMax ? target[i] : rMax;
+                }
+            }
+
+            // The residual is measured before each step, so the loop ends one
+            // step after every point is within tolerance.
+            float residual = tolerance + 1;
+            for (int k = 0; k < maxIterations && residual > tolerance; k++) {
+                residual = model->Type == LENS_POWER ?
+                    HalleyPower(model->Power, target, r, lo, hi, n) :
+                    HalleyPolynomial(model, target, r, lo, hi, n);
+            }
+
+            for (int i = 0; i < n; i++) {
+                float rd = sqrtf(q[2 * i] * q[2 * i] + q[2 * i + 1] * q[2 * i + 1]);
+                float s = r[i] / (rd > 0 ? rd : 1);
+                p[2 * i] = q[2 * i] * s;
+                p[2 * i + 1] = q[2 * i + 1] * s;
+            }
+        }
+
+        // Points past the invertible range were clamped, so they fail too.
+        if (tangential) {
+            memcpy(q, p, sizeof(float) * 2 * n);
+            DistortBrownConrady(model, q, n);
+            for (int i = 0; i < n; i++) {
+                float dx = q[2 * i] - distorted[2 * i], dy = q[2 * i + 1] - distorted[2 * i + 1];
+                failed += sqrtf(dx * dx + dy * dy) > tolerance;
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                float rd = sqrtf(q[2 * i] * q[2 * i] + q[2 * i + 1] * q[2 * i + 1]);
+                float f = model->Type == LENS_POWER ?
+                    FastExp2(model->Power * FastLog2(r[i])) : Polynomial(model, r[i]);
+                failed += fabsf(f - rd) > tolerance;
+            }
+        }
+    }
+    return failed;
+}
+
+// Both solvers below look at the lens through a grid of screen points:
+// where each lands in the source, and how many screen pixels a unit of
+// source covers there along each source axis, from the Jacobian of
+// lensDistort by central differences.  Only points that land inside the
+// source count.
+#define LENS_SAMPLES 128
+
+// Relative rounding error of the Jacobian, forgiven so that a lens that
+// doesn't magnify needs exactly the screen.
+#define LENS_JACOBIAN_SLACK 1e-4f
+
+typedef struct FootprintRec {
+    float Q[2];                 // source point, in normalized device coordinates
+    float Pixels[2];            // screen pixels per unit of source along x and y
+    float Step[2];              // how far the source point moves over half a sample
+} Footprint;
+
+static int Footprints(const LensModel* model, int width, int height, Footprint* footprints)
+{
+    const int n = LENS_SAMPLES;
+    const float h = 1e-2f;
+    float* xy = (float*) malloc(sizeof(float) * 10 * n * n);
+    if (!xy) {
+        return -1;
+    }
+
+    // Each sample and its four neighbors.
+    const float dx[] = {0, h, -h, 0, 0}, dy[] = {0, 0, 0, h, -h};
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            float* p = xy + 10 * (j * n + i);
+            for (int k = 0; k < 5; k++) {
+                p[2 * k] = (i + 0.5f) * 2.0f / n - 1.0f + dx[k];
+                p[2 * k + 1] = (j + 0.5f) * 2.0f / n - 1.0f + dy[k];
+            }
+        }
+    }
+    lensDistort(model, xy, 5 * n * n);
+
+    int count = 0;
+    for (int s = 0; s < n * n; s++) {
+        const float* q = xy + 10 * s;
+        if (fabsf(q[0]) > 1 || fabsf(q[1]) > 1) {
+            continue;
+        }
+
+        // Source per screen, inverted, then scaled to pixels.  A singular
+        // Jacobian, like the center of the barrel power, magnifies without
+        // bound.
+        float a = (q[2] - q[4]) / (2 * h), b = (q[6] - q[8]) / (2 * h);
+        float c = (q[3] - q[5]) / (2 * h), d = (q[7] - q[9]) / (2 * h);
+        float det = a * d - b * c;
+        Footprint* f = footprints + count++;
+        f->Q[0] = q[0];
+        f->Q[1] = q[1];
+        for (int axis = 0; axis < 2; axis++) {
+            f->Pixels[axis] = HUGE_VALF;
+            if (det != 0) {
+                float ex = 0.5f * width * (axis == 0 ? d : -b) / det;
+                float ey = 0.5f * height * (axis == 0 ? -c : a) / det;
+                f->Pixels[axis] = sqrtf(ex * ex + ey * ey);
+            }
+        }
+        f->Step[0] = (fabsf(a) + fabsf(b)) / n;
+        f->Step[1] = (fabsf(c) + fabsf(d)) / n;
+    }
+    free(xy);
+    return count;
+}
+
+LensTarget lensSolveTarget(const LensModel* model, int width, int height, float maxScale)
+{
+    LensTarget target = {width, height, {1, 1}, 1};
+    Footprint* footprints = (Footprint*) malloc(sizeof(Footprint) * LENS_SAMPLES * LENS_SAMPLES);
+    int count = footprints ? Footprints(model, width, height, footprints) : -1;
+    if (count <= 0) {
+        free(footprints);
+        return target;
+    }
+
+    // The field of view only needs to reach the farthest source point on
+    // screen, give or take half a sample.
+    float extent[2] = {0, 0};
+    for (int i = 0; i < count; i++) {
+        for (int axis = 0; axis < 2; axis++) {
+            float reach = fabsf(footprints[i].Q[axis]) + footprints[i].Step[axis];
+            extent[axis] = reach > extent[axis] ? reach : extent[axis];
+        }
+    }
+
+    // Then the densest footprint sets the resolution, up to the cap.
+    int size[2] = {width, height};
+    float density[2] = {0, 0};
+    for (int axis = 0; axis < 2; axis++) {
+        target.Extent[axis] = extent[axis] < 1 ? extent[axis] : 1;
+        for (int i = 0; i < count; i++) {
+            float pixels = footprints[i].Pixels[axis];
+            density[axis] = pixels > density[axis] ? pixels : density[axis];
+        }
+        float texels = ceilf(2 * target.Extent[axis] * density[axis] * (1 - LENS_JACOBIAN_SLACK));
+        float cap = ceilf(maxScale * size[axis]);
+        size[axis] = (int) (texels < cap ? texels : cap);
+    }
+    target.Width = size[0];
+    target.Height = size[1];
+
+    // The capped resolution leaves the most magnified points under 1:1.
+    int covered = 0;
+    for (int i = 0; i < count; i++) {
+        float x = footprints[i].Pixels[0] * 2 * target.Extent[0] * (1 - LENS_JACOBIAN_SLACK);
+        float y = footprints[i].Pixels[1] * 2 * target.Extent[1] * (1 - LENS_JACOBIAN_SLACK);
+        covered += x <= target.Width && y <= target.Height;
+    }
+    target.Coverage = (float) covered / count;
+    free(footprints);
+    return target;
+}
+
+// Screen pixels per target texel along each source axis, binned by the
+// distance of the source point from the center line.  A band starting at
+// bin b must keep the densest of bins b and beyond.
+#define LENS_MULTIRES_BINS 64
+
+LensMultiRes lensMultiRes(const LensModel* model, int width, int height, const LensTarget* target)
+{
+    LensMultiRes layout = {{1, 1}, {1, 1}};
+    Footprint* footprints = (Footprint*) malloc(sizeof(Footprint) * LENS_SAMPLES * LENS_SAMPLES);
+    int count = footprints ? Footprints(model, width, height, footprints) : -1;
+    if (count <= 0) {
+        free(footprints);
+        return layout;
+    }
+
+    float density[2][LENS_MULTIRES_BINS] = {{0}};
+    int size[2] = {target->Width, target->Height};
+    for (int i = 0; i < count; i++) {
+        for (int axis = 0; axis < 2; axis++) {
+            float extent = target->Extent[axis];
+            float need = footprints[i].Pixels[axis] * 2 * extent / size[axis];
+            int bin = (int) (fabsf(footprints[i].Q[axis]) / extent * LENS_MULTIRES_BINS);
+            bin = bin < LENS_MULTIRES_BINS ? bin : LENS_MULTIRES_BINS - 1;
+            float capped = need < 1 ? need : 1;
+            density[axis][bin] = capped > density[axis][bin] ? capped : density[axis][bin];
+        }
+    }
+    free(footprints);
+
+    // The split that leaves the fewest texels along each axis.
+    for (int axis = 0; axis < 2; axis++) {
+        float scale = 0, best = 1;
+        for (int bin = LENS_MULTIRES_BINS - 1; bin >= 0; bin--) {
+            scale = density[axis][bin] > scale ? density[axis][bin] : scale;
+            float center = (float) bin / LENS_MULTIRES_BINS;
+            float fraction = center + (1 - center) * scale;
+            if (fraction < best) {
+                best = fraction;
+                layout.Center[axis] = center;
+                layout.Scale[axis] = scale;
+            }
+        }
+    }
+    return layout;
+}
+
+float lensMultiResFraction(const LensMultiRes* layout, int axis)
+{
+    return layout->Center[axis] + (1 - layout->Center[axis]) * layout->Scale[axis];
+}
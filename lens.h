@@ -0,0 +1,115 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Radial distortion on the CPU.  The reference kernel is the polar round
+// trip done by Distort() in VertexWarping.glsl and TessWarping.glsl; the
+// fast kernel scales each point by radius^(power-1) instead.
+// Points are interleaved (x, y) pairs in normalized device coordinates.
+
+void lensDistortReference(float* xy, int count, float power);
+void lensDistortFast(float* xy, int count, float power);
+
+float lensFastLog2(float x);
+float lensFastExp2(float x);
+
+// Lens models.  The power model covers all of the demos; the polynomial
+// one is Brown-Conrady, as produced by the usual camera calibration tools:
+// a radial barrel (K1 < 0) or pincushion (K1 > 0) curve mapping an
+// undistorted radius r to a distorted one, plus optional tangential terms
+// for decentered lenses.
+enum { LENS_POWER, LENS_POLYNOMIAL };
+
+typedef struct LensModelRec {
+    int Type;
+    float Power;                // LENS_POWER: r^Power
+    float K1, K2, K3;           // LENS_POLYNOMIAL: r (1 + K1 r^2 + K2 r^4 + K3 r^6)
+    float P1, P2;               // LENS_POLYNOMIAL: tangential terms
+} LensModel;
+
+LensModel lensPowerModel(float power);
+LensModel lensPolynomialModel(float k1, float k2, float k3);
+LensModel lensBrownConradyModel(float k1, float k2, float k3, float p1, float p2);
+
+// The cheapest kernel that evaluates a model exactly.  Each variant is
+// compiled separately, on the CPU and in the demo shaders, so that terms
+// which are zero cost nothing.
+enum {
+    LENS_VARIANT_POWER,
+    LENS_VARIANT_K1,            // K2 = K3 = P1 = P2 = 0
+    LENS_VARIANT_RADIAL,        // P1 = P2 = 0
+    LENS_VARIANT_TANGENTIAL,
+};
+
+int lensVariant(const LensModel* model);
+
+// Shader directive for pezSwAddDirective that selects the variant of
+// Distort() matching the model, e.g. "#define LENS_K1".
+const char* lensShaderDefine(const LensModel* model);
+
+// Lateral chromatic aberration.  Each color channel samples the distorted
+// point scaled by Scale + Radial * r^2, where r is the distorted radius.
+// Green is the reference, so only red and blue usually differ from 1 and 0.
+typedef struct LensChromaRec {
+    float Scale[3];
+    float Radial[3];
+} LensChroma;
+
+LensChroma lensNoChroma();
+LensChroma lensChroma(float redScale, float redRadial, float blueScale, float blueRadial);
+void lensChromaShift(const LensChroma* chroma, int channel, float* xy, int count);
+
+// Largest radius up to which the model is monotonic, and so invertible.
+float lensMaxRadius(const LensModel* model);
+
+void lensDistort(const LensModel* model, float* xy, int count);
+
+// How much lensDistort scales lengths around (x, y): the square root of
+// its Jacobian determinant by central differences, so a linear scale, the
+// geometric mean of the two axes'.  Above 1 where the lens magnifies,
+// below 1 where it compresses.
+float lensMagnification(const LensModel* model, float x, float y);
+
+// Inverts the model with Halley's method until the distorted radius is
+// matched to within tolerance, in normalized device units.  Tolerances
+// below about 1e-6 are lost in float precision.  Points beyond the
+// invertible range are clamped to it.  Tangential terms are peeled off by
+// fixed-point iteration around the radial solve.  Returns the number of
+// points that didn't converge.
+int lensUndistort(const LensModel* model, float* xy, int count, float tolerance, int maxIterations);
+
+// The render target that the warp needs for a width by height screen: the
+// field of view only reaches as far into the source as the lens shows, as
+// Extent, and the resolution is the least that samples the source at 1:1
+// or better everywhere on screen, but at most maxScale times the screen.
+// Lenses that magnify without bound, like the barrel power at its center,
+// hit the cap; Coverage is the part of the screen still at 1:1 or better.
+typedef struct LensTargetRec {
+    int Width;
+    int Height;
+    float Extent[2];            // half-size of the source shown, in normalized device coordinates
+    float Coverage;
+} LensTarget;
+
+LensTarget lensSolveTarget(const LensModel* model, int width, int height, float maxScale);
+
+// Multi-resolution render targets.  The scene is rendered in a 3 x 3 grid
+// of viewports: the center keeps full density, and the bands outside
+// Center along each axis are squeezed to Scale texels per pixel.  The
+// layout is the smallest one in which every texel of the target that the
+// lens shows is sampled at least as densely as the screen shows it, in
+// pixels per texel up to 1.  It then only uses lensMultiResFraction of the
+// target's width and height.
+typedef struct LensMultiResRec {
+    float Center[2];            // half-size of the full-density region, in the target's normalized device coordinates
+    float Scale[2];             // density of the bands around it
+} LensMultiRes;
+
+LensMultiRes lensMultiRes(const LensModel* model, int width, int height, const LensTarget* target);
+float lensMultiResFraction(const LensMultiRes* layout, int axis);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,789 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mesh.h"
+
+// Each cell's error is measured on a regular grid of this many points per
+// side, corners included.
+#define MESH_SAMPLES 5
+
+// Cells that the edge of the source image crosses count their error this
+// many times over.  There an error moves the edge itself, and the pixels
+// it sweeps flip between the image and the background, which shows far
+// more than the same shift inside the image.
+#define MESH_EDGE_WEIGHT 2
+
+typedef struct CellRec {
+    int X;                      // lower left corner, in lattice units
+    int Y;
+    int Depth;
+    float Error;
+} Cell;
+
+typedef struct BuilderRec {
+    const LensModel* Model;
+    int Lattice;                // cells per root side at the deepest level
+    int Columns;                // lattice points across and down
+    int Rows;
+    float ScaleX;               // NDC to source texels
+    float ScaleY;
+    Cell* Cells;
+    int CellCount;
+    int CellCapacity;
+    int* Heap;                  // cell indices, worst error on top
+    int HeapCount;
+} Builder;
+
+static int CellSize(const Builder* b, const Cell* cell)
+{
+    return b->Lattice >> cell->Depth;
+}
+
+static float LatticeToNdcX(const Builder* b, float i)
+{
+    return i * 2.0f / (b->Columns - 1) - 1.0f;
+}
+
+static float LatticeToNdcY(const Builder* b, float j)
+{
+    return j * 2.0f / (b->Rows - 1) - 1.0f;
+}
+
+static int Inside(const float* st)
+{
+    return fabsf(st[0]) <= 1 && fabsf(st[1]) <= 1;
+}
+
+// Compares the exact mapping against the two triangles that the cell is
+// drawn with, split along the diagonal from its lower left corner.  Points
+// count when either mapping lands inside the source image.
+static float CellError(const Builder* b, const Cell* cell)
+{
+    const int n = MESH_SAMPLES;
+    float x0 = LatticeToNdcX(b, cell->X), x1 = LatticeToNdcX(b, cell->X + CellSize(b, cell));
+    float y0 = LatticeToNdcY(b, cell->Y), y1 = LatticeToNdcY(b, cell->Y + CellSize(b, cell));
+    float exact[2 * MESH_SAMPLES * MESH_SAMPLES];
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            float* p = exact + 2 * (j * n + i);
+            p[0] = x0 + (x1 - x0) * i / (n - 1);
+            p[1] = y0 + (y1 - y0) * j / (n - 1);
+        }
+    }
+    lensDistort(b->Model, exact, n * n);
+
+    const float* c00 = exact;
+    const float* c10 = exact + 2 * (n - 1);
+    const float* c01 = exact + 2 * (n - 1) * n;
+    const float* c11 = exact + 2 * (n * n - 1);
+    float worst = 0;
+    int inside = 0, crossed = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            const float* p = exact + 2 * (j * n + i);
+            float s = (float) i / (n - 1), t = (float) j / (n - 1);
+            float lerp[2];
+            for (int k = 0; k < 2; k++) {
+                lerp[k] = s >= t ?
+                    c00[k] + s * (c10[k] - c00[k]) + t * (c11[k] - c10[k]) :
+                    c00[k] + t * (c01[k] - c00[k]) + s * (c11[k] - c01[k]);
+            }
+            inside += Inside(p);
+            crossed |= Inside(p) != Inside(lerp);
+            if (!Inside(p) && !Inside(lerp)) {
+                continue;
+            }
+            float dx = (lerp[0] - p[0]) * b->ScaleX;
+            float dy = (lerp[1] - p[1]) * b->ScaleY;
+            worst = fmaxf(worst, sqrtf(dx * dx + dy * dy));
+        }
+    }
+    if (crossed || (inside > 0 && inside < n * n)) {
+        worst *= MESH_EDGE_WEIGHT;
+    }
+    return worst;
+}
+
+static void HeapPush(Builder* b, int cell)
+{
+    int i = b->HeapCount++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (b->Cells[b->Heap[parent]].Error >= b->Cells[cell].Error) {
+            break;
+        }
+        b->Heap[i] = b->Heap[parent];
+        i = parent;
+    }
+    b->Heap[i] = cell;
+}
+
+static int HeapPop(Builder* b)
+{
+    int top = b->Heap[0];
+    int last = b->Heap[--b->HeapCount];
+    float error = b->Cells[last].Error;
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= b->HeapCount) {
+            break;
+        }
+        if (child + 1 < b->HeapCount &&
+            b->Cells[b->Heap[child + 1]].Error > b->Cells[b->Heap[child]].Error) {
+            child++;
+        }
+        if (b->Cells[b->Heap[child]].Error <= error) {
+            break;
+        }
+        b->Heap[i] = b->Heap[child];
+        i = child;
+    }
+    b->Heap[i] = last;
+    return top;
+}
+
+// Replaces a leaf with its four children.  The first child reuses the
+// parent's slot, so the cell array only ever holds leaves.
+static int SplitCell(Builder* b, int index)
+{
+    if (b->CellCount + 3 > b->CellCapacity) {
+        int capacity = 2 * b->CellCapacity;
+        Cell* cells = (Cell*) realloc(b->Cells, sizeof(Cell) * capacity);
+        int* heap = (int*) realloc(b->Heap, sizeof(int) * capacity);
+        if (cells) {
+            b->Cells = cells;
+        }
+        if (heap) {
+            b->Heap = heap;
+        }
+        if (!cells || !heap) {
+            return 0;
+        }
+        b->CellCapacity = capacity;
+    }
+
+    Cell parent = b->Cells[index];
+    int half = CellSize(b, &parent) / 2;
+    const int slots[4] = {index, b->CellCount, b->CellCount + 1, b->CellCount + 2};
+    b->CellCount += 3;
+    for (int k = 0; k < 4; k++) {
+        Cell* child = b->Cells + slots[k];
+        child->X = parent.X + (k & 1) * half;
+        child->Y = parent.Y + (k >> 1) * half;
+        child->Depth = parent.Depth + 1;
+        child->Error = CellError(b, child);
+        HeapPush(b, slots[k]);
+    }
+    return 1;
+}
+
+// Lattice points on the boundary of a cell that are corners of some leaf,
+// counter-clockwise from its lower left corner.
+static int CellBoundary(const Builder* b, const Cell* cell, const int* ids, int* boundary)
+{
+    int size = CellSize(b, cell), stride = b->Columns, n = 0;
+    int x = cell->X, y = cell->Y;
+    for (int side = 0; side < 4; side++) {
+        for (int k = 0; k < size; k++) {
+            int i, j;
+            switch (side) {
+            case 0: i = x + k; j = y; break;
+            case 1: i = x + size; j = y + k; break;
+            case 2: i = x + size - k; j = y + size; break;
+            default: i = x; j = y + size - k; break;
+            }
+            int id = ids[j * stride + i];
+            if (id >= 0) {
+                boundary[n++] = id;
+            }
+        }
+    }
+    return n;
+}
+
+static MeshGrid* Triangulate(const Builder* b)
+{
+    int stride = b->Columns, points = b->Columns * b->Rows;
+    MeshGrid* mesh = (MeshGrid*) calloc(1, sizeof(MeshGrid));
+    int* ids = (int*) malloc(sizeof(int) * points);
+    int* boundary = (int*) malloc(sizeof(int) * 4 * b->Lattice);
+    if (!mesh || !ids || !boundary) {
+        free(mesh);
+        free(ids);
+        free(boundary);
+        return 0;
+    }
+
+    // Number the lattice points that are leaf corners.
+    for (int i = 0; i < points; i++) {
+        ids[i] = -1;
+    }
+    for (int c = 0; c < b->CellCount; c++) {
+        const Cell* cell = b->Cells + c;
+        int size = CellSize(b, cell);
+        ids[cell->Y * stride + cell->X] = 0;
+        ids[cell->Y * stride + cell->X + size] = 0;
+        ids[(cell->Y + size) * stride + cell->X] = 0;
+        ids[(cell->Y + size) * stride + cell->X + size] = 0;
+    }
+    int latticeCount = 0;
+    for (int i = 0; i < points; i++) {
+        if (ids[i] == 0) {
+            ids[i] = latticeCount++;
+        }
+    }
+
+    // Plain cells take two triangles; fanned ones a center vertex and one
+    // triangle per boundary point.
+    int centers = 0;
+    for (int c = 0; c < b->CellCount; c++) {
+        int n = CellBoundary(b, b->Cells + c, ids, boundary);
+        centers += n > 4;
+        mesh->TriangleCount += n > 4 ? n : 2;
+    }
+
+    mesh->VertexCount = latticeCount + centers;
+    mesh->LeafCount = b->CellCount;
+    mesh->Positions = (float*) malloc(sizeof(float) * 2 * mesh->VertexCount);
+    mesh->TexCoords = (float*) malloc(sizeof(float) * 2 * mesh->VertexCount);
+    mesh->Indices = (unsigned int*) malloc(sizeof(unsigned int) * 3 * mesh->TriangleCount);
+    if (!mesh->Positions || !mesh->TexCoords || !mesh->Indices) {
+        meshDestroy(mesh);
+        free(ids);
+        free(boundary);
+        return 0;
+    }
+
+    for (int j = 0; j < b->Rows; j++) {
+        for (int i = 0; i < stride; i++) {
+            int id = ids[j * stride + i];
+            if (id >= 0) {
+                mesh->Positions[2 * id] = LatticeToNdcX(b, i);
+                mesh->Positions[2 * id + 1] = LatticeToNdcY(b, j);
+            }
+        }
+    }
+
+    unsigned int* index = mesh->Indices;
+    int center = latticeCount;
+    for (int c = 0; c < b->CellCount; c++) {
+        const Cell* cell = b->Cells + c;
+        int n = CellBoundary(b, cell, ids, boundary);
+        mesh->Depth = cell->Depth > mesh->Depth ? cell->Depth : mesh->Depth;
+        mesh->MaxError = fmaxf(mesh->MaxError, cell->Error);
+        if (n == 4) {
+            *index++ = boundary[0];
+            *index++ = boundary[1];
+            *index++ = boundary[2];
+            *index++ = boundary[0];
+            *index++ = boundary[2];
+            *index++ = boundary[3];
+            continue;
+        }
+        float half = CellSize(b, cell) * 0.5f;
+        mesh->Positions[2 * center] = LatticeToNdcX(b, cell->X + half);
+        mesh->Positions[2 * center + 1] = LatticeToNdcY(b, cell->Y + half);
+        for (int k = 0; k < n; k++) {
+            *index++ = center;
+            *index++ = boundary[k];
+            *index++ = boundary[(k + 1) % n];
+        }
+        center++;
+    }
+
+    memcpy(mesh->TexCoords, mesh->Positions, sizeof(float) * 2 * mesh->VertexCount);
+    lensDistort(b->Model, mesh->TexCoords, mesh->VertexCount);
+
+    free(ids);
+    free(boundary);
+    return mesh;
+}
+
+MeshGrid* meshCreateAdaptive(const LensModel* model, float maxError, int maxTriangles, int maxDepth,
+                             int srcWidth, int srcHeight)
+{
+    if (maxDepth < 0 || maxDepth > MESH_MAX_DEPTH || srcWidth < 1 || srcHeight < 1) {
+        return 0;
+    }
+
+    // Start from a row or column of square roots, so that cells are close
+    // to square in pixels rather than stretched with the screen.
+    int across = srcWidth >= srcHeight ? (srcWidth + srcHeight / 2) / srcHeight : 1;
+    int down = srcHeight > srcWidth ? (srcHeight + srcWidth / 2) / srcWidth : 1;
+
+    Builder b;
+    b.Model = model;
+    b.Lattice = 1 << maxDepth;
+    b.Columns = across * b.Lattice + 1;
+    b.Rows = down * b.Lattice + 1;
+    b.ScaleX = 0.5f * srcWidth;
+    b.ScaleY = 0.5f * srcHeight;
+    b.CellCapacity = 256 + across * down;
+    b.CellCount = across * down;
+    b.HeapCount = 0;
+    b.Cells = (Cell*) malloc(sizeof(Cell) * b.CellCapacity);
+    b.Heap = (int*) malloc(sizeof(int) * b.CellCapacity);
+    if (!b.Cells || !b.Heap) {
+        free(b.Cells);
+        free(b.Heap);
+        return 0;
+    }
+
+    for (int c = 0; c < b.CellCount; c++) {
+        b.Cells[c].X = (c % across) * b.Lattice;
+        b.Cells[c].Y = (c / across) * b.Lattice;
+        b.Cells[c].Depth = 0;
+        b.Cells[c].Error = CellError(&b, b.Cells + c);
+        HeapPush(&b, c);
+    }
+
+    // Worst leaf first, so a triangle budget is spent where it helps most.
+    int ok = 1;
+    while (ok && b.HeapCount > 0) {
+        int worst = b.Heap[0];
+        if (b.Cells[worst].Error <= maxError) {
+            break;
+        }
+        if (maxTriangles > 0 && 2 * (b.CellCount + 3) > maxTriangles) {
+            break;
+        }
+        HeapPop(&b);
+        if (b.Cells[worst].Depth < maxDepth) {
+            ok = SplitCell(&b, worst);
+        }
+    }
+
+    MeshGrid* mesh = ok ? Triangulate(&b) : 0;
+    free(b.Cells);
+    free(b.Heap);
+    return mesh;
+}
+
+void meshDestroy(MeshGrid* mesh)
+{
+    if (mesh) {
+        free(mesh->Positions);
+        free(mesh->TexCoords);
+        free(mesh->Indices);
+        free(mesh);
+    }
+}
+
+// Samples of the lens along and across the axis when placing edges.
+#define MESH_EDGE_SAMPLES 512
+#define MESH_EDGE_ACROSS 33
+
+// A cell drawn with one linear projection is off from the lens by about
+// h^2 |f''| / 8 across its width h, so the edges are placed to keep
+// h sqrt|f''| even.  A floor on the density keeps the flat parts of the
+// lens from ending up in a few huge cells.
+int meshLensEdges(const LensModel* model, int axis, int cells, int pixels,
+                  int srcWidth, int srcHeight, float* edges)
+{
+    if (cells < 1 || (pixels > 0 && cells > pixels) || srcWidth < 1 || srcHeight < 1) {
+        return 0;
+    }
+
+    const int n = MESH_EDGE_SAMPLES, m = MESH_EDGE_ACROSS;
+    const float h = 2.0f / n;
+    float* density = (float*) malloc(sizeof(float) * (n + 1));
+    float* xy = (float*) malloc(sizeof(float) * 6 * m);
+    if (!density || !xy) {
+        free(density);
+        free(xy);
+        return 0;
+    }
+
+    // Worst curvature across the screen at each sample, counting only the
+    // points that show some of the source.
+    float peak = 0;
+    for (int i = 0; i <= n; i++) {
+        float along = i * h - 1.0f;
+        for (int j = 0; j < m; j++) {
+            float across = j * 2.0f / (m - 1) - 1.0f;
+            for (int k = 0; k < 3; k++) {
+                xy[6 * j + 2 * k + axis] = along + (k - 1) * h;
+                xy[6 * j + 2 * k + 1 - axis] = across;
+            }
+        }
+        lensDistort(model, xy, 3 * m);
+
+        float curvature = 0;
+        for (int j = 0; j < m; j++) {
+            const float* f = xy + 6 * j;
+            if (fabsf(f[2]) > 1 || fabsf(f[3]) > 1) {
+                continue;
+            }
+            float dx = 0.5f * srcWidth * (f[0] - 2 * f[2] + f[4]) / (h * h);
+            float dy = 0.5f * srcHeight * (f[1] - 2 * f[3] + f[5]) / (h * h);
+            curvature = fmaxf(curvature, sqrtf(dx * dx + dy * dy));
+        }
+        density[i] = sqrtf(curvature);
+        peak = fmaxf(peak, density[i]);
+    }
+
+    // Equal shares of the integrated density, by the trapezoid rule.
+    float minimum = peak > 0 ? 0.2f * peak : 1.0f;
+    float total = 0;
+    for (int i = 0; i <= n; i++) {
+        density[i] += minimum;
+    }
+    for (int i = 0; i < n; i++) {
+        total += 0.5f * (density[i] + density[i + 1]) * h;
+    }
+    edges[0] = -1;
+    float sum = 0;
+    int i = 0;
+    for (int k = 1; k < cells; k++) {
+        float target = total * k / cells;
+        float step = 0.5f * (density[i] + density[i + 1]) * h;
+        while (i < n - 1 && sum + step < target) {
+            sum += step;
+            i++;
+            step = 0.5f * (density[i] + density[i + 1]) * h;
+        }
+        edges[k] = i * h - 1.0f + h * fminf(1, (target - sum) / step);
+    }
+    edges[cells] = 1;
+    free(density);
+    free(xy);
+
+    // Whole pixels, at least one per cell.
+    if (pixels > 0) {
+        int previous = 0;
+        for (int k = 1; k < cells; k++) {
+            int pixel = (int) floorf((edges[k] + 1.0f) * 0.5f * pixels + 0.5f);
+            pixel = pixel > previous ? pixel : previous + 1;
+            pixel = pixel < pixels - (cells - k) ? pixel : pixels - (cells - k);
+            edges[k] = pixel * 2.0f / pixels - 1.0f;
+            previous = pixel;
+        }
+    }
+    return 1;
+}
+
+MeshIndices* meshCreateIndices(int vertexCount, int capacity)
+{
+    MeshIndices* indices = (MeshIndices*) calloc(1, sizeof(MeshIndices));
+    if (!indices) {
+        return 0;
+    }
+    indices->Size = vertexCount <= 0xFFFF ? 2 : 4;
+    indices->Restart = vertexCount <= 0xFFFF ? 0xFFFF : 0xFFFFFFFF;
+    indices->Capacity = capacity;
+    indices->Data = malloc((size_t) indices->Size * capacity);
+    if (!indices->Data) {
+        free(indices);
+        return 0;
+    }
+    return indices;
+}
+
+void meshDestroyIndices(MeshIndices* indices)
+{
+    if (indices) {
+        free(indices->Data);
+        free(indices);
+    }
+}
+
+void meshPushIndex(MeshIndices* indices, unsigned int index)
+{
+    if (indices->Count == indices->Capacity) {
+        return;
+    }
+    if (indices->Size == 2) {
+        ((unsigned short*) indices->Data)[indices->Count++] = (unsigned short) index;
+    } else {
+        ((unsigned int*) indices->Data)[indices->Count++] = index;
+    }
+}
+
+void meshPushRestart(MeshIndices* indices)
+{
+    meshPushIndex(indices, indices->Restart);
+}
+
+MeshIndices* meshLatticeTriangles(int rows, int columns)
+{
+    int vps = rows + 1;
+    MeshIndices* indices = meshCreateIndices(vps * (columns + 1), 6 * rows * columns);
+    if (!indices) {
+        return 0;
+    }
+    for (int i = 0; i < columns; i++) {
+        int n = i * vps;
+        for (int j = 0; j < rows; j++) {
+            meshPushIndex(indices, n + j + vps);
+            meshPushIndex(indices, n + j + 1);
+            meshPushIndex(indices, n + j);
+            meshPushIndex(indices, n + j + 1 + vps);
+            meshPushIndex(indices, n + j + 1);
+            meshPushIndex(indices, n + j + vps);
+        }
+    }
+    return indices;
+}
+
+// One strip per column, zig-zagging between its two runs of vertices.
+MeshIndices* meshLatticeStrips(int rows, int columns)
+{
+    int vps = rows + 1;
+    MeshIndices* indices = meshCreateIndices(vps * (columns + 1), (2 * vps + 1) * columns);
+    if (!indices) {
+        return 0;
+    }
+    for (int i = 0; i < columns; i++) {
+        int n = i * vps;
+        if (i > 0) {
+            meshPushRestart(indices);
+        }
+        for (int j = 0; j < vps; j++) {
+            meshPushIndex(indices, n + j);
+            meshPushIndex(indices, n + j + vps);
+        }
+    }
+    return indices;
+}
+
+MeshIndices* meshLatticeLines(int rows, int columns)
+{
+    int vps = rows + 1;
+    int count = (columns + 1) * (vps + 1) + vps * (columns + 2);
+    MeshIndices* indices = meshCreateIndices(vps * (columns + 1), count);
+    if (!indices) {
+        return 0;
+    }
+    for (int i = 0; i <= columns; i++) {
+        for (int j = 0; j < vps; j++) {
+            meshPushIndex(indices, i * vps + j);
+        }
+        meshPushRestart(indices);
+    }
+    for (int j = 0; j < vps; j++) {
+        for (int i = 0; i <= columns; i++) {
+            meshPushIndex(indices, i * vps + j);
+        }
+        meshPushRestart(indices);
+    }
+    return indices;
+}
+
+// The same lines as meshLatticeLines, one pair of indices per segment.
+MeshIndices* meshLatticeSegments(int rows, int columns)
+{
+    int vps = rows + 1;
+    int count = 2 * ((columns + 1) * rows + vps * columns);
+    MeshIndices* indices = meshCreateIndices(vps * (columns + 1), count);
+    if (!indices) {
+        return 0;
+    }
+    for (int i = 0; i <= columns; i++) {
+        for (int j = 0; j < rows; j++) {
+            meshPushIndex(indices, i * vps + j);
+            meshPushIndex(indices, i * vps + j + 1);
+        }
+    }
+    for (int j = 0; j < vps; j++) {
+        for (int i = 0; i < columns; i++) {
+            meshPushIndex(indices, i * vps + j);
+            meshPushIndex(indices, (i + 1) * vps + j);
+        }
+    }
+    return indices;
+}
+
+static unsigned int IndexAt(const MeshIndices* indices, int i)
+{
+    return indices->Size == 2 ?
+        ((const unsigned short*) indices->Data)[i] : ((const unsigned int*) indices->Data)[i];
+}
+
+static void SetIndex(MeshIndices* indices, int i, unsigned int index)
+{
+    if (indices->Size == 2) {
+        ((unsigned short*) indices->Data)[i] = (unsigned short) index;
+    } else {
+        ((unsigned int*) indices->Data)[i] = index;
+    }
+}
+
+// Tipsify's fallbacks when the current fan runs dry: the most recently
+// emitted vertex that still has triangles left, or else the next such
+// vertex in index order.
+static int SkipDeadEnd(const int* live, int* deadEnd, int* deadEndCount, int* cursor, int vertexCount)
+{
+    while (*deadEndCount > 0) {
+        int v = deadEnd[--*deadEndCount];
+        if (live[v] > 0) {
+            return v;
+        }
+    }
+    for (; *cursor < vertexCount; ++*cursor) {
+        if (live[*cursor] > 0) {
+            return *cursor;
+        }
+    }
+    return -1;
+}
+
+int meshOptimizeTriangles(MeshIndices* triangles, int vertexCount, int cacheSize, unsigned int* remap)
+{
+    int triangleCount = triangles->Count / 3;
+    int* offsets = (int*) calloc(vertexCount + 1, sizeof(int));
+    int* adjacency = (int*) malloc(sizeof(int) * 3 * triangleCount);
+    int* live = (int*) calloc(vertexCount, sizeof(int));
+    int* stamps = (int*) calloc(vertexCount, sizeof(int));
+    int* deadEnd = (int*) malloc(sizeof(int) * 3 * triangleCount);
+    int* candidates = (int*) malloc(sizeof(int) * 3 * triangleCount);
+    unsigned char* emitted = (unsigned char*) calloc(triangleCount, 1);
+    unsigned int* order = (unsigned int*) malloc(sizeof(unsigned int) * 3 * triangleCount);
+    int ok = offsets && adjacency && live && stamps && deadEnd && candidates && emitted && order;
+
+    if (ok) {
+        // Triangles around each vertex.
+        for (int i = 0; i < 3 * triangleCount; i++) {
+            live[IndexAt(triangles, i)]++;
+        }
+        for (int v = 0; v < vertexCount; v++) {
+            offsets[v + 1] = offsets[v] + live[v];
+        }
+        // Stamps doubles as a fill count until the fans start.
+        int* fill = stamps;
+        for (int i = 0; i < 3 * triangleCount; i++) {
+            unsigned int v = IndexAt(triangles, i);
+            adjacency[offsets[v] + fill[v]++] = i / 3;
+        }
+        memset(stamps, 0, sizeof(int) * vertexCount);
+
+        // Fan around one vertex at a time, then move on to whichever of the
+        // fan's vertices will still be in the cache once its own remaining
+        // triangles are emitted, preferring the oldest.
+        int deadEndCount = 0, cursor = 0, time = cacheSize + 1, emittedCount = 0;
+        int fan = SkipDeadEnd(live, deadEnd, &deadEndCount, &cursor, vertexCount);
+        while (fan >= 0) {
+            int candidateCount = 0;
+            for (int a = offsets[fan]; a < offsets[fan + 1]; a++) {
+                int t = adjacency[a];
+                if (emitted[t]) {
+                    continue;
+                }
+                emitted[t] = 1;
+                for (int k = 0; k < 3; k++) {
+                    unsigned int v = IndexAt(triangles, 3 * t + k);
+                    order[emittedCount++] = v;
+                    deadEnd[deadEndCount++] = v;
+                    candidates[candidateCount++] = v;
+                    live[v]--;
+                    if (time - stamps[v] > cacheSize) {
+                        stamps[v] = time++;
+                    }
+                }
+            }
+
+            int best = -1, bestPriority = -1;
+            for (int c = 0; c < candidateCount; c++) {
+                int v = candidates[c];
+                if (live[v] <= 0) {
+                    continue;
+                }
+                int priority = 0;
+                if (time - stamps[v] + 2 * live[v] <= cacheSize) {
+                    priority = time - stamps[v];
+                }
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    best = v;
+                }
+            }
+            fan = best >= 0 ? best : SkipDeadEnd(live, deadEnd, &deadEndCount, &cursor, vertexCount);
+        }
+
+        // Number the vertices as they are first used; unused ones go last.
+        unsigned int next = 0;
+        for (int v = 0; v < vertexCount; v++) {
+            remap[v] = 0xFFFFFFFF;
+        }
+        for (int i = 0; i < emittedCount; i++) {
+            if (remap[order[i]] == 0xFFFFFFFF) {
+                remap[order[i]] = next++;
+            }
+        }
+        for (int v = 0; v < vertexCount; v++) {
+            if (remap[v] == 0xFFFFFFFF) {
+                remap[v] = next++;
+            }
+        }
+        for (int i = 0; i < emittedCount; i++) {
+            SetIndex(triangles, i, remap[order[i]]);
+        }
+    }
+
+    free(offsets);
+    free(adjacency);
+    free(live);
+    free(stamps);
+    free(deadEnd);
+    free(candidates);
+    free(emitted);
+    free(order);
+    return ok;
+}
+
+int meshRemapVertices(void* vertices, int vertexSize, int vertexCount, const unsigned int* remap)
+{
+    unsigned char* copy = (unsigned char*) malloc((size_t) vertexSize * vertexCount);
+    if (!copy) {
+        return 0;
+    }
+    memcpy(copy, vertices, (size_t) vertexSize * vertexCount);
+    for (int v = 0; v < vertexCount; v++) {
+        memcpy((unsigned char*) vertices + (size_t) remap[v] * vertexSize,
+               copy + (size_t) v * vertexSize, vertexSize);
+    }
+    free(copy);
+    return 1;
+}
+
+void meshRemapIndices(MeshIndices* indices, const unsigned int* remap)
+{
+    for (int i = 0; i < indices->Count; i++) {
+        unsigned int index = IndexAt(indices, i);
+        if (index != indices->Restart) {
+            SetIndex(indices, i, remap[index]);
+        }
+    }
+}
+
+int meshCacheMisses(const MeshIndices* indices, int cacheSize)
+{
+    unsigned int* fifo = (unsigned int*) malloc(sizeof(unsigned int) * cacheSize);
+    if (!fifo) {
+        return -1;
+    }
+    int misses = 0, head = 0, filled = 0;
+    for (int i = 0; i < indices->Count; i++) {
+        unsigned int index = IndexAt(indices, i);
+        if (index == indices->Restart) {
+            continue;
+        }
+        int hit = 0;
+        for (int k = 0; k < filled && !hit; k++) {
+            hit = fifo[k] == index;
+        }
+        if (hit) {
+            continue;
+        }
+        misses++;
+        fifo[head] = index;
+        head = (head + 1) % cacheSize;
+        filled = filled < cacheSize ? filled + 1 : filled;
+    }
+    free(fifo);
+    return misses;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "lens.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Warp meshes built by error rather than by a fixed row and column count.
+// The screen is split as a quadtree, always refining the cell whose
+// piecewise-linear texture coordinates stray furthest from the exact
+// lensDistort mapping that Quad.FS in the gridless demo evaluates per pixel.
+//
+// Positions are on screen and texture coordinates in the source image, both
+// in normalized device coordinates.  Triangles are counter-clockwise.
+
+typedef struct MeshGridRec {
+    int VertexCount;
+    int TriangleCount;
+    int LeafCount;
+    int Depth;                  // of the deepest leaf
+    float MaxError;             // largest error found among the leaves, in source texels
+    float* Positions;           // (x, y) per vertex
+    float* TexCoords;           // (s, t) per vertex
+    unsigned int* Indices;      // three per triangle
+} MeshGrid;
+
+// Refines until every leaf is within maxError source texels, the leaves
+// would exceed about maxTriangles (0 for no limit), or the cells reach
+// maxDepth levels, at most MESH_MAX_DEPTH.  Only points that land inside
+// the source image count towards the error, and leaves that the edge of the
+// source image crosses count theirs double, so the edge stays in place.
+//
+// Neighboring leaves may differ by any number of levels.  A leaf with
+// vertices of its smaller neighbors along its sides is fanned from its
+// center through all of them, so the mesh has no T-junctions and no cracks.
+enum { MESH_MAX_DEPTH = 10 };
+
+MeshGrid* meshCreateAdaptive(const LensModel* model, float maxError, int maxTriangles, int maxDepth,
+                             int srcWidth, int srcHeight);
+void meshDestroy(MeshGrid* mesh);
+
+// Edges of a rectilinear grid along one axis (0 for x, 1 for y), cells + 1
+// of them from -1 to 1 in normalized device coordinates.  They crowd where
+// the lens's local magnification changes fastest in source texels, the
+// worst case across the other axis, so that each cell is about as far from
+// linear as the next.  With pixels > 0 they are snapped to whole pixels, at
+// least one per cell.  Returns 0 if there are more cells than pixels.
+int meshLensEdges(const LensModel* model, int axis, int cells, int pixels,
+                  int srcWidth, int srcHeight, float* edges);
+
+// Index buffers, ready for glBufferData.  Indices are 16-bit when there are
+// few enough vertices to leave the largest value free, and 32-bit
+// otherwise.  That largest value is the primitive restart index that
+// separates strips.
+typedef struct MeshIndicesRec {
+    int Count;
+    int Capacity;
+    int Size;                   // bytes per index, 2 or 4
+    unsigned int Restart;       // 0xFFFF or 0xFFFFFFFF
+    void* Data;
+} MeshIndices;
+
+MeshIndices* meshCreateIndices(int vertexCount, int capacity);
+void meshDestroyIndices(MeshIndices* indices);
+void meshPushIndex(MeshIndices* indices, unsigned int index);
+void meshPushRestart(MeshIndices* indices);
+
+// Indices for a lattice of columns + 1 runs of rows + 1 vertices, with the
+// vertex at (i, j) numbered i * (rows + 1) + j.  That is how the demos lay
+// out their grids, and their cylinders with stacks as columns and slices
+// as rows.  The lists and the strips make the same triangles with the same
+// winding; the strips take about a third of the indices.  Lines are line
+// strips along both directions, and segments the same lines as separate
+// pairs, for primitives that can't restart such as patches.
+MeshIndices* meshLatticeTriangles(int rows, int columns);
+MeshIndices* meshLatticeStrips(int rows, int columns);
+MeshIndices* meshLatticeLines(int rows, int columns);
+MeshIndices* meshLatticeSegments(int rows, int columns);
+
+// Post-transform vertex cache.  meshOptimizeTriangles reorders a triangle
+// list with Tipsify (Sander, Nehab and Barczak, 2007) for a cache of about
+// cacheSize vertices, then renumbers the vertices in order of first use so
+// that vertex fetches stream through memory.  Remap receives the new number
+// of each old vertex, for meshRemapVertices and for any other index buffers
+// over the same vertices.  Returns 0 if it runs out of memory, leaving the
+// triangles as they were.
+int meshOptimizeTriangles(MeshIndices* triangles, int vertexCount, int cacheSize, unsigned int* remap);
+int meshRemapVertices(void* vertices, int vertexSize, int vertexCount, const unsigned int* remap);
+void meshRemapIndices(MeshIndices* indices, const unsigned int* remap);
+
+// Vertices transformed when drawing the indices through a FIFO cache of
+// cacheSize entries.  Divided by the triangle count this is the ACMR, and
+// by the number of distinct vertices the ATVR, which is 1 at best.
+// Restarts are skipped; for strips the cache is simply fed the index
+// stream.
+int meshCacheMisses(const MeshIndices* indices, int cacheSize);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,6 +4,7 @@
 #include "bstrlib.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 ///////////////////////////////////////////////////////////////////////////////
 // PRIVATE TYPES
@@ -376,6 +377,21 @@ int pezSwAddDirective(const char* token, const char* directive)
 
     return 1;
 }
+
+bool pezExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const GLubyte* extension = glGetStringi(GL_EXTENSIONS, i);
+        if (extension && !strcmp((const char*) extension, name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
 /*
  * Copyright (c) 2009 Andrew Collette <andrew.collette at gmail.com>
  * http://lzfx.googlecode.com
@@ -840,160 +856,530 @@ int lzfx_getsize(const void* ibuf, unsigned int ilen, unsigned int *olen){
 
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
-PezPixels pezLoadPixels(const char* filename)
+///////////////////////////////////////////////////////////////////////////////
+// PEZ CONTAINER
+//
+// Version 1 of the on-disk layout for PezPixels and PezVerts:
+//
+//   pezFileHeader                  64 bytes
+//   pezFilePixels or pezFileVerts
+//   pezFileAttrib[AttribCount]     (verts only)
+//   attribute names                (verts only, null-terminated)
+//   payloads                       (each aligned to Alignment)
+//
+// Fields are little-endian and fixed-size, and locations are byte offsets
+// from the start of the file rather than pointers.  Uncompressed files are
+// mapped into memory and used in place; since payloads are page-aligned,
+// they can be handed straight to glBufferData or glTexImage2D.  Compressed
+// files store the header as-is followed by an lzfx stream of the rest, and
+// offsets refer to the decompressed image.
+//
+// Files without the magic number are the older format, which was a raw
+// copy of the in-memory structs.
+
+#define PEZ_FILE_VERSION 1
+#define PEZ_FILE_ALIGNMENT 4096
+
+enum { PEZ_FILE_PIXELS = 1, PEZ_FILE_VERTS = 2 };
+enum { PEZ_FILE_COMPRESSED = 1 };
+
+static const char __pez__Magic[4] = {'P', 'E', 'Z', 0x1A};
+
+typedef struct pezFileHeaderRec
+{
+    char Magic[4];
+    uint32_t Version;
+    uint32_t Kind;
+    uint32_t Flags;
+    uint32_t Alignment;
+    uint32_t Reserved0;
+    uint64_t ImageSize;         // size of the uncompressed file
+    uint64_t StoredSize;        // size of the file on disk
+    uint8_t Reserved1[24];
+} pezFileHeader;
+
+typedef struct pezFilePixelsRec
+{
+    int32_t FrameCount;
+    int32_t Width;
+    int32_t Height;
+    int32_t Depth;
+    int32_t MipLevels;
+    uint32_t Format;
+    uint32_t InternalFormat;
+    uint32_t Type;
+    uint64_t BytesPerFrame;
+    uint64_t FramesOffset;
+} pezFilePixels;
+
+typedef struct pezFileVertsRec
+{
+    int32_t AttribCount;
+    int32_t IndexCount;
+    int32_t VertexCount;
+    uint32_t IndexType;
+    uint64_t IndexBufferSize;
+    uint64_t IndicesOffset;
+    uint64_t AttribsOffset;
+} pezFileVerts;
+
+typedef struct pezFileAttribRec
+{
+    uint64_t NameOffset;
+    int32_t Size;
+    uint32_t Type;
+    int32_t Stride;
+    int32_t FrameCount;
+    uint64_t FramesOffset;
+} pezFileAttrib;
+
+// What RawHeader points to: the file image, and for verts the attribute
+// table, which holds pointers and so can't live in the image.
+typedef struct pezStorageRec
+{
+    unsigned char* Image;
+    size_t Size;
+    int Mapped;
+    PezAttrib* Attribs;
+} pezStorage;
+
+static uint64_t __pez__Align(uint64_t offset)
+{
+    return (offset + PEZ_FILE_ALIGNMENT - 1) & ~(uint64_t) (PEZ_FILE_ALIGNMENT - 1);
+}
+
+static int __pez__LittleEndian()
+{
+    const uint32_t one = 1;
+    return *(const unsigned char*) &one == 1;
+}
+
+static unsigned char* __pez__ReadFile(const char* filename, size_t* size)
 {
     FILE* file = fopen(filename, "rb");
-    unsigned int compressedSize, decompressedSize;
-    unsigned char* compressed;
-    unsigned int headerSize;
-    PezPixels pixels;
+    pezCheckPointer(file, "Unable to open %s", filename);
 
     fseek(file, 0, SEEK_END);
-    compressedSize = ftell(file);
+    *size = ftell(file);
     fseek(file, 0, SEEK_SET);
 
-    compressed = (unsigned char*) malloc(compressedSize);
-    fread(compressed, 1, compressedSize, file);
+    unsigned char* contents = (unsigned char*) malloc(*size ? *size : 1);
+    pezCheckPointer(contents, "Out of memory reading %s", filename);
+    pezCheck(fread(contents, 1, *size, file) == *size, "Unable to read %s", filename);
+    fclose(file);
+    return contents;
+}
+
+// Maps the file if the platform allows, otherwise reads it.
+static unsigned char* __pez__MapFile(const char* filename, size_t size, int* mapped)
+{
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    pezCheck(fd >= 0, "Unable to open %s", filename);
+    // Private and writable, so that callers can touch up the data without
+    // affecting the file; pages are only copied if they're written.
+    void* image = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image != MAP_FAILED) {
+        *mapped = 1;
+        return (unsigned char*) image;
+    }
+#endif
+    size_t actual;
+    *mapped = 0;
+    unsigned char* contents = __pez__ReadFile(filename, &actual);
+    pezCheck(actual == size, "%s changed while loading", filename);
+    return contents;
+}
+
+static size_t __pez__FileSize(const char* filename)
+{
+#ifndef _WIN32
+    struct stat info;
+    pezCheck(stat(filename, &info) == 0, "Unable to open %s", filename);
+    return (size_t) info.st_size;
+#else
+    FILE* file = fopen(filename, "rb");
+    pezCheckPointer(file, "Unable to open %s", filename);
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
     fclose(file);
+    return size;
+#endif
+}
+
+// Loads a file in either format.  For version 1 files the image starts with
+// a validated pezFileHeader of the given kind; for old files it's the
+// decompressed contents.
+static pezStorage* __pez__Load(const char* filename, uint32_t kind, int* legacy)
+{
+    pezStorage* storage = (pezStorage*) calloc(1, sizeof(pezStorage));
+    pezCheckPointer(storage, "Out of memory loading %s", filename);
+
+    pezFileHeader header;
+    memset(&header, 0, sizeof(header));
+    size_t fileSize = __pez__FileSize(filename);
+    if (fileSize >= sizeof(header)) {
+        FILE* file = fopen(filename, "rb");
+        pezCheckPointer(file, "Unable to open %s", filename);
+        pezCheck(fread(&header, sizeof(header), 1, file) == 1, "Unable to read %s", filename);
+        fclose(file);
+    }
+
+    *legacy = memcmp(header.Magic, __pez__Magic, 4) != 0;
+    if (*legacy) {
+        size_t compressedSize;
+        unsigned char* compressed = __pez__ReadFile(filename, &compressedSize);
+        unsigned int decompressedSize = 0;
+        lzfx_decompress(compressed, compressedSize, 0, &decompressedSize);
+        storage->Image = (unsigned char*) malloc(decompressedSize);
+        pezCheckPointer(storage->Image, "Out of memory loading %s", filename);
+        lzfx_decompress(compressed, compressedSize, storage->Image, &decompressedSize);
+        storage->Size = decompressedSize;
+        free(compressed);
+        return storage;
+    }
+
+    pezCheck(__pez__LittleEndian(), "%s: big-endian hosts are not supported", filename);
+    pezCheck(header.Version == PEZ_FILE_VERSION, "%s: unsupported version %u", filename, header.Version);
+    pezCheck(header.Kind == kind, "%s: wrong kind of content", filename);
+    pezCheck(header.StoredSize == fileSize, "%s: truncated", filename);
+
+    storage->Size = header.ImageSize;
+    if (header.Flags & PEZ_FILE_COMPRESSED) {
+        size_t compressedSize;
+        unsigned char* compressed = __pez__ReadFile(filename, &compressedSize);
+        pezCheck(header.ImageSize - sizeof(header) <= UINT_MAX, "%s: corrupt data", filename);
+        unsigned int payloadSize = (unsigned int) (header.ImageSize - sizeof(header));
+        storage->Image = (unsigned char*) malloc(header.ImageSize);
+        pezCheckPointer(storage->Image, "Out of memory loading %s", filename);
+        memcpy(storage->Image, &header, sizeof(header));
+        int status = lzfx_decompress(compressed + sizeof(header), compressedSize - sizeof(header),
+                                     storage->Image + sizeof(header), &payloadSize);
+        pezCheck(status >= 0 && payloadSize == header.ImageSize - sizeof(header),
+                 "%s: corrupt data", filename);
+        free(compressed);
+    } else {
+        pezCheck(header.ImageSize == fileSize, "%s: truncated", filename);
+        storage->Image = __pez__MapFile(filename, fileSize, &storage->Mapped);
+    }
+    return storage;
+}
 
-    decompressedSize = 0;
-    lzfx_decompress(compressed, compressedSize, 0, &decompressedSize);
+static void __pez__Release(void* rawHeader)
+{
+    pezStorage* storage = (pezStorage*) rawHeader;
+    if (!storage) {
+        return;
+    }
+#ifndef _WIN32
+    if (storage->Mapped) {
+        munmap(storage->Image, storage->Size);
+    } else
+#endif
+    free(storage->Image);
+    free(storage->Attribs);
+    free(storage);
+}
+
+// Checks that [offset, offset + size) lies within the image.
+static void __pez__CheckRange(const pezStorage* storage, uint64_t offset, uint64_t size)
+{
+    pezCheck(offset <= storage->Size && size <= storage->Size - offset, "Corrupt pez file");
+}
+
+// Returns count * size, rejecting negative counts and products that wrap.
+static uint64_t __pez__Extent(int32_t count, uint64_t size)
+{
+    pezCheck(count >= 0 && (count == 0 || size <= UINT64_MAX / (uint64_t) count), "Corrupt pez file");
+    return (uint64_t) count * size;
+}
+
+// Writes the metadata followed by each payload at its aligned offset,
+// either straight to disk or through one lzfx pass over the whole image.
+static void __pez__Write(const char* filename, unsigned char* meta, uint64_t metaSize,
+                         int payloadCount, const void** payloads, const uint64_t* offsets,
+                         const uint64_t* sizes, int compress)
+{
+    pezFileHeader* header = (pezFileHeader*) meta;
+    uint64_t imageSize = metaSize;
+    for (int i = 0; i < payloadCount; i++) {
+        imageSize = offsets[i] + sizes[i] > imageSize ? offsets[i] + sizes[i] : imageSize;
+    }
+    header->ImageSize = imageSize;
+
+    // lzfx lengths are 32-bit, so larger images are stored uncompressed.
+    if (imageSize - sizeof(pezFileHeader) > UINT_MAX) {
+        compress = 0;
+        header->Flags &= ~PEZ_FILE_COMPRESSED;
+    }
 
-    pixels.RawHeader = (void*) malloc(decompressedSize);
-    lzfx_decompress(compressed, compressedSize, pixels.RawHeader, &decompressedSize);
+    FILE* file = fopen(filename, "wb");
+    pezCheckPointer(file, "Unable to create %s", filename);
+
+    if (!compress) {
+        static const unsigned char zeros[PEZ_FILE_ALIGNMENT] = {0};
+        header->StoredSize = imageSize;
+        fwrite(meta, 1, metaSize, file);
+        uint64_t position = metaSize;
+        for (int i = 0; i < payloadCount; i++) {
+            fwrite(zeros, 1, offsets[i] - position, file);
+            fwrite(payloads[i], 1, sizes[i], file);
+            position = offsets[i] + sizes[i];
+        }
+        fclose(file);
+        return;
+    }
+
+    unsigned char* image = (unsigned char*) calloc(imageSize, 1);
+    pezCheckPointer(image, "Out of memory saving %s", filename);
+    memcpy(image, meta, metaSize);
+    for (int i = 0; i < payloadCount; i++) {
+        memcpy(image + offsets[i], payloads[i], sizes[i]);
+    }
+
+    unsigned int payloadSize = (unsigned int) (imageSize - sizeof(pezFileHeader));
+    unsigned int compressedSize = payloadSize + payloadSize / 16 + 64;
+    unsigned char* compressed = (unsigned char*) malloc(compressedSize);
+    pezCheckPointer(compressed, "Out of memory saving %s", filename);
+    int status = lzfx_compress(image + sizeof(pezFileHeader), payloadSize, compressed, &compressedSize);
+    pezCheck(status >= 0, "Unable to compress %s", filename);
+
+    header->StoredSize = sizeof(pezFileHeader) + compressedSize;
+    fwrite(header, 1, sizeof(pezFileHeader), file);
+    fwrite(compressed, 1, compressedSize, file);
+    fclose(file);
     free(compressed);
+    free(image);
+}
 
-    headerSize = sizeof(struct PezPixelsRec);
-    memcpy(&pixels, pixels.RawHeader, headerSize - 2 * sizeof(void*));
-    pixels.Frames = (char*) pixels.RawHeader + headerSize;
+static void __pez__InitHeader(pezFileHeader* header, uint32_t kind, int compress)
+{
+    memset(header, 0, sizeof(pezFileHeader));
+    memcpy(header->Magic, __pez__Magic, 4);
+    header->Version = PEZ_FILE_VERSION;
+    header->Kind = kind;
+    header->Flags = compress ? PEZ_FILE_COMPRESSED : 0;
+    header->Alignment = PEZ_FILE_ALIGNMENT;
+}
+
+PezPixels pezLoadPixels(const char* filename)
+{
+    PezPixels pixels;
+    int legacy;
+    pezStorage* storage = __pez__Load(filename, PEZ_FILE_PIXELS, &legacy);
+
+    if (legacy) {
+        unsigned int headerSize = sizeof(struct PezPixelsRec);
+        memcpy(&pixels, storage->Image, headerSize - 2 * sizeof(void*));
+        pixels.Frames = storage->Image + headerSize;
+        pixels.RawHeader = storage;
+        return pixels;
+    }
 
+    __pez__CheckRange(storage, sizeof(pezFileHeader), sizeof(pezFilePixels));
+    const pezFilePixels* desc = (const pezFilePixels*) (storage->Image + sizeof(pezFileHeader));
+    __pez__CheckRange(storage, desc->FramesOffset, __pez__Extent(desc->FrameCount, desc->BytesPerFrame));
+
+    pixels.FrameCount = desc->FrameCount;
+    pixels.Width = desc->Width;
+    pixels.Height = desc->Height;
+    pixels.Depth = desc->Depth;
+    pixels.MipLevels = desc->MipLevels;
+    pixels.Format = desc->Format;
+    pixels.InternalFormat = desc->InternalFormat;
+    pixels.Type = desc->Type;
+    pixels.BytesPerFrame = (GLsizeiptr) desc->BytesPerFrame;
+    pixels.Frames = storage->Image + desc->FramesOffset;
+    pixels.RawHeader = storage;
     return pixels;
 }
 
 void pezFreePixels(PezPixels pixels)
 {
-    free(pixels.RawHeader);
+    __pez__Release(pixels.RawHeader);
 }
 
 void pezFreeVerts(PezVerts verts)
 {
-    free(verts.RawHeader);
+    __pez__Release(verts.RawHeader);
 }
 
-void pezSavePixels(PezPixels pixels, const char* filename)
+void pezWritePixels(PezPixels pixels, const char* filename, bool compress)
 {
-    unsigned int headerSize = sizeof(struct PezPixelsRec);
-    unsigned int contentSize = pixels.FrameCount * pixels.BytesPerFrame;
-    unsigned int decompressedSize = headerSize + contentSize;
-    unsigned char* decompressed;
-    unsigned int compressedSize;
-    unsigned char* compressed;
-    FILE* file;
-    
-    decompressed = (unsigned char*) malloc(decompressedSize);
-    memcpy(decompressed, &pixels, headerSize);
-    memcpy(decompressed + headerSize, pixels.Frames, contentSize);
-
-    compressedSize = decompressedSize;
-    compressed = (unsigned char*) malloc(decompressedSize);
-    lzfx_compress(decompressed, decompressedSize, compressed, &compressedSize);
-    
-    free(decompressed);
+    struct {
+        pezFileHeader Header;
+        pezFilePixels Pixels;
+    } meta;
+
+    __pez__InitHeader(&meta.Header, PEZ_FILE_PIXELS, compress);
+    memset(&meta.Pixels, 0, sizeof(meta.Pixels));
+    meta.Pixels.FrameCount = pixels.FrameCount;
+    meta.Pixels.Width = pixels.Width;
+    meta.Pixels.Height = pixels.Height;
+    meta.Pixels.Depth = pixels.Depth;
+    meta.Pixels.MipLevels = pixels.MipLevels;
+    meta.Pixels.Format = pixels.Format;
+    meta.Pixels.InternalFormat = pixels.InternalFormat;
+    meta.Pixels.Type = pixels.Type;
+    meta.Pixels.BytesPerFrame = pixels.BytesPerFrame;
+    meta.Pixels.FramesOffset = __pez__Align(sizeof(meta));
+
+    const void* payload = pixels.Frames;
+    uint64_t size = (uint64_t) pixels.FrameCount * pixels.BytesPerFrame;
+    __pez__Write(filename, (unsigned char*) &meta, sizeof(meta), 1, &payload,
+                 &meta.Pixels.FramesOffset, &size, compress);
+}
 
-    file = fopen(filename, "wb");
-    fwrite(compressed, 1, compressedSize, file);
-    free(compressed);
-    fclose(file);
+void pezSavePixels(PezPixels pixels, const char* filename)
+{
+    pezWritePixels(pixels, filename, true);
 }
 
 PezVerts pezLoadVerts(const char* filename)
 {
-    FILE* file = fopen(filename, "rb");
-    
-    unsigned int compressedSize;
-    fseek(file, 0, SEEK_END);
-    compressedSize = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    PezVerts verts;
+    int legacy;
+    pezStorage* storage = __pez__Load(filename, PEZ_FILE_VERTS, &legacy);
 
-    unsigned char* compressed = (unsigned char*) malloc(compressedSize);
-    fread(compressed, 1, compressedSize, file);
-    fclose(file);
+    if (legacy) {
+        unsigned int headerSize = sizeof(struct PezVertsRec);
+        memcpy(&verts, storage->Image, headerSize - sizeof(void*));
 
-    unsigned int decompressedSize = 0;
-    lzfx_decompress(compressed, compressedSize, 0, &decompressedSize);
+        unsigned int attribTableSize = sizeof(struct PezAttribRec) * verts.AttribCount;
+        unsigned int indexTableSize = verts.IndexBufferSize;
 
-    PezVerts verts;
-    verts.RawHeader = (void*) malloc(decompressedSize);
-    lzfx_decompress(compressed, compressedSize, verts.RawHeader, &decompressedSize);
-    free(compressed);
+        verts.Attribs = (PezAttrib*) (storage->Image + headerSize);
+        verts.Indices = (GLvoid*) (storage->Image + headerSize + attribTableSize);
 
-    unsigned int headerSize = sizeof(struct PezVertsRec);
-    memcpy(&verts, verts.RawHeader, headerSize - sizeof(void*));
+        char* f = (char*) storage->Image + headerSize + attribTableSize + indexTableSize;
+        for (int attrib = 0; attrib < verts.AttribCount; attrib++) {
+            verts.Attribs[attrib].Frames = (GLvoid*) f;
+            f += verts.VertexCount * verts.Attribs[attrib].FrameCount * verts.Attribs[attrib].Stride;
+        }
 
-    unsigned int attribTableSize = sizeof(struct PezAttribRec) * verts.AttribCount;
-    unsigned int indexTableSize = verts.IndexBufferSize;
-    
-    verts.Attribs = (PezAttrib*) ((char*) verts.RawHeader + headerSize);
-    verts.Indices = (GLvoid*) ((char*) verts.RawHeader + headerSize + attribTableSize);
-    
-    char* f = (char*) verts.RawHeader + headerSize + attribTableSize + indexTableSize;
-    for (int attrib = 0; attrib < verts.AttribCount; attrib++) {
-        verts.Attribs[attrib].Frames = (GLvoid*) f;
-        f += verts.VertexCount * verts.Attribs[attrib].FrameCount * verts.Attribs[attrib].Stride;
+        const char* s = f;
+        for (int attrib = 0; attrib < verts.AttribCount; attrib++) {
+            verts.Attribs[attrib].Name = s;
+            s += strlen(s) + 1;
+        }
+
+        verts.RawHeader = storage;
+        return verts;
     }
 
-    const char* s = f;
+    __pez__CheckRange(storage, sizeof(pezFileHeader), sizeof(pezFileVerts));
+    const pezFileVerts* desc = (const pezFileVerts*) (storage->Image + sizeof(pezFileHeader));
+    __pez__CheckRange(storage, desc->AttribsOffset, __pez__Extent(desc->AttribCount, sizeof(pezFileAttrib)));
+    __pez__CheckRange(storage, desc->IndicesOffset, desc->IndexBufferSize);
+    const pezFileAttrib* attribs = (const pezFileAttrib*) (storage->Image + desc->AttribsOffset);
+    pezCheck(desc->VertexCount >= 0 && desc->IndexCount >= 0, "Corrupt pez file");
+
+    verts.AttribCount = desc->AttribCount;
+    verts.IndexCount = desc->IndexCount;
+    verts.VertexCount = desc->VertexCount;
+    verts.IndexType = desc->IndexType;
+    verts.IndexBufferSize = (GLsizeiptr) desc->IndexBufferSize;
+    verts.Indices = storage->Image + desc->IndicesOffset;
+
+    storage->Attribs = (PezAttrib*) calloc(desc->AttribCount ? desc->AttribCount : 1, sizeof(PezAttrib));
+    pezCheckPointer(storage->Attribs, "Out of memory loading %s", filename);
     for (int attrib = 0; attrib < verts.AttribCount; attrib++) {
-        verts.Attribs[attrib].Name = s;
-        s += strlen(s) + 1;
+        const pezFileAttrib* a = attribs + attrib;
+        pezCheck(a->Stride >= 0, "Corrupt pez file");
+        uint64_t frameSize = __pez__Extent(a->FrameCount, __pez__Extent(verts.VertexCount, a->Stride));
+        __pez__CheckRange(storage, a->FramesOffset, frameSize);
+        __pez__CheckRange(storage, a->NameOffset, 1);
+        pezCheck(memchr(storage->Image + a->NameOffset, 0, storage->Size - a->NameOffset) != 0,
+                 "%s: corrupt data", filename);
+
+        PezAttrib* dest = storage->Attribs + attrib;
+        dest->Name = (const GLchar*) (storage->Image + a->NameOffset);
+        dest->Size = a->Size;
+        dest->Type = a->Type;
+        dest->Stride = a->Stride;
+        dest->FrameCount = a->FrameCount;
+        dest->Frames = storage->Image + a->FramesOffset;
     }
-
+    verts.Attribs = storage->Attribs;
+    verts.RawHeader = storage;
     return verts;
 }
 
-void pezSaveVerts(PezVerts verts, const char* filename)
+void pezWriteVerts(PezVerts verts, const char* filename, bool compress)
 {
-    unsigned int headerSize = sizeof(struct PezVertsRec);
-    unsigned int attribTableSize = sizeof(struct PezAttribRec) * verts.AttribCount;
-    unsigned int indexTableSize = verts.IndexBufferSize;
-
-    unsigned int stringTableSize = 0;
-    unsigned int frameTableSize = 0;
+    // Header, descriptor, attribute table and names, then the index buffer
+    // and one payload per attribute.
+    uint64_t attribsOffset = sizeof(pezFileHeader) + sizeof(pezFileVerts);
+    uint64_t namesOffset = attribsOffset + sizeof(pezFileAttrib) * verts.AttribCount;
+    uint64_t metaSize = namesOffset;
     for (int attrib = 0; attrib < verts.AttribCount; attrib++) {
-        stringTableSize += strlen(verts.Attribs[attrib].Name) + 1;
-        frameTableSize += verts.VertexCount * verts.Attribs[attrib].FrameCount * verts.Attribs[attrib].Stride;
+        metaSize += strlen(verts.Attribs[attrib].Name) + 1;
     }
 
-    unsigned int decompressedSize = headerSize + attribTableSize + indexTableSize + frameTableSize + stringTableSize;
-
-    unsigned char* decompressed = (unsigned char*) malloc(decompressedSize);
-    memcpy(decompressed, &verts, headerSize);
-    memcpy(decompressed + headerSize, verts.Attribs, attribTableSize);
-    memcpy(decompressed + headerSize + attribTableSize, verts.Indices, indexTableSize);
-    
-    unsigned char* frameTable = decompressed + headerSize + attribTableSize + indexTableSize;
+    unsigned char* meta = (unsigned char*) calloc(metaSize, 1);
+    const void** payloads = (const void**) malloc(sizeof(void*) * (verts.AttribCount + 1));
+    uint64_t* offsets = (uint64_t*) malloc(sizeof(uint64_t) * (verts.AttribCount + 1));
+    uint64_t* sizes = (uint64_t*) malloc(sizeof(uint64_t) * (verts.AttribCount + 1));
+    pezCheck(meta && payloads && offsets && sizes, "Out of memory saving %s", filename);
+
+    pezFileHeader* header = (pezFileHeader*) meta;
+    pezFileVerts* desc = (pezFileVerts*) (meta + sizeof(pezFileHeader));
+    pezFileAttrib* attribs = (pezFileAttrib*) (meta + attribsOffset);
+    __pez__InitHeader(header, PEZ_FILE_VERTS, compress);
+
+    desc->AttribCount = verts.AttribCount;
+    desc->IndexCount = verts.IndexCount;
+    desc->VertexCount = verts.VertexCount;
+    desc->IndexType = verts.IndexType;
+    desc->IndexBufferSize = verts.IndexBufferSize;
+    desc->AttribsOffset = attribsOffset;
+    desc->IndicesOffset = __pez__Align(metaSize);
+
+    payloads[0] = verts.Indices;
+    offsets[0] = desc->IndicesOffset;
+    sizes[0] = verts.IndexBufferSize;
+
+    uint64_t nameOffset = namesOffset;
+    uint64_t offset = desc->IndicesOffset + verts.IndexBufferSize;
     for (int attrib = 0; attrib < verts.AttribCount; attrib++) {
-        GLsizei frameSize = verts.VertexCount * verts.Attribs[attrib].FrameCount * verts.Attribs[attrib].Stride;
-        memcpy(frameTable, verts.Attribs[attrib].Frames, frameSize);
-        frameTable += frameSize;
+        const PezAttrib* a = verts.Attribs + attrib;
+        pezFileAttrib* dest = attribs + attrib;
+        dest->NameOffset = nameOffset;
+        dest->Size = a->Size;
+        dest->Type = a->Type;
+        dest->Stride = a->Stride;
+        dest->FrameCount = a->FrameCount;
+        dest->FramesOffset = __pez__Align(offset);
+
+        strcpy((char*) meta + nameOffset, a->Name);
+        nameOffset += strlen(a->Name) + 1;
+
+        payloads[attrib + 1] = a->Frames;
+        offsets[attrib + 1] = dest->FramesOffset;
+        sizes[attrib + 1] = (uint64_t) verts.VertexCount * a->FrameCount * a->Stride;
+        offset = offsets[attrib + 1] + sizes[attrib + 1];
     }
 
-    char* stringTable = (char*) frameTable;
-    for (int attrib = 0; attrib < verts.AttribCount; attrib++) {
-        const char* s = verts.Attribs[attrib].Name;
-        strcpy(stringTable, s);
-        stringTable += strlen(s) + 1;
-    }
-
-    unsigned int compressedSize = decompressedSize;
-    unsigned char* compressed = (unsigned char*) malloc(decompressedSize);
-    lzfx_compress(decompressed, decompressedSize, compressed, &compressedSize);
-    
-    free(decompressed);
+    __pez__Write(filename, meta, metaSize, verts.AttribCount + 1, payloads, offsets, sizes, compress);
+    free(meta);
+    free(payloads);
+    free(offsets);
+    free(sizes);
+}
 
-    FILE* file = fopen(filename, "wb");
-    fwrite(compressed, 1, compressedSize, file);
-    free(compressed);
-    fclose(file);
+void pezSaveVerts(PezVerts verts, const char* filename)
+{
+    pezWriteVerts(verts, filename, true);
 }
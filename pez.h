@@ -58,6 +58,18 @@ const char* pezOpenFileDialog();
 const char* pezGetDesktopFolder();
 const char* pezGetShader(const char* effectKey);
 
+// Command-line options.  "-o name" switches on an option that the app can
+// test with pezOption.  "-b frames" benchmarks instead of running: it
+// renders that many frames at a fixed 60 Hz time step, waiting for each
+// one with glFinish, then prints the mean time spent in PezRender and
+// exits.  Apps test their options in PezInitialize, and only where they
+// make a difference; a benchmark with an option that went untested is
+// skipped as a repeat of the run without it.
+bool pezOption(const char* name);
+
+// Whether the current context advertises the named OpenGL extension.
+bool pezExtension(const char* name);
+
 typedef struct PezAttribRec {
     const GLchar* Name;
     GLint Size;
@@ -92,14 +104,19 @@ typedef struct PezPixelsRec {
     void* RawHeader;
 } PezPixels;
 
+// Files written without compression are memory-mapped by the loaders, so
+// Frames and Indices point into the mapping and can be passed directly to
+// glBufferData or glTexImage*.  The save functions compress.
 PezVerts pezLoadVerts(const char* filename);
 PezVerts pezGenQuad(float left, float top, float right, float bottom);
 void pezFreeVerts(PezVerts verts);
 void pezSaveVerts(PezVerts verts, const char* filename);
+void pezWriteVerts(PezVerts verts, const char* filename, bool compress);
 
 PezPixels pezLoadPixels(const char* filename);
 void pezFreePixels(PezPixels pixels);
 void pezSavePixels(PezPixels pixels, const char* filename);
+void pezWritePixels(PezPixels pixels, const char* filename, bool compress);
 void pezRenderText(PezPixels pixels, const char* message);
 PezPixels pezGenNoise(PezPixels desc, float alpha, float beta, int n);
 
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <signal.h>
 #include <wchar.h>
 #include <Xm/MwmUtil.h>
@@ -23,6 +24,21 @@ typedef struct PlatformContextRec
     Window MainWindow;
 } PlatformContext;
 
+static const char* Options[16];
+static bool OptionTested[16];
+static int OptionCount = 0;
+
+bool pezOption(const char* name)
+{
+    for (int i = 0; i < OptionCount; i++) {
+        if (!strcmp(Options[i], name)) {
+            OptionTested[i] = true;
+            return true;
+        }
+    }
+    return false;
+}
+
 unsigned int GetMicroseconds()
 {
     struct timeval tp;
@@ -44,6 +60,18 @@ int main(int argc, char** argv)
         None
     };
     
+    int benchmarkFrames = 0;
+    for (int i = 1; i < argc; i++) {
+        int hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-b") && hasValue) {
+            benchmarkFrames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-o") && hasValue && OptionCount < countof(Options)) {
+            Options[OptionCount++] = argv[++i];
+        } else {
+            pezFatal("Usage: %s [-b frames] [-o option]...\n", argv[0]);
+        }
+    }
+
     PlatformContext context;
 
     context.MainDisplay = XOpenDisplay(NULL);
@@ -194,6 +222,17 @@ int main(int argc, char** argv)
     // Perform user-specified intialization
     pezPrintString("OpenGL Version: %s\n", glGetString(GL_VERSION));
     PezInitialize();
+
+    // An option that PezInitialize never tested leaves the app as it would
+    // be without it, so benchmarking it would only repeat that run.
+    for (int i = 0; benchmarkFrames && i < OptionCount; i++) {
+        if (!OptionTested[i]) {
+            pezPrintString("%s -o %s: no effect, not benchmarked\n", PezGetConfig().Title, Options[i]);
+            pezSwShutdown();
+            return 0;
+        }
+    }
+
     bstring windowTitle = bmidstr(name, 0, blength(name) - 2);
     XStoreName(context.MainDisplay, context.MainWindow, bdata(windowTitle));
     bdestroy(windowTitle);
@@ -204,6 +243,8 @@ int main(int argc, char** argv)
     // -------------------
 
     unsigned int previousTime = GetMicroseconds();
+    unsigned int benchmarkTime = 0;
+    int frame = 0;
     int done = 0;
     while (!done) {
         
@@ -260,6 +301,24 @@ int main(int argc, char** argv)
         unsigned int deltaTime = currentTime - previousTime;
         previousTime = currentTime;
         
+        if (benchmarkFrames) {
+            PezUpdate(1.0f / 60.0f);
+            unsigned int renderTime = GetMicroseconds();
+            PezRender(0);
+            glFinish();
+            benchmarkTime += GetMicroseconds() - renderTime;
+            glXSwapBuffers(context.MainDisplay, context.MainWindow);
+            if (++frame == benchmarkFrames) {
+                pezPrintString("%s", PezGetConfig().Title);
+                for (int i = 0; i < OptionCount; i++) {
+                    pezPrintString(" -o %s", Options[i]);
+                }
+                pezPrintString(": %d frames, %.3f ms per frame\n", frame, benchmarkTime / 1000.0f / frame);
+                done = 1;
+            }
+            continue;
+        }
+
         PezUpdate((float) deltaTime / 1000000.0f);
 
         PezRender(0);
@@ -0,0 +1,1481 @@
+// Distortion OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "warp.h"
+#include "lens.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WARP_X86 1
+#include <immintrin.h>
+#define WARP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#define WARP_BAND_ROWS 16
+#define WARP_TILE_SIZE 64
+#define WARP_INVERSE_ITERATIONS 8
+
+static int Isa = -1;
+
+static int DetectIsa()
+{
+#ifdef WARP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return WARP_ISA_AVX2;
+    if (__builtin_cpu_supports("sse2")) return WARP_ISA_SSE2;
+#endif
+    return WARP_ISA_SCALAR;
+}
+
+int warpGetIsa()
+{
+    if (Isa < 0) {
+        Isa = DetectIsa();
+    }
+    return Isa;
+}
+
+// Returns the ISA that will actually be used, which may be lower than requested.
+int warpSetIsa(int isa)
+{
+    int supported = DetectIsa();
+    Isa = isa < supported ? isa : supported;
+    return Isa;
+}
+
+WarpFill warpDefaultFill()
+{
+    // BackgroundColor and BorderColor from Quad.FS
+    WarpFill fill = {{255, 255, 255, 255}, {0, 0, 0, 0}};
+    return fill;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Remap
+
+// Converts a normalized texture coordinate into a clamp-to-edge texel index
+// with 8 bits of sub-texel precision, like GL_LINEAR does.
+static unsigned short TexelFixed(float tc, int size, unsigned char* frac)
+{
+    float t = tc * size - 0.5f;
+    if (t < 0) t = 0;
+    if (t > size - 1) t = size - 1;
+    int fixed = (int) (t * 256.0f + 0.5f);
+    *frac = (unsigned char) (fixed & 255);
+    return (unsigned short) (fixed >> 8);
+}
+
+// Where each output pixel center lands in the source image, for one
+// color channel.
+typedef struct WarpLensRec {
+    LensModel Model;
+    int Inverse;
+    float Tolerance;
+    LensChroma Chroma;
+    int Channel;
+} WarpLens;
+
+static WarpLens BarrelLens(float barrelPower)
+{
+    WarpLens lens = {lensPowerModel(barrelPower), 0, 0, lensNoChroma(), 1};
+    return lens;
+}
+
+static void MapPoints(const WarpLens* lens, float* points, int count)
+{
+    if (lens->Inverse) {
+        lensUndistort(&lens->Model, points, count, lens->Tolerance, WARP_INVERSE_ITERATIONS);
+    } else {
+        lensDistort(&lens->Model, points, count);
+    }
+    lensChromaShift(&lens->Chroma, lens->Channel, points, count);
+}
+
+// Quad.FS uses fwidth() to fade the edges of the warped image.  Here the
+// screen-space derivatives are forward differences with the right and lower
+// neighbors, so each rectangle evaluates one extra row and column.
+// The points buffer needs room for (cols + 1) * (rows + 1) pairs.
+static void RectTaps(WarpTap* taps, int x0, int y0, int cols, int rows, int width, int height,
+                     int srcWidth, int srcHeight, const WarpLens* lens, float* points)
+{
+    int columns = cols + 1;
+    for (int j = 0; j <= rows; j++) {
+        float y = (y0 + j + 0.5f) * 2.0f / height - 1.0f;
+        float* p = points + 2 * columns * j;
+        for (int i = 0; i < columns; i++, p += 2) {
+            p[0] = (x0 + i + 0.5f) * 2.0f / width - 1.0f;
+            p[1] = y;
+        }
+    }
+    MapPoints(lens, points, columns * (rows + 1));
+
+    WarpTap* tap = taps;
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < cols; i++, tap++) {
+            const float* p = points + 2 * (columns * j + i);
+            const float* right = p + 2;
+            const float* below = p + 2 * columns;
+
+            float qx = 1 - fabsf(p[0]);
+            float qy = 1 - fabsf(p[1]);
+            float u = fabsf(fabsf(right[0]) - fabsf(p[0])) + fabsf(fabsf(below[0]) - fabsf(p[0]));
+            float v = fabsf(fabsf(right[1]) - fabsf(p[1])) + fabsf(fabsf(below[1]) - fabsf(p[1]));
+
+            memset(tap, 0, sizeof(WarpTap));
+            tap->Coverage = 255;
+            if (qx < -u || qy < -v) {
+                continue;
+            }
+
+            float L = 1.0f;
+            if (qx < u) L *= fabsf(qx / u);
+            if (qy < v) L *= fabsf(qy / v);
+            tap->Coverage = (unsigned char) (L * 255.0f + 0.5f);
+
+            if (qx < 0 || qy < 0) {
+                continue;
+            }
+
+            tap->Flags = WARP_TAP_SOURCE;
+            tap->X = TexelFixed(0.5f * (p[0] + 1.0f), srcWidth, &tap->FracX);
+            tap->Y = TexelFixed(0.5f * (p[1] + 1.0f), srcHeight, &tap->FracY);
+        }
+    }
+}
+
+int warpBarrelTaps(WarpTap* taps, int firstRow, int rowCount,
+                   int width, int height, int srcWidth, int srcHeight, float barrelPower)
+{
+    float* points = (float*) malloc(sizeof(float) * 2 * (width + 1) * (rowCount + 1));
+    if (!points) {
+        return 0;
+    }
+
+    WarpLens lens = BarrelLens(barrelPower);
+    RectTaps(taps, 0, firstRow, width, rowCount, width, height,
+             srcWidth, srcHeight, &lens, points);
+    free(points);
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sampling
+//
+// All kernels use the same 16-bit integer arithmetic, so the SIMD paths are
+// bit-exact with the scalar one:
+//
+//   top    = (tl * (256 - fx) + tr * fx + 128) >> 8
+//   bottom = (bl * (256 - fx) + br * fx + 128) >> 8
+//   texel  = (top * (256 - fy) + bottom * fy + 128) >> 8
+//   t      = texel * c + border * (255 - c) + 128
+//   output = (t + (t >> 8)) >> 8
+
+static inline unsigned int Fetch(const unsigned char* p, int channels)
+{
+    switch (channels) {
+        case 1: return p[0];
+        case 2: return p[0] | p[1] << 8;
+        case 3: return p[0] | p[1] << 8 | p[2] << 16;
+    }
+    unsigned int texel;
+    memcpy(&texel, p, 4);
+    return texel;
+}
+
+static inline void Store(unsigned char* p, unsigned int pixel, int channels)
+{
+    if (channels == 4) {
+        memcpy(p, &pixel, 4);
+        return;
+    }
+    for (int c = 0; c < channels; c++) {
+        p[c] = (unsigned char) (pixel >> (8 * c));
+    }
+}
+
+// Fetches the four bilinear taps, falling back to the background color
+// for pixels that don't sample the source image.
+static inline void FetchQuad(const WarpImage* src, const WarpTap* tap, unsigned int background,
+                             unsigned int* tl, unsigned int* tr, unsigned int* bl, unsigned int* br,
+                             int channels)
+{
+    if (!(tap->Flags & WARP_TAP_SOURCE)) {
+        *tl = *tr = *bl = *br = background;
+        return;
+    }
+    const unsigned char* top = src->Pixels + tap->Y * src->Stride + tap->X * channels;
+    const unsigned char* bottom = tap->Y + 1 < src->Height ? top + src->Stride : top;
+    int dx = tap->X + 1 < src->Width ? channels : 0;
+    *tl = Fetch(top, channels);
+    *tr = Fetch(top + dx, channels);
+    *bl = Fetch(bottom, channels);
+    *br = Fetch(bottom + dx, channels);
+}
+
+static inline unsigned int Pack(const unsigned char* color)
+{
+    return color[0] | color[1] << 8 | color[2] << 16 | (unsigned int) color[3] << 24;
+}
+
+static inline void GatherScalar(const WarpImage* src, const WarpTap* taps, const WarpFill* fill,
+                                unsigned char* dst, int count, int channels)
+{
+    unsigned int background = Pack(fill->Background);
+    for (int i = 0; i < count; i++, dst += channels) {
+        const WarpTap* tap = taps + i;
+        unsigned int tl, tr, bl, br;
+        FetchQuad(src, tap, background, &tl, &tr, &bl, &br, channels);
+        unsigned int fx = tap->FracX, fy = tap->FracY, c = tap->Coverage;
+        unsigned int pixel = 0;
+        for (int k = 0; k < channels; k++) {
+            int s = 8 * k;
+            unsigned int top = (((tl >> s) & 255) * (256 - fx) + ((tr >> s) & 255) * fx + 128) >> 8;
+            unsigned int bottom = (((bl >> s) & 255) * (256 - fx) + ((br >> s) & 255) * fx + 128) >> 8;
+            unsigned int texel = (top * (256 - fy) + bottom * fy + 128) >> 8;
+            unsigned int t = texel * c + fill->Border[k] * (255 - c) + 128;
+            pixel |= ((t + (t >> 8)) >> 8) << s;
+        }
+        Store(dst, pixel, channels);
+    }
+}
+
+#ifdef WARP_X86
+
+// Blends eight 16-bit lanes, each with its own weights and coverage.
+WARP_TARGET("sse2")
+static inline __m128i BlendLanesSSE2(__m128i tl, __m128i tr, __m128i bl, __m128i br,
+                                     __m128i fx, __m128i fy, __m128i c, __m128i border)
+{
+    const __m128i lo = _mm_set1_epi16(255);
+    const __m128i one = _mm_set1_epi16(256);
+    const __m128i half = _mm_set1_epi16(128);
+
+    __m128i gx = _mm_sub_epi16(one, fx);
+    __m128i gy = _mm_sub_epi16(one, fy);
+
+    __m128i top = _mm_add_epi16(_mm_mullo_epi16(tl, gx), _mm_mullo_epi16(tr, fx));
+    top = _mm_srli_epi16(_mm_add_epi16(top, half), 8);
+    __m128i bottom = _mm_add_epi16(_mm_mullo_epi16(bl, gx), _mm_mullo_epi16(br, fx));
+    bottom = _mm_srli_epi16(_mm_add_epi16(bottom, half), 8);
+    __m128i texel = _mm_add_epi16(_mm_mullo_epi16(top, gy), _mm_mullo_epi16(bottom, fy));
+    texel = _mm_srli_epi16(_mm_add_epi16(texel, half), 8);
+
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(texel, c), _mm_mullo_epi16(border, _mm_sub_epi16(lo, c)));
+    t = _mm_add_epi16(t, half);
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// Blends two pixels (eight 16-bit lanes) per register.
+WARP_TARGET("sse2")
+static inline __m128i BlendSSE2(__m128i tl, __m128i tr, __m128i bl, __m128i br,
+                                __m128i weights, __m128i border)
+{
+    const __m128i lo = _mm_set1_epi16(255);
+    __m128i fx = _mm_and_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(weights, 0xAA), 0xAA), lo);
+    __m128i fy = _mm_srli_epi16(_mm_shufflehi_epi16(_mm_shufflelo_epi16(weights, 0xAA), 0xAA), 8);
+    __m128i c = _mm_and_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(weights, 0xFF), 0xFF), lo);
+    return BlendLanesSSE2(tl, tr, bl, br, fx, fy, c, border);
+}
+
+// Eight output pixels per iteration.  SSE2 has no gather, so the taps are
+// fetched with scalar loads and everything else is done in 16-bit lanes.
+WARP_TARGET("sse2")
+static inline void GatherSSE2(const WarpImage* src, const WarpTap* taps, const WarpFill* fill,
+                              unsigned char* dst, int count, int channels)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned int background = Pack(fill->Background);
+    __m128i border = _mm_unpacklo_epi8(_mm_set1_epi32((int) Pack(fill->Border)), zero);
+    unsigned int tl[8], tr[8], bl[8], br[8], out[8];
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, dst += 8 * channels) {
+        for (int k = 0; k < 8; k++) {
+            FetchQuad(src, taps + i + k, background, tl + k, tr + k, bl + k, br + k, channels);
+        }
+        for (int k = 0; k < 8; k += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (tl + k));
+            __m128i b = _mm_loadu_si128((const __m128i*) (tr + k));
+            __m128i c = _mm_loadu_si128((const __m128i*) (bl + k));
+            __m128i d = _mm_loadu_si128((const __m128i*) (br + k));
+            __m128i w0 = _mm_loadu_si128((const __m128i*) (taps + i + k));
+            __m128i w1 = _mm_loadu_si128((const __m128i*) (taps + i + k + 2));
+            __m128i p0 = BlendSSE2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                   _mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero), w0, border);
+            __m128i p1 = BlendSSE2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                   _mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero), w1, border);
+            _mm_storeu_si128((__m128i*) (out + k), _mm_packus_epi16(p0, p1));
+        }
+        if (channels == 4) {
+            memcpy(dst, out, sizeof(out));
+        } else {
+            for (int k = 0; k < 8; k++) {
+                Store(dst + k * channels, out[k], channels);
+            }
+        }
+    }
+
+    GatherScalar(src, taps + i, fill, dst, count - i, channels);
+}
+
+// Blends four pixels (sixteen 16-bit lanes) per register.
+WARP_TARGET("avx2")
+static inline __m256i BlendAVX2(__m256i tl, __m256i tr, __m256i bl, __m256i br,
+                                __m256i fx, __m256i fy, __m256i c, __m256i border)
+{
+    const __m256i lo = _mm256_set1_epi16(255);
+    const __m256i one = _mm256_set1_epi16(256);
+    const __m256i half = _mm256_set1_epi16(128);
+    __m256i gx = _mm256_sub_epi16(one, fx);
+    __m256i gy = _mm256_sub_epi16(one, fy);
+
+    __m256i top = _mm256_add_epi16(_mm256_mullo_epi16(tl, gx), _mm256_mullo_epi16(tr, fx));
+    top = _mm256_srli_epi16(_mm256_add_epi16(top, half), 8);
+    __m256i bottom = _mm256_add_epi16(_mm256_mullo_epi16(bl, gx), _mm256_mullo_epi16(br, fx));
+    bottom = _mm256_srli_epi16(_mm256_add_epi16(bottom, half), 8);
+    __m256i texel = _mm256_add_epi16(_mm256_mullo_epi16(top, gy), _mm256_mullo_epi16(bottom, fy));
+    texel = _mm256_srli_epi16(_mm256_add_epi16(texel, half), 8);
+
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(texel, c),
+                                 _mm256_mullo_epi16(border, _mm256_sub_epi16(lo, c)));
+    t = _mm256_add_epi16(t, half);
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Corner texels and weights for eight taps of a four-channel image.
+typedef struct WarpQuadAVX2Rec {
+    __m256i Tl, Tr, Bl, Br;     // 32-bit texels
+    __m256i Fx, Fy, C;          // one byte per 32-bit lane
+} WarpQuadAVX2;
+
+WARP_TARGET("avx2")
+static inline WarpQuadAVX2 FetchQuadAVX2(const WarpImage* src, const WarpTap* taps, __m256i background)
+{
+    const __m256i lo = _mm256_set1_epi32(0xFFFF);
+    const __m256i bytes = _mm256_set1_epi32(255);
+    const __m256i source = _mm256_set1_epi32(WARP_TAP_SOURCE << 24);
+    const __m256i deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256i width = _mm256_set1_epi32(src->Width - 1);
+    const __m256i height = _mm256_set1_epi32(src->Height - 1);
+    const __m256i stride = _mm256_set1_epi32(src->Stride);
+    const __m256i four = _mm256_set1_epi32(4);
+    const int* base = (const int*) src->Pixels;
+
+    // Split eight taps into their (X,Y) and (Frac,Coverage) words.
+    __m256i t0 = _mm256_loadu_si256((const __m256i*) taps);
+    __m256i t1 = _mm256_loadu_si256((const __m256i*) (taps + 4));
+    t0 = _mm256_permutevar8x32_epi32(t0, deinterleave);
+    t1 = _mm256_permutevar8x32_epi32(t1, deinterleave);
+    __m256i xy = _mm256_permute2x128_si256(t0, t1, 0x20);
+    __m256i fc = _mm256_permute2x128_si256(t0, t1, 0x31);
+
+    __m256i x = _mm256_and_si256(xy, lo);
+    __m256i y = _mm256_srli_epi32(xy, 16);
+    __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(fc, source), source);
+    __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(y, stride), _mm256_slli_epi32(x, 2));
+    __m256i dx = _mm256_and_si256(_mm256_cmpgt_epi32(width, x), four);
+    __m256i dy = _mm256_and_si256(_mm256_cmpgt_epi32(height, y), stride);
+
+    WarpQuadAVX2 quad;
+    quad.Tl = _mm256_mask_i32gather_epi32(background, base, offset, mask, 1);
+    quad.Tr = _mm256_mask_i32gather_epi32(background, base, _mm256_add_epi32(offset, dx), mask, 1);
+    offset = _mm256_add_epi32(offset, dy);
+    quad.Bl = _mm256_mask_i32gather_epi32(background, base, offset, mask, 1);
+    quad.Br = _mm256_mask_i32gather_epi32(background, base, _mm256_add_epi32(offset, dx), mask, 1);
+
+    quad.Fx = _mm256_and_si256(fc, bytes);
+    quad.Fy = _mm256_and_si256(_mm256_srli_epi32(fc, 8), bytes);
+    quad.C = _mm256_and_si256(_mm256_srli_epi32(fc, 16), bytes);
+    return quad;
+}
+
+// Blends eight pixels and stores them.  The weights hold one byte per
+// channel, so each 16-bit lane can have its own.
+WARP_TARGET("avx2")
+static inline void BlendStoreAVX2(const WarpQuadAVX2* quad, __m256i fx, __m256i fy, __m256i c,
+                                  __m256i border, unsigned char* dst)
+{
+    __m256i result[2];
+    for (int q = 0; q < 2; q++) {
+        #define LANE(v) (q ? _mm256_extracti128_si256(v, 1) : _mm256_castsi256_si128(v))
+        result[q] = BlendAVX2(
+            _mm256_cvtepu8_epi16(LANE(quad->Tl)), _mm256_cvtepu8_epi16(LANE(quad->Tr)),
+            _mm256_cvtepu8_epi16(LANE(quad->Bl)), _mm256_cvtepu8_epi16(LANE(quad->Br)),
+            _mm256_cvtepu8_epi16(LANE(fx)), _mm256_cvtepu8_epi16(LANE(fy)),
+            _mm256_cvtepu8_epi16(LANE(c)), border);
+        #undef LANE
+    }
+
+    // packus works within 128-bit halves, so put the pixels back in order.
+    __m256i packed = _mm256_packus_epi16(result[0], result[1]);
+    packed = _mm256_permute4x64_epi64(packed, 0xD8);
+    _mm256_storeu_si256((__m256i*) dst, packed);
+}
+
+// Copies the low byte of each 32-bit lane into all four bytes.
+WARP_TARGET("avx2")
+static inline __m256i Splat32(__m256i v)
+{
+    return _mm256_mullo_epi32(v, _mm256_set1_epi32(0x01010101));
+}
+
+// Sixteen output pixels per iteration, using hardware gathers for the taps.
+// Only four-channel images can be gathered as whole 32-bit texels; the
+// others go through the SSE2 kernel.
+WARP_TARGET("avx2")
+static void GatherAVX2(const WarpImage* src, const WarpTap* taps, const WarpFill* fill,
+                       unsigned char* dst, int count)
+{
+    const __m256i background = _mm256_set1_epi32((int) Pack(fill->Background));
+    const __m256i border = _mm256_cvtepu8_epi16(_mm_set1_epi32((int) Pack(fill->Border)));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, dst += 32) {
+        WarpQuadAVX2 quad = FetchQuadAVX2(src, taps + i, background);
+        BlendStoreAVX2(&quad, Splat32(quad.Fx), Splat32(quad.Fy), Splat32(quad.C), border, dst);
+    }
+
+    GatherScalar(src, taps + i, fill, dst, count - i, 4);
+}
+
+#endif
+
+// The channel count is a literal in each call so the inlined kernels
+// are specialized for it.
+#define DISPATCH(kernel) \
+    switch (src->Channels) { \
+        case 1: kernel(src, taps, fill, dst, count, 1); break; \
+        case 2: kernel(src, taps, fill, dst, count, 2); break; \
+        case 3: kernel(src, taps, fill, dst, count, 3); break; \
+        case 4: kernel(src, taps, fill, dst, count, 4); break; \
+    }
+
+void warpGather(const WarpImage* src, const WarpTap* taps, const WarpFill* fill,
+                unsigned char* dst, int count)
+{
+    WarpFill defaultFill;
+    if (!fill) {
+        defaultFill = warpDefaultFill();
+        fill = &defaultFill;
+    }
+
+    switch (warpGetIsa()) {
+#ifdef WARP_X86
+        case WARP_ISA_AVX2:
+            if (src->Channels == 4) {
+                GatherAVX2(src, taps, fill, dst, count);
+                return;
+            }
+            // fall through
+        case WARP_ISA_SSE2:
+            DISPATCH(GatherSSE2);
+            return;
+#endif
+        default:
+            DISPATCH(GatherScalar);
+            return;
+    }
+}
+
+#undef DISPATCH
+
+static inline unsigned char BlendChannel(unsigned int tl, unsigned int tr, unsigned int bl,
+                                         unsigned int br, const WarpTap* tap,
+                                         unsigned int border, int shift)
+{
+    unsigned int fx = tap->FracX, fy = tap->FracY, c = tap->Coverage;
+    unsigned int top = (((tl >> shift) & 255) * (256 - fx) + ((tr >> shift) & 255) * fx + 128) >> 8;
+    unsigned int bottom = (((bl >> shift) & 255) * (256 - fx) + ((br >> shift) & 255) * fx + 128) >> 8;
+    unsigned int texel = (top * (256 - fy) + bottom * fy + 128) >> 8;
+    unsigned int t = texel * c + border * (255 - c) + 128;
+    return (unsigned char) ((t + (t >> 8)) >> 8);
+}
+
+// Same arithmetic as GatherScalar, but red, green and blue each have their
+// own taps.  A fourth channel follows green.
+static void GatherChroma(const WarpImage* src, const WarpTap* const* taps, const WarpFill* fill,
+                         unsigned char* dst, int count)
+{
+    int channels = src->Channels;
+    unsigned int background = Pack(fill->Background);
+    for (int i = 0; i < count; i++, dst += channels) {
+        for (int k = 0; k < 3; k++) {
+            const WarpTap* tap = taps[k] + i;
+            unsigned int tl, tr, bl, br;
+            FetchQuad(src, tap, background, &tl, &tr, &bl, &br, channels);
+            dst[k] = BlendChannel(tl, tr, bl, br, tap, fill->Border[k], 8 * k);
+            if (k == 1 && channels == 4) {
+                dst[3] = BlendChannel(tl, tr, bl, br, tap, fill->Border[3], 24);
+            }
+        }
+    }
+}
+
+#ifdef WARP_X86
+
+// Eight output pixels per iteration, like GatherSSE2.  Each corner texel
+// is stitched together from fetches through each channel's tap, with alpha
+// riding along with green, and the weights are spread per lane instead of
+// per pixel.
+WARP_TARGET("sse2")
+static inline void GatherChromaSSE2(const WarpImage* src, const WarpTap* const* taps,
+                                    const WarpFill* fill, unsigned char* dst, int count, int channels)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned int background = Pack(fill->Background);
+    __m128i border = _mm_unpacklo_epi8(_mm_set1_epi32((int) Pack(fill->Border)), zero);
+    unsigned int tl[8], tr[8], bl[8], br[8], out[8];
+    unsigned short fx[32], fy[32], cover[32];
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, dst += 8 * channels) {
+        for (int k = 0; k < 8; k++) {
+            unsigned int a = 0, b = 0, d = 0, e = 0;
+            for (int c = 0; c < 3; c++) {
+                const WarpTap* tap = taps[c] + i + k;
+                unsigned int mask = channels == 4 && c == 1 ? 0xFF00FF00 : 255u << (8 * c);
+                if (tap->Flags & WARP_TAP_SOURCE) {
+                    const unsigned char* top = src->Pixels + tap->Y * src->Stride + tap->X * channels;
+                    const unsigned char* bottom = tap->Y + 1 < src->Height ? top + src->Stride : top;
+                    int dx = tap->X + 1 < src->Width ? channels : 0;
+                    if (channels == 4) {
+                        a |= Fetch(top, 4) & mask;
+                        b |= Fetch(top + dx, 4) & mask;
+                        d |= Fetch(bottom, 4) & mask;
+                        e |= Fetch(bottom + dx, 4) & mask;
+                    } else {
+                        a |= (unsigned int) top[c] << (8 * c);
+                        b |= (unsigned int) top[dx + c] << (8 * c);
+                        d |= (unsigned int) bottom[c] << (8 * c);
+                        e |= (unsigned int) bottom[dx + c] << (8 * c);
+                    }
+                } else {
+                    a |= background & mask;
+                    b |= background & mask;
+                    d |= background & mask;
+                    e |= background & mask;
+                }
+                fx[4 * k + c] = tap->FracX;
+                fy[4 * k + c] = tap->FracY;
+                cover[4 * k + c] = tap->Coverage;
+            }
+            fx[4 * k + 3] = fx[4 * k + 1];
+            fy[4 * k + 3] = fy[4 * k + 1];
+            cover[4 * k + 3] = cover[4 * k + 1];
+            tl[k] = a;
+            tr[k] = b;
+            bl[k] = d;
+            br[k] = e;
+        }
+        for (int k = 0; k < 8; k += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (tl + k));
+            __m128i b = _mm_loadu_si128((const __m128i*) (tr + k));
+            __m128i c = _mm_loadu_si128((const __m128i*) (bl + k));
+            __m128i d = _mm_loadu_si128((const __m128i*) (br + k));
+            const unsigned short* w = fx + 4 * k;
+            __m128i p0 = BlendLanesSSE2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                        _mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero),
+                                        _mm_loadu_si128((const __m128i*) w),
+                                        _mm_loadu_si128((const __m128i*) (fy + 4 * k)),
+                                        _mm_loadu_si128((const __m128i*) (cover + 4 * k)), border);
+            __m128i p1 = BlendLanesSSE2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                        _mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero),
+                                        _mm_loadu_si128((const __m128i*) (w + 8)),
+                                        _mm_loadu_si128((const __m128i*) (fy + 4 * k + 8)),
+                                        _mm_loadu_si128((const __m128i*) (cover + 4 * k + 8)), border);
+            _mm_storeu_si128((__m128i*) (out + k), _mm_packus_epi16(p0, p1));
+        }
+        if (channels == 4) {
+            memcpy(dst, out, sizeof(out));
+        } else {
+            for (int k = 0; k < 8; k++) {
+                Store(dst + k * channels, out[k], channels);
+            }
+        }
+    }
+
+    const WarpTap* rest[3] = {taps[0] + i, taps[1] + i, taps[2] + i};
+    GatherChroma(src, rest, fill, dst, count - i);
+}
+
+// Eight four-channel pixels per iteration: one set of gathers per channel's
+// taps, stitched together with byte masks before a single blend.
+WARP_TARGET("avx2")
+static void GatherChromaAVX2(const WarpImage* src, const WarpTap* const* taps, const WarpFill* fill,
+                             unsigned char* dst, int count)
+{
+    const __m256i background = _mm256_set1_epi32((int) Pack(fill->Background));
+    const __m256i border = _mm256_cvtepu8_epi16(_mm_set1_epi32((int) Pack(fill->Border)));
+    const __m256i red = _mm256_set1_epi32(0x000000FF);
+    const __m256i green = _mm256_set1_epi32(0xFF00FF00);
+    const __m256i blue = _mm256_set1_epi32(0x00FF0000);
+    const __m256i greenWeights = _mm256_set1_epi32(0x01000100);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, dst += 32) {
+        WarpQuadAVX2 r = FetchQuadAVX2(src, taps[0] + i, background);
+        WarpQuadAVX2 g = FetchQuadAVX2(src, taps[1] + i, background);
+        WarpQuadAVX2 b = FetchQuadAVX2(src, taps[2] + i, background);
+
+        #define STITCH(f) _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(r.f, red), \
+            _mm256_and_si256(g.f, green)), _mm256_and_si256(b.f, blue))
+        #define WEIGHTS(f) _mm256_or_si256(_mm256_or_si256(r.f, \
+            _mm256_mullo_epi32(g.f, greenWeights)), _mm256_slli_epi32(b.f, 16))
+        WarpQuadAVX2 quad = {STITCH(Tl), STITCH(Tr), STITCH(Bl), STITCH(Br)};
+        BlendStoreAVX2(&quad, WEIGHTS(Fx), WEIGHTS(Fy), WEIGHTS(C), border, dst);
+        #undef STITCH
+        #undef WEIGHTS
+    }
+
+    const WarpTap* rest[3] = {taps[0] + i, taps[1] + i, taps[2] + i};
+    GatherChroma(src, rest, fill, dst, count - i);
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Driver
+
+int warpBarrel(const WarpImage* src, WarpImage* dst, float barrelPower, const WarpFill* fill)
+{
+    if (src->Channels != dst->Channels || src->Channels < 1 || src->Channels > 4 ||
+        src->Width < 1 || src->Height < 1 || src->Width > 65535 || src->Height > 65535) {
+        return 0;
+    }
+
+    WarpTap* taps = (WarpTap*) malloc(sizeof(WarpTap) * dst->Width * WARP_BAND_ROWS);
+    if (!taps) {
+        return 0;
+    }
+
+    for (int row = 0; row < dst->Height; row += WARP_BAND_ROWS) {
+        int rowCount = dst->Height - row < WARP_BAND_ROWS ? dst->Height - row : WARP_BAND_ROWS;
+        if (!warpBarrelTaps(taps, row, rowCount, dst->Width, dst->Height,
+                            src->Width, src->Height, barrelPower)) {
+            free(taps);
+            return 0;
+        }
+        for (int j = 0; j < rowCount; j++) {
+            unsigned char* scanline = dst->Pixels + (row + j) * dst->Stride;
+            warpGather(src, taps + j * dst->Width, fill, scanline, dst->Width);
+        }
+    }
+
+    free(taps);
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Remap tables
+
+static WarpMap* CreateMap(const WarpLens* lens, float power, int width, int height,
+                          int srcWidth, int srcHeight)
+{
+    WarpMap* map = (WarpMap*) calloc(1, sizeof(WarpMap));
+    float* points = (float*) malloc(sizeof(float) * 2 * (width + 1) * (WARP_BAND_ROWS + 1));
+    if (map) {
+        map->Taps = (WarpTap*) malloc(sizeof(WarpTap) * width * height);
+    }
+    if (!map || !map->Taps || !points) {
+        warpDestroyMap(map);
+        free(points);
+        return 0;
+    }
+
+    map->Power = power;
+    map->Width = width;
+    map->Height = height;
+    map->SrcWidth = srcWidth;
+    map->SrcHeight = srcHeight;
+
+    // Build in bands to keep the scratch rows small.
+    for (int row = 0; row < height; row += WARP_BAND_ROWS) {
+        int rowCount = height - row < WARP_BAND_ROWS ? height - row : WARP_BAND_ROWS;
+        RectTaps(map->Taps + row * width, 0, row, width, rowCount, width, height,
+                 srcWidth, srcHeight, lens, points);
+    }
+
+    free(points);
+    return map;
+}
+
+WarpMap* warpCreateMap(float barrelPower, int width, int height, int srcWidth, int srcHeight)
+{
+    WarpLens lens = BarrelLens(barrelPower);
+    return CreateMap(&lens, barrelPower, width, height, srcWidth, srcHeight);
+}
+
+// For inverse maps the iterative solve runs once per pixel here, and never
+// again when the map is applied.
+WarpMap* warpCreateLensMap(const LensModel* model, int inverse, float tolerance,
+                           int width, int height, int srcWidth, int srcHeight)
+{
+    WarpLens lens = {*model, inverse, tolerance, lensNoChroma(), 1};
+    float power = model->Type == LENS_POWER ? model->Power : 0;
+    return CreateMap(&lens, power, width, height, srcWidth, srcHeight);
+}
+
+void warpDestroyMap(WarpMap* map)
+{
+    if (map) {
+        free(map->Taps);
+        free(map);
+    }
+}
+
+void warpGridVertices(int layout, float barrelPower, int rows, int columns,
+                      float* positions, float* texCoords)
+{
+    int count = (columns + 1) * (rows + 1);
+    float* p = positions;
+    for (int i = 0; i <= columns; i++) {
+        for (int j = 0; j <= rows; j++, p += 2) {
+            float x = i * 2.0f / columns - 1.0f;
+            float y = j * 2.0f / rows - 1.0f;
+            if (layout == WARP_GRID_NONUNIFORM) {
+                x = x * fabsf(x);
+                y = y * fabsf(y);
+            }
+            p[0] = x;
+            p[1] = y;
+        }
+    }
+    memcpy(texCoords, positions, sizeof(float) * 2 * count);
+
+    // The pincushion grid is regular on screen and distorts its texture
+    // coordinates; the others distort their positions the opposite way.
+    if (layout == WARP_GRID_PINCUSHION) {
+        lensDistortReference(texCoords, count, barrelPower);
+    } else {
+        lensDistortReference(positions, count, 1.0f / barrelPower);
+    }
+}
+
+void warpGridIndices(int rows, int columns, unsigned int* indices)
+{
+    int vps = rows + 1;
+    for (int i = 0; i < columns; i++) {
+        int n = i * vps;
+        for (int j = 0; j < rows; j++) {
+            *indices++ = n + j + vps;
+            *indices++ = n + j + 1;
+            *indices++ = n + j;
+            *indices++ = n + j + 1 + vps;
+            *indices++ = n + j + 1;
+            *indices++ = n + j + vps;
+        }
+    }
+}
+
+// Fills the pixels whose centers fall inside a triangle, interpolating the
+// texture coordinates like the rasterizer does.
+static void RasterizeTriangle(WarpMap* map, const float* positions, const float* texCoords,
+                              int a, int b, int c)
+{
+    const int v[3] = {a, b, c};
+    float x[3], y[3];
+    for (int k = 0; k < 3; k++) {
+        x[k] = 0.5f * (positions[2 * v[k]] + 1.0f) * map->Width;
+        y[k] = 0.5f * (positions[2 * v[k] + 1] + 1.0f) * map->Height;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) {
+        return;
+    }
+
+    float minX = fminf(x[0], fminf(x[1], x[2])), maxX = fmaxf(x[0], fmaxf(x[1], x[2]));
+    float minY = fminf(y[0], fminf(y[1], y[2])), maxY = fmaxf(y[0], fmaxf(y[1], y[2]));
+    int i0 = (int) ceilf(minX - 0.5f), i1 = (int) floorf(maxX - 0.5f);
+    int j0 = (int) ceilf(minY - 0.5f), j1 = (int) floorf(maxY - 0.5f);
+    i0 = i0 < 0 ? 0 : i0;
+    j0 = j0 < 0 ? 0 : j0;
+    i1 = i1 >= map->Width ? map->Width - 1 : i1;
+    j1 = j1 >= map->Height ? map->Height - 1 : j1;
+
+    for (int j = j0; j <= j1; j++) {
+        for (int i = i0; i <= i1; i++) {
+            float px = i + 0.5f, py = j + 0.5f;
+            float w[3];
+            for (int k = 0; k < 3; k++) {
+                int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+                w[k] = ((x[k2] - x[k1]) * (py - y[k1]) - (px - x[k1]) * (y[k2] - y[k1])) / area;
+            }
+            if (w[0] < 0 || w[1] < 0 || w[2] < 0) {
+                continue;
+            }
+
+            float s = 0, t = 0;
+            for (int k = 0; k < 3; k++) {
+                s += w[k] * 0.5f * (texCoords[2 * v[k]] + 1.0f);
+                t += w[k] * 0.5f * (texCoords[2 * v[k] + 1] + 1.0f);
+            }
+
+            // Like Quad.FS in the pincushion demo, coordinates outside the
+            // texture get the border color.
+            WarpTap* tap = map->Taps + j * map->Width + i;
+            memset(tap, 0, sizeof(WarpTap));
+            if (s < 0 || s > 1 || t < 0 || t > 1) {
+                continue;
+            }
+            tap->Coverage = 255;
+            tap->Flags = WARP_TAP_SOURCE;
+            tap->X = TexelFixed(s, map->SrcWidth, &tap->FracX);
+            tap->Y = TexelFixed(t, map->SrcHeight, &tap->FracY);
+        }
+    }
+}
+
+WarpMap* warpCreateGridMap(int layout, float barrelPower, int rows, int columns,
+                           int width, int height, int srcWidth, int srcHeight)
+{
+    int count = (columns + 1) * (rows + 1);
+    WarpMap* map = (WarpMap*) calloc(1, sizeof(WarpMap));
+    float* positions = (float*) malloc(sizeof(float) * 2 * count);
+    float* texCoords = (float*) malloc(sizeof(float) * 2 * count);
+    unsigned int* indices = (unsigned int*) malloc(sizeof(unsigned int) * 6 * rows * columns);
+    if (map) {
+        map->Taps = (WarpTap*) malloc(sizeof(WarpTap) * width * height);
+    }
+    if (!map || !map->Taps || !positions || !texCoords || !indices) {
+        warpDestroyMap(map);
+        free(positions);
+        free(texCoords);
+        free(indices);
+        return 0;
+    }
+
+    map->Power = barrelPower;
+    map->Width = width;
+    map->Height = height;
+    map->SrcWidth = srcWidth;
+    map->SrcHeight = srcHeight;
+
+    // Pixels outside the mesh show the background.
+    for (int i = 0; i < width * height; i++) {
+        memset(map->Taps + i, 0, sizeof(WarpTap));
+        map->Taps[i].Coverage = 255;
+    }
+
+    warpGridVertices(layout, barrelPower, rows, columns, positions, texCoords);
+    warpGridIndices(rows, columns, indices);
+    for (int i = 0; i < 6 * rows * columns; i += 3) {
+        RasterizeTriangle(map, positions, texCoords, indices[i], indices[i + 1], indices[i + 2]);
+    }
+
+    free(positions);
+    free(texCoords);
+    free(indices);
+    return map;
+}
+
+int warpApplyMap(const WarpImage* src, const WarpMap* map, WarpImage* dst, const WarpFill* fill)
+{
+    if (src->Channels != dst->Channels || src->Channels < 1 || src->Channels > 4 ||
+        src->Width != map->SrcWidth || src->Height != map->SrcHeight ||
+        dst->Width != map->Width || dst->Height != map->Height) {
+        return 0;
+    }
+
+    for (int row = 0; row < dst->Height; row++) {
+        unsigned char* scanline = dst->Pixels + row * dst->Stride;
+        warpGather(src, map->Taps + row * map->Width, fill, scanline, map->Width);
+    }
+
+    return 1;
+}
+
+// The three maps share everything but the chroma shift, so the lens itself
+// is evaluated three times here and never when the maps are applied.
+int warpCreateChromaMaps(const LensModel* model, const LensChroma* chroma,
+                         int width, int height, int srcWidth, int srcHeight, WarpMap** maps)
+{
+    float power = model->Type == LENS_POWER ? model->Power : 0;
+    for (int c = 0; c < 3; c++) {
+        WarpLens lens = {*model, 0, 0, *chroma, c};
+        maps[c] = CreateMap(&lens, power, width, height, srcWidth, srcHeight);
+        if (!maps[c]) {
+            while (c--) {
+                warpDestroyMap(maps[c]);
+                maps[c] = 0;
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int warpApplyChromaMaps(const WarpImage* src, WarpMap* const* maps, WarpImage* dst, const WarpFill* fill)
+{
+    if (src->Channels != dst->Channels || src->Channels < 3 || src->Channels > 4) {
+        return 0;
+    }
+    for (int c = 0; c < 3; c++) {
+        if (src->Width != maps[c]->SrcWidth || src->Height != maps[c]->SrcHeight ||
+            dst->Width != maps[c]->Width || dst->Height != maps[c]->Height) {
+            return 0;
+        }
+    }
+
+    WarpFill defaultFill;
+    if (!fill) {
+        defaultFill = warpDefaultFill();
+        fill = &defaultFill;
+    }
+
+    for (int row = 0; row < dst->Height; row++) {
+        const WarpTap* taps[3];
+        for (int c = 0; c < 3; c++) {
+            taps[c] = maps[c]->Taps + row * dst->Width;
+        }
+        unsigned char* scanline = dst->Pixels + row * dst->Stride;
+#ifdef WARP_X86
+        if (warpGetIsa() == WARP_ISA_AVX2 && src->Channels == 4) {
+            GatherChromaAVX2(src, taps, fill, scanline, dst->Width);
+            continue;
+        }
+        if (warpGetIsa() != WARP_ISA_SCALAR) {
+            if (src->Channels == 4) {
+                GatherChromaSSE2(src, taps, fill, scanline, dst->Width, 4);
+            } else {
+                GatherChromaSSE2(src, taps, fill, scanline, dst->Width, 3);
+            }
+            continue;
+        }
+#endif
+        GatherChroma(src, taps, fill, scanline, dst->Width);
+    }
+
+    return 1;
+}
+
+struct WarpCacheRec {
+    int Capacity;
+    float PowerStep;
+    unsigned int Clock;
+    WarpMap** Maps;
+    unsigned int* LastUse;
+};
+
+WarpCache* warpCreateCache(int capacity, float powerStep)
+{
+    WarpCache* cache = (WarpCache*) calloc(1, sizeof(WarpCache));
+    if (!cache) {
+        return 0;
+    }
+
+    cache->Capacity = capacity;
+    cache->PowerStep = powerStep;
+    cache->Maps = (WarpMap**) calloc(capacity, sizeof(WarpMap*));
+    cache->LastUse = (unsigned int*) calloc(capacity, sizeof(unsigned int));
+    if (!cache->Maps || !cache->LastUse) {
+        warpDestroyCache(cache);
+        return 0;
+    }
+
+    return cache;
+}
+
+void warpDestroyCache(WarpCache* cache)
+{
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; cache->Maps && i < cache->Capacity; i++) {
+        warpDestroyMap(cache->Maps[i]);
+    }
+    free(cache->Maps);
+    free(cache->LastUse);
+    free(cache);
+}
+
+const WarpMap* warpCacheMap(WarpCache* cache, float barrelPower,
+                            int width, int height, int srcWidth, int srcHeight)
+{
+    if (cache->PowerStep > 0) {
+        barrelPower = cache->PowerStep * floorf(barrelPower / cache->PowerStep + 0.5f);
+    }
+
+    int victim = 0;
+    for (int i = 0; i < cache->Capacity; i++) {
+        WarpMap* map = cache->Maps[i];
+        if (map && map->Power == barrelPower &&
+            map->Width == width && map->Height == height &&
+            map->SrcWidth == srcWidth && map->SrcHeight == srcHeight) {
+            cache->LastUse[i] = ++cache->Clock;
+            return map;
+        }
+        if (!map || (cache->Maps[victim] && cache->LastUse[i] < cache->LastUse[victim])) {
+            victim = i;
+        }
+    }
+
+    WarpMap* map = warpCreateMap(barrelPower, width, height, srcWidth, srcHeight);
+    if (!map) {
+        return 0;
+    }
+
+    warpDestroyMap(cache->Maps[victim]);
+    cache->Maps[victim] = map;
+    cache->LastUse[victim] = ++cache->Clock;
+    return map;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Remap banks
+
+// Interpolates coordinates only where both taps sample the source image;
+// elsewhere the nearer tap wins.  The coverage is always interpolated.
+void warpBlendTaps(const WarpTap* a, const WarpTap* b, float t, WarpTap* taps, int count)
+{
+    long long w = (long long) (t * 256.0f + 0.5f);
+    for (int i = 0; i < count; i++, a++, b++) {
+        WarpTap tap = w < 128 ? *a : *b;
+        tap.Coverage = (unsigned char) ((a->Coverage * (256 - w) + b->Coverage * w + 128) >> 8);
+        if (a->Flags & b->Flags & WARP_TAP_SOURCE) {
+            long long ax = a->X << 8 | a->FracX, bx = b->X << 8 | b->FracX;
+            long long ay = a->Y << 8 | a->FracY, by = b->Y << 8 | b->FracY;
+            int x = (int) ((ax * (256 - w) + bx * w + 128) >> 8);
+            int y = (int) ((ay * (256 - w) + by * w + 128) >> 8);
+            tap.X = (unsigned short) (x >> 8);
+            tap.Y = (unsigned short) (y >> 8);
+            tap.FracX = (unsigned char) (x & 255);
+            tap.FracY = (unsigned char) (y & 255);
+        }
+        taps[i] = tap;
+    }
+}
+
+// Largest difference in source texels between the midpoint blend of two
+// maps and the exact map.
+static float MidpointError(const WarpMap* a, const WarpMap* b, const WarpMap* exact, WarpTap* scratch)
+{
+    int worst = 0;
+    for (int row = 0; row < exact->Height; row++) {
+        int offset = row * exact->Width;
+        warpBlendTaps(a->Taps + offset, b->Taps + offset, 0.5f, scratch, exact->Width);
+        for (int i = 0; i < exact->Width; i++) {
+            const WarpTap* e = exact->Taps + offset + i;
+            const WarpTap* s = scratch + i;
+            if (!(e->Flags & s->Flags & WARP_TAP_SOURCE)) {
+                continue;
+            }
+            int dx = abs((s->X << 8 | s->FracX) - (e->X << 8 | e->FracX));
+            int dy = abs((s->Y << 8 | s->FracY) - (e->Y << 8 | e->FracY));
+            worst = dx > worst ? dx : worst;
+            worst = dy > worst ? dy : worst;
+        }
+    }
+    return worst / 256.0f;
+}
+
+// Starts with the two endpoints and keeps doubling the sampling density
+// until the midpoint error is within bounds or maxCount would be exceeded.
+WarpBank* warpCreateBank(float minPower, float maxPower, float maxError, int maxCount,
+                         int width, int height, int srcWidth, int srcHeight)
+{
+    WarpBank* bank = (WarpBank*) calloc(1, sizeof(WarpBank));
+    WarpTap* scratch = (WarpTap*) malloc(sizeof(WarpTap) * width);
+    if (!bank || !scratch) {
+        free(bank);
+        free(scratch);
+        return 0;
+    }
+
+    bank->MinPower = minPower;
+    bank->MaxPower = maxPower;
+    bank->Count = 2;
+    bank->Maps = (WarpMap**) calloc(2, sizeof(WarpMap*));
+    bank->Maps[0] = warpCreateMap(minPower, width, height, srcWidth, srcHeight);
+    bank->Maps[1] = warpCreateMap(maxPower, width, height, srcWidth, srcHeight);
+    bool ok = bank->Maps[0] && bank->Maps[1];
+
+    while (ok) {
+        int count = 2 * bank->Count - 1;
+        WarpMap** maps = (WarpMap**) calloc(count, sizeof(WarpMap*));
+        if (!maps) {
+            ok = false;
+            break;
+        }
+
+        float error = 0;
+        for (int i = 0; i < bank->Count; i++) {
+            maps[2 * i] = bank->Maps[i];
+            if (i + 1 == bank->Count) {
+                break;
+            }
+            float t = (2 * i + 1) / (float) (count - 1);
+            WarpMap* mid = warpCreateMap(minPower + t * (maxPower - minPower),
+                                         width, height, srcWidth, srcHeight);
+            if (!mid) {
+                ok = false;
+                break;
+            }
+            maps[2 * i + 1] = mid;
+            float e = MidpointError(bank->Maps[i], bank->Maps[i + 1], mid, scratch);
+            error = e > error ? e : error;
+        }
+
+        bank->MaxError = error;
+        if (!ok || error <= maxError || count > maxCount) {
+            for (int i = 1; i < count; i += 2) {
+                warpDestroyMap(maps[i]);
+            }
+            free(maps);
+            break;
+        }
+
+        free(bank->Maps);
+        bank->Maps = maps;
+        bank->Count = count;
+    }
+
+    free(scratch);
+    if (!ok) {
+        warpDestroyBank(bank);
+        return 0;
+    }
+    return bank;
+}
+
+void warpDestroyBank(WarpBank* bank)
+{
+    if (!bank) {
+        return;
+    }
+    for (int i = 0; bank->Maps && i < bank->Count; i++) {
+        warpDestroyMap(bank->Maps[i]);
+    }
+    free(bank->Maps);
+    free(bank);
+}
+
+// Fractional index of the given power within the bank, clamped to its range.
+float warpBankPosition(const WarpBank* bank, float barrelPower)
+{
+    float t = (barrelPower - bank->MinPower) / (bank->MaxPower - bank->MinPower);
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    return t * (bank->Count - 1);
+}
+
+int warpApplyBank(const WarpImage* src, const WarpBank* bank, float barrelPower,
+                  WarpImage* dst, const WarpFill* fill)
+{
+    const WarpMap* first = bank->Maps[0];
+    if (src->Channels != dst->Channels || src->Channels < 1 || src->Channels > 4 ||
+        src->Width != first->SrcWidth || src->Height != first->SrcHeight ||
+        dst->Width != first->Width || dst->Height != first->Height) {
+        return 0;
+    }
+
+    float position = warpBankPosition(bank, barrelPower);
+    int index = (int) position;
+    index = index > bank->Count - 2 ? bank->Count - 2 : index;
+    float t = position - index;
+    const WarpMap* a = bank->Maps[index];
+    const WarpMap* b = bank->Maps[index + 1];
+
+    WarpTap* taps = (WarpTap*) malloc(sizeof(WarpTap) * dst->Width);
+    if (!taps) {
+        return 0;
+    }
+
+    for (int row = 0; row < dst->Height; row++) {
+        int offset = row * dst->Width;
+        warpBlendTaps(a->Taps + offset, b->Taps + offset, t, taps, dst->Width);
+        warpGather(src, taps, fill, dst->Pixels + row * dst->Stride, dst->Width);
+    }
+
+    free(taps);
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tiled driver
+//
+// Each thread owns a contiguous range of tile indices.  The owner takes tiles
+// from the bottom of its range and idle threads steal from the top, so the
+// expensive tiles near the edges get spread across cores.  Since no tiles are
+// added during a frame, a range fits in one 64-bit word that both ends update
+// with compare-and-swap.
+
+typedef struct WarpWorkerRec {
+    struct WarpPoolRec* Pool;
+    int Index;
+    pthread_t Thread;
+    unsigned long long Range;   // top << 32 | bottom
+    WarpTap* Taps;
+    float* Points;
+} WarpWorker;
+
+typedef struct WarpJobRec {
+    const WarpImage* Src;
+    WarpImage* Dst;
+    const WarpFill* Fill;
+    WarpLens Lens;
+    int TileSize;
+    int TilesX;
+    WarpTileStats* Stats;
+} WarpJob;
+
+struct WarpPoolRec {
+    int ThreadCount;
+    int ScratchSize;            // tile size that the scratch buffers fit
+    WarpWorker* Workers;
+    pthread_mutex_t Lock;
+    pthread_cond_t Start;
+    pthread_cond_t Done;
+    int Generation;
+    int Busy;
+    bool Quit;
+    WarpJob Job;
+};
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns the next tile index or -1 if the range is empty.
+static int TakeTile(WarpWorker* worker, bool steal)
+{
+    unsigned long long range = __atomic_load_n(&worker->Range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        unsigned int top = (unsigned int) (range >> 32);
+        unsigned int bottom = (unsigned int) range;
+        if (top >= bottom) {
+            return -1;
+        }
+        unsigned long long next = steal ? range + (1ull << 32) : range - 1;
+        if (__atomic_compare_exchange_n(&worker->Range, &range, next, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return steal ? (int) top : (int) bottom - 1;
+        }
+    }
+}
+
+static void RunTile(WarpWorker* worker, int tile, bool stolen)
+{
+    const WarpJob* job = &worker->Pool->Job;
+    const WarpImage* src = job->Src;
+    WarpImage* dst = job->Dst;
+    double start = Now();
+
+    int x0 = (tile % job->TilesX) * job->TileSize;
+    int y0 = (tile / job->TilesX) * job->TileSize;
+    int cols = dst->Width - x0 < job->TileSize ? dst->Width - x0 : job->TileSize;
+    int rows = dst->Height - y0 < job->TileSize ? dst->Height - y0 : job->TileSize;
+
+    RectTaps(worker->Taps, x0, y0, cols, rows, dst->Width, dst->Height,
+             src->Width, src->Height, &job->Lens, worker->Points);
+    for (int j = 0; j < rows; j++) {
+        unsigned char* scanline = dst->Pixels + (y0 + j) * dst->Stride + x0 * dst->Channels;
+        warpGather(src, worker->Taps + j * cols, job->Fill, scanline, cols);
+    }
+
+    if (job->Stats) {
+        WarpTileStats* stats = job->Stats + tile;
+        stats->X = x0;
+        stats->Y = y0;
+        stats->Width = cols;
+        stats->Height = rows;
+        stats->Thread = worker->Index;
+        stats->Stolen = stolen;
+        stats->Seconds = Now() - start;
+    }
+}
+
+static void RunTiles(WarpWorker* worker)
+{
+    WarpPool* pool = worker->Pool;
+    for (;;) {
+        int tile = TakeTile(worker, false);
+        if (tile >= 0) {
+            RunTile(worker, tile, false);
+            continue;
+        }
+        for (int i = 1; i < pool->ThreadCount && tile < 0; i++) {
+            WarpWorker* victim = pool->Workers + (worker->Index + i) % pool->ThreadCount;
+            tile = TakeTile(victim, true);
+        }
+        if (tile < 0) {
+            return;
+        }
+        RunTile(worker, tile, true);
+    }
+}
+
+static void* WorkerMain(void* arg)
+{
+    WarpWorker* worker = (WarpWorker*) arg;
+    WarpPool* pool = worker->Pool;
+    int generation = 0;
+
+    pthread_mutex_lock(&pool->Lock);
+    for (;;) {
+        while (pool->Generation == generation && !pool->Quit) {
+            pthread_cond_wait(&pool->Start, &pool->Lock);
+        }
+        if (pool->Quit) {
+            break;
+        }
+        generation = pool->Generation;
+        pthread_mutex_unlock(&pool->Lock);
+
+        RunTiles(worker);
+
+        pthread_mutex_lock(&pool->Lock);
+        if (--pool->Busy == 0) {
+            pthread_cond_signal(&pool->Done);
+        }
+    }
+    pthread_mutex_unlock(&pool->Lock);
+    return 0;
+}
+
+WarpPool* warpCreatePool(int threadCount)
+{
+    if (threadCount <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cores > 0 ? (int) cores : 1;
+    }
+
+    WarpPool* pool = (WarpPool*) calloc(1, sizeof(WarpPool));
+    if (!pool) {
+        return 0;
+    }
+    pool->Workers = (WarpWorker*) calloc(threadCount, sizeof(WarpWorker));
+    if (!pool->Workers) {
+        free(pool);
+        return 0;
+    }
+    pthread_mutex_init(&pool->Lock, 0);
+    pthread_cond_init(&pool->Start, 0);
+    pthread_cond_init(&pool->Done, 0);
+
+    // The calling thread doubles as worker 0.
+    pool->ThreadCount = 1;
+    pool->Workers[0].Pool = pool;
+    for (int i = 1; i < threadCount; i++) {
+        WarpWorker* worker = pool->Workers + i;
+        worker->Pool = pool;
+        worker->Index = i;
+        if (pthread_create(&worker->Thread, 0, WorkerMain, worker)) {
+            break;
+        }
+        pool->ThreadCount++;
+    }
+    return pool;
+}
+
+void warpDestroyPool(WarpPool* pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->Lock);
+    pool->Quit = true;
+    pthread_cond_broadcast(&pool->Start);
+    pthread_mutex_unlock(&pool->Lock);
+
+    for (int i = 0; i < pool->ThreadCount; i++) {
+        if (i > 0) {
+            pthread_join(pool->Workers[i].Thread, 0);
+        }
+        free(pool->Workers[i].Taps);
+        free(pool->Workers[i].Points);
+    }
+    pthread_cond_destroy(&pool->Done);
+    pthread_cond_destroy(&pool->Start);
+    pthread_mutex_destroy(&pool->Lock);
+    free(pool->Workers);
+    free(pool);
+}
+
+int warpPoolThreads(const WarpPool* pool)
+{
+    return pool->ThreadCount;
+}
+
+int warpTileCount(int width, int height, int tileSize)
+{
+    if (tileSize <= 0) {
+        tileSize = WARP_TILE_SIZE;
+    }
+    return ((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize);
+}
+
+static bool ReserveScratch(WarpPool* pool, int tileSize)
+{
+    if (tileSize <= pool->ScratchSize) {
+        return true;
+    }
+    for (int i = 0; i < pool->ThreadCount; i++) {
+        WarpWorker* worker = pool->Workers + i;
+        free(worker->Taps);
+        free(worker->Points);
+        worker->Taps = (WarpTap*) malloc(sizeof(WarpTap) * tileSize * tileSize);
+        worker->Points = (float*) malloc(sizeof(float) * 2 * (tileSize + 1) * (tileSize + 1));
+        if (!worker->Taps || !worker->Points) {
+            pool->ScratchSize = 0;
+            return false;
+        }
+    }
+    pool->ScratchSize = tileSize;
+    return true;
+}
+
+int warpBarrelTiled(WarpPool* pool, const WarpImage* src, WarpImage* dst, float barrelPower,
+                    const WarpFill* fill, int tileSize, WarpTileStats* stats)
+{
+    if (src->Channels != dst->Channels || src->Channels < 1 || src->Channels > 4 ||
+        src->Width < 1 || src->Height < 1 || src->Width > 65535 || src->Height > 65535) {
+        return 0;
+    }
+    if (tileSize <= 0) {
+        tileSize = WARP_TILE_SIZE;
+    }
+    if (!ReserveScratch(pool, tileSize)) {
+        return 0;
+    }
+
+    // Resolve the ISA before any worker asks for it.
+    warpGetIsa();
+
+    WarpJob job = {src, dst, fill, BarrelLens(barrelPower), tileSize,
+                   (dst->Width + tileSize - 1) / tileSize, stats};
+    int tileCount = warpTileCount(dst->Width, dst->Height, tileSize);
+
+    pthread_mutex_lock(&pool->Lock);
+    pool->Job = job;
+    for (int i = 0; i < pool->ThreadCount; i++) {
+        unsigned long long top = (unsigned long long) tileCount * i / pool->ThreadCount;
+        unsigned long long bottom = (unsigned long long) tileCount * (i + 1) / pool->ThreadCount;
+        __atomic_store_n(&pool->Workers[i].Range, top << 32 | bottom, __ATOMIC_RELEASE);
+    }
+    pool->Busy = pool->ThreadCount - 1;
+    pool->Generation++;
+    pthread_cond_broadcast(&pool->Start);
+    pthread_mutex_unlock(&pool->Lock);
+
+    RunTiles(pool->Workers);
+
+    pthread_mutex_lock(&pool->Lock);
+    while (pool->Busy > 0) {
+        pthread_cond_wait(&pool->Done, &pool->Lock);
+    }
+    pthread_mutex_unlock(&pool->Lock);
+    return 1;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "lens.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CPU implementation of the gridless barrel warp in TextureWarping-Gridless.glsl.
+// It reproduces Quad.FS: the BarrelPower polar remap, the fwidth-based
+// border fade, and clamp-to-edge bilinear filtering.
+
+typedef struct WarpImageRec {
+    int Width;
+    int Height;
+    int Channels;           // 1 to 4 interleaved 8-bit channels
+    int Stride;             // bytes between consecutive rows
+    unsigned char* Pixels;
+} WarpImage;
+
+// Everything the sampler needs for one output pixel, in four 16-bit words:
+// the top-left source texel, the 8-bit bilinear weights, and the border fade.
+typedef struct WarpTapRec {
+    unsigned short X;
+    unsigned short Y;
+    unsigned char FracX;
+    unsigned char FracY;
+    unsigned char Coverage;
+    unsigned char Flags;
+} WarpTap;
+
+enum { WARP_TAP_SOURCE = 1 };
+
+// Output = mix(Border, Source or Background, Coverage).
+typedef struct WarpFillRec {
+    unsigned char Background[4];
+    unsigned char Border[4];
+} WarpFill;
+
+enum { WARP_ISA_SCALAR, WARP_ISA_SSE2, WARP_ISA_AVX2 };
+
+int warpGetIsa();
+int warpSetIsa(int isa);
+WarpFill warpDefaultFill();
+
+int warpBarrelTaps(WarpTap* taps, int firstRow, int rowCount,
+                   int width, int height, int srcWidth, int srcHeight, float barrelPower);
+void warpGather(const WarpImage* src, const WarpTap* taps, const WarpFill* fill,
+                unsigned char* dst, int count);
+int warpBarrel(const WarpImage* src, WarpImage* dst, float barrelPower, const WarpFill* fill);
+
+// A full-frame table of taps.  Once built, warping is a pure gather.
+// The taps are laid out so that the table can be uploaded directly as
+// a GL_RGBA16UI texture.
+typedef struct WarpMapRec {
+    float Power;
+    int Width;
+    int Height;
+    int SrcWidth;
+    int SrcHeight;
+    WarpTap* Taps;
+} WarpMap;
+
+WarpMap* warpCreateMap(float barrelPower, int width, int height, int srcWidth, int srcHeight);
+
+// Map for any lens model.  An inverse map undoes the warp, so applying it
+// to an image that was warped by the model recovers the original.  For
+// inverse maps, tolerance is passed to lensUndistort.  Power is set only
+// for power models.
+WarpMap* warpCreateLensMap(const LensModel* model, int inverse, float tolerance,
+                           int width, int height, int srcWidth, int srcHeight);
+void warpDestroyMap(WarpMap* map);
+int warpApplyMap(const WarpImage* src, const WarpMap* map, WarpImage* dst, const WarpFill* fill);
+
+// One map per color channel, for lateral chromatic aberration.  Applying
+// them warps red, green and blue in a single pass over a 3 or 4 channel
+// image, with alpha following green.
+int warpCreateChromaMaps(const LensModel* model, const LensChroma* chroma,
+                         int width, int height, int srcWidth, int srcHeight, WarpMap** maps);
+int warpApplyChromaMaps(const WarpImage* src, WarpMap* const* maps, WarpImage* dst, const WarpFill* fill);
+
+// Maps that reproduce the textured meshes of the grid demos instead of the
+// per-pixel warp.  Rows and columns match GridRows and GridCols there.
+enum { WARP_GRID_UNIFORM, WARP_GRID_PINCUSHION, WARP_GRID_NONUNIFORM };
+
+WarpMap* warpCreateGridMap(int layout, float barrelPower, int rows, int columns,
+                           int width, int height, int srcWidth, int srcHeight);
+
+// The meshes themselves.  Vertices are laid out column by column, as
+// positions and texture coordinates in normalized device coordinates,
+// (rows + 1) * (columns + 1) of each.  Indices are the same triangles as
+// the index buffer in CreateGrid, 6 * rows * columns of them.
+void warpGridVertices(int layout, float barrelPower, int rows, int columns,
+                      float* positions, float* texCoords);
+void warpGridIndices(int rows, int columns, unsigned int* indices);
+
+// Least-recently-used set of maps keyed by (power, size, source size).
+// Powers are snapped to multiples of powerStep, or matched exactly if it's 0.
+typedef struct WarpCacheRec WarpCache;
+
+WarpCache* warpCreateCache(int capacity, float powerStep);
+void warpDestroyCache(WarpCache* cache);
+const WarpMap* warpCacheMap(WarpCache* cache, float barrelPower,
+                            int width, int height, int srcWidth, int srcHeight);
+
+// Maps sampled uniformly across a range of barrel powers, for animated
+// distortion.  Powers in between are handled by blending the taps of the two
+// nearest maps.  MaxError is the worst blending error found at the interval
+// midpoints while building the bank, in source texels.
+typedef struct WarpBankRec {
+    float MinPower;
+    float MaxPower;
+    int Count;
+    float MaxError;
+    WarpMap** Maps;
+} WarpBank;
+
+WarpBank* warpCreateBank(float minPower, float maxPower, float maxError, int maxCount,
+                         int width, int height, int srcWidth, int srcHeight);
+void warpDestroyBank(WarpBank* bank);
+float warpBankPosition(const WarpBank* bank, float barrelPower);
+void warpBlendTaps(const WarpTap* a, const WarpTap* b, float t, WarpTap* taps, int count);
+int warpApplyBank(const WarpImage* src, const WarpBank* bank, float barrelPower,
+                  WarpImage* dst, const WarpFill* fill);
+
+// Multithreaded warp.  The output is split into square tiles that a pool of
+// threads works through, stealing from each other when they run out.
+// A tile size of 0 picks a default that keeps each tile's taps and pixels
+// in cache.  If stats is non-null it receives warpTileCount entries.
+typedef struct WarpPoolRec WarpPool;
+
+typedef struct WarpTileStatsRec {
+    int X;
+    int Y;
+    int Width;
+    int Height;
+    int Thread;
+    int Stolen;
+    double Seconds;
+} WarpTileStats;
+
+WarpPool* warpCreatePool(int threadCount);  // 0 for one thread per core
+void warpDestroyPool(WarpPool* pool);
+int warpPoolThreads(const WarpPool* pool);
+int warpTileCount(int width, int height, int tileSize);
+int warpBarrelTiled(WarpPool* pool, const WarpImage* src, WarpImage* dst, float barrelPower,
+                    const WarpFill* fill, int tileSize, WarpTileStats* stats);
+
+#ifdef __cplusplus
+}
+#endif